@@ -0,0 +1,74 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ACTION_SPACE_HH
+#define ACTION_SPACE_HH
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace pokezero {
+/*
+ * fixed action indices shared by search and the policy head, in showdown's
+ * own order: move slot s used with option o is s * MoveOptions + o, and a
+ * switch to party position p is MoveActions + p
+ */
+constexpr size_t MoveSlots = 4;
+constexpr size_t MoveOptions = 2; // plain, or with the gimmick (mega, z-move, dynamax, terastallize)
+constexpr size_t SwitchSlots = 6;
+constexpr size_t MoveActions = MoveSlots * MoveOptions;
+constexpr size_t ActionCount = MoveActions + SwitchSlots;
+
+// returned for a choice string outside the action space
+constexpr size_t NoAction = ActionCount;
+
+static_assert(ActionCount <= 32, "legal actions must fit in a 32 bit mask");
+
+size_t parseChoice(std::string_view);
+
+// a reply to one request, built without touching the heap
+typedef std::array<char, 48> ReplyBuffer;
+
+/*
+ * the legal actions of one player request and where each sits in the
+ * request's choices, decoded straight from the request text
+ */
+struct RequestActions {
+	enum Command : uint8_t { UNKNOWN, ACTIVE, FORCE_SWITCH, TEAM_PREVIEW };
+
+	Command command = UNKNOWN;
+	uint8_t choice_count = 0; // entries in the request's choices
+	uint32_t mask = 0;        // bit a is set when action a is legal
+
+	// index into the request's choices of each legal action
+	std::array<uint8_t, ActionCount> choice{};
+
+	static RequestActions decode(std::string_view);
+
+	bool legal(size_t action) const { return action < ActionCount && (this->mask >> action & 1); }
+	size_t count() const { return size_t(std::popcount(this->mask)); }
+
+	std::string_view reply(size_t, ReplyBuffer &) const;
+	std::string_view replyAction(size_t, ReplyBuffer &) const;
+};
+} // namespace pokezero
+
+#endif /* ACTION_SPACE_HH */
@@ -0,0 +1,95 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALLOC_STATS_HH
+#define ALLOC_STATS_HH
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/*
+ * allocation accounting: with POKEZERO_ALLOC_STATS defined (`make
+ * ALLOC_STATS=1`), global operator new counts every allocation and its bytes
+ * against the subsystem tag of the calling thread
+ *
+ * ALLOC_SCOPE(ALLOC_PARSE) tags the thread until the end of the enclosing
+ * block. Like TRACE_SCOPE it must not span a co_await, since the coroutine
+ * can resume on another thread. Otherwise the macro is empty and operator new
+ * is the standard one.
+ */
+#ifdef POKEZERO_ALLOC_STATS
+#define ALLOC_CONCAT_(a, b) a##b
+#define ALLOC_CONCAT(a, b)  ALLOC_CONCAT_(a, b)
+
+#define ALLOC_SCOPE(tag) pokezero::AllocScope ALLOC_CONCAT(alloc_scope_, __LINE__)(pokezero::tag)
+#else
+#define ALLOC_SCOPE(tag) \
+	do {             \
+	} while (false)
+#endif
+
+namespace pokezero {
+#ifdef POKEZERO_ALLOC_STATS
+constexpr bool AllocStatsEnabled = true;
+#else
+constexpr bool AllocStatsEnabled = false;
+#endif
+
+enum AllocTag : uint8_t {
+	ALLOC_OTHER,
+	ALLOC_MANAGER,
+	ALLOC_SOCKET,
+	ALLOC_PARSE,
+	ALLOC_FEATURIZE,
+	ALLOC_PLAYER,
+	ALLOC_TAG_COUNT
+};
+
+extern const char *const AllocTagNames[ALLOC_TAG_COUNT];
+
+extern thread_local AllocTag alloc_tag;
+
+class AllocScope {
+public:
+	// constructors
+	AllocScope(AllocTag tag) : saved(alloc_tag) { alloc_tag = tag; }
+
+	// destructor
+	~AllocScope() { alloc_tag = this->saved; }
+
+	AllocScope(const AllocScope &) = delete;
+	AllocScope &operator=(const AllocScope &) = delete;
+
+private:
+	AllocTag saved;
+};
+
+struct AllocStats {
+	std::array<uint64_t, ALLOC_TAG_COUNT> allocations{};
+	std::array<uint64_t, ALLOC_TAG_COUNT> bytes{};
+
+	AllocStats operator-(const AllocStats &) const;
+};
+
+AllocStats allocStats();
+void writeAllocReport(std::ostream &, const AllocStats &, uint64_t);
+} // namespace pokezero
+
+#endif /* ALLOC_STATS_HH */
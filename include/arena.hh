@@ -0,0 +1,92 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARENA_HH
+#define ARENA_HH
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "log.hh"
+#include "manager.hh"
+#include "placement.hh"
+#include "supervisor.hh"
+
+namespace pokezero {
+struct BattleResult {
+	int winner = -1;      // index of the winning player, -1 for a tie
+	bool aborted = false; // the node process failed on every attempt
+
+	// processor time each player spent on its own decisions, and how many
+	// it made
+	std::array<std::chrono::nanoseconds, 2> cpu{};
+	std::array<uint64_t, 2> decisions{};
+};
+
+// times a battle is started over on a new node process after one fails
+constexpr int BATTLE_RETRIES = 3;
+
+/*
+ * play one battle to the end and return who won and what each player's
+ * decisions cost; its samples go to the sink if one is given, and the
+ * endgame solver directs both sides under the given config
+ *
+ * the battle runs on the executor of the placement slot and its node process
+ * is pinned to the slot's cpus. A battle whose node process crashes or hangs
+ * is played again from the start on a new one; after BATTLE_RETRIES restarts
+ * it counts as a tie
+ */
+template <class P1, class P2>
+BattleResult
+playBattle(TrajectorySink *trajectories = nullptr, const std::string &name = "manager",
+           showdown::Placement::Slot slot = showdown::Placement::shared().next(),
+           const EndgameConfig &endgame = EndgameConfig())
+{
+	for (int attempt = 0;; attempt++) {
+		Manager<P1, P2> manager(name, slot.executor);
+		manager.trajectories = trajectories;
+		manager.endgame.config = endgame;
+		manager.node_cpus = slot.cpus();
+		manager.start();
+		manager.join();
+
+		if (!manager.aborted()) {
+			BattleResult result;
+			result.winner = manager.winnerSide();
+			for (size_t i = 0; i < 2; i++) {
+				result.cpu[i] = manager.player(i).cpuTime();
+				result.decisions[i] = manager.player(i).ownDecisions();
+			}
+			return result;
+		}
+		if (attempt == BATTLE_RETRIES) {
+			LOG_ERROR("arena", "battle failed on every attempt", "battle", name, "attempts", attempt + 1);
+			return {-1, true, {}, {}};
+		}
+
+		showdown::Supervisor::shared().countRestart();
+	}
+}
+
+int headToHead(int, char **);
+int benchPlacement(int, char **);
+} // namespace pokezero
+
+#endif /* ARENA_HH */
@@ -0,0 +1,104 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BOUNDED_QUEUE_HH
+#define BOUNDED_QUEUE_HH
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace pokezero {
+/*
+ * multi producer, multi consumer queue holding at most `capacity` items
+ *
+ * push() waits while the queue is full, so a slow stage holds back the ones
+ * feeding it instead of letting work pile up in memory; once every producer
+ * is done, close() lets consumers drain what is left and then stop
+ */
+template <class T>
+class BoundedQueue {
+public:
+	// constructors
+	BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+	/*
+	 * returns false, without queueing the item, if the queue was closed
+	 */
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lk(this->lock);
+		while (this->items.size() >= this->capacity && !this->closed) {
+			this->not_full.wait(lk);
+		}
+		if (this->closed) {
+			return false;
+		}
+
+		this->items.push_back(std::move(item));
+		lk.unlock();
+		this->not_empty.notify_one();
+
+		return true;
+	}
+
+	/*
+	 * returns false once the queue is closed and empty
+	 */
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lk(this->lock);
+		while (this->items.empty() && !this->closed) {
+			this->not_empty.wait(lk);
+		}
+		if (this->items.empty()) {
+			return false;
+		}
+
+		item = std::move(this->items.front());
+		this->items.pop_front();
+		lk.unlock();
+		this->not_full.notify_one();
+
+		return true;
+	}
+
+	void close()
+	{
+		std::unique_lock<std::mutex> lk(this->lock);
+		this->closed = true;
+		lk.unlock();
+
+		this->not_empty.notify_all();
+		this->not_full.notify_all();
+	}
+
+private:
+	size_t capacity;
+
+	std::mutex lock;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::deque<T> items;
+	bool closed = false;
+};
+} // namespace pokezero
+
+#endif /* BOUNDED_QUEUE_HH */
@@ -0,0 +1,180 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CLUSTER_HH
+#define CLUSTER_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hh"
+#include "metrics.hh"
+#include "socket_helper.hh"
+#include "trajectory.hh"
+
+namespace pokezero {
+/*
+ * self-play spread over many hosts: a coordinator hands battle jobs and
+ * model weights to worker daemons, which play the battles and send back
+ * their samples
+ *
+ * messages are json over a Socket, usually a "tcp:" one; weights and
+ * samples follow their message as a raw payload of the size it gives.
+ * A worker asks for a job whenever it is running low on battles and sends
+ * samples in batches, with at most `window` of them unacknowledged, so a
+ * coordinator that cannot keep up slows its workers down instead of
+ * buffering without bound
+ */
+// largest payloads a peer may announce: samples in one upload, and bytes of
+// weights; a message announcing more ends the connection
+constexpr size_t MaxUploadRecords = 1 << 16;
+constexpr size_t MaxModelBytes = size_t(1) << 30;
+
+struct CoordinatorConfig {
+	std::string address;      // socket to listen on, e.g. "tcp:*:7420"
+	std::string prefix;       // trajectory shard prefix
+	uint64_t battles = 1000;  // battles to hand out in all
+	size_t job_battles = 16;  // battles per job
+	std::string model;        // weights file handed to workers, "" for none
+};
+
+struct CoordinatorStats {
+	uint64_t battles = 0; // battles workers reported finished
+	uint64_t records = 0;
+	uint64_t turns = 0;
+	size_t workers = 0;   // workers that connected
+	double seconds = 0;
+};
+
+class Coordinator {
+public:
+	// constructors
+	Coordinator(const CoordinatorConfig &);
+
+	// destructor
+	~Coordinator();
+
+	CoordinatorStats run();
+
+private:
+	CoordinatorConfig config;
+	showdown::Socket server;
+	TrajectoryWriter writer;
+
+	std::mutex lock;
+	std::condition_variable changed;
+	uint64_t handed = 0; // battles out with workers or finished
+	size_t connected = 0;
+	CoordinatorStats counts;
+	std::vector<std::thread> threads;
+
+	// the weights file, sent again to each worker whenever it changes
+	uint32_t model_version = 0;
+	std::shared_ptr<const std::string> model_bytes;
+	std::filesystem::file_time_type model_time;
+
+	MetricsRegistry &metrics = MetricsRegistry::shared();
+
+	void serve(std::unique_ptr<showdown::Socket>);
+	uint64_t takeBattles();
+	uint32_t refreshModel(std::shared_ptr<const std::string> &);
+};
+
+struct WorkerConfig {
+	std::string address;          // coordinator's socket
+	size_t concurrency = 0;       // battles played at once; 0 for one per two hardware threads
+	size_t batch_records = 1024;  // samples per upload
+	size_t window = 4;            // uploads sent but not yet acknowledged
+	std::string model_dir = "/tmp";
+	bool synthetic = false;       // random samples instead of battles, to load test a coordinator
+};
+
+struct WorkerStats {
+	uint64_t battles = 0;
+	uint64_t records = 0;
+	uint64_t uploads = 0;
+	double seconds = 0;
+};
+
+class Worker : public TrajectorySink {
+public:
+	// constructors
+	Worker(const WorkerConfig &);
+
+	WorkerStats run();
+
+	void append(const TrajectoryRecord *, size_t) override;
+
+private:
+	// a batch of samples and the battles and turns that finished with it
+	struct Upload {
+		std::vector<TrajectoryRecord> records;
+		uint64_t battles = 0;
+		uint64_t turns = 0;
+	};
+
+	WorkerConfig config;
+	showdown::Socket socket;
+	std::mutex send_lock;
+
+	// jobs from the coordinator, shared by the battle threads
+	std::mutex lock;
+	std::condition_variable changed;
+	uint64_t available = 0; // battles handed out and not started
+	bool requested = false; // a job request is unanswered
+	bool done = false;      // the coordinator has no more battles, or is gone
+	bool closed = false;    // the coordinator is gone
+	size_t acked = 0;       // uploads the coordinator has written
+
+	std::atomic<uint32_t> model_version{0};
+	uint64_t turns_reported = 0;
+
+	// samples are gathered into batches, which the uploader sends in order;
+	// each append() is one battle's samples, and a battle is reported with
+	// the upload holding its last one
+	std::mutex batch_lock;
+	std::vector<TrajectoryRecord> batch;
+	std::vector<size_t> battle_ends; // one past each unreported battle's last sample in batch
+	BoundedQueue<Upload> uploads;
+
+	WorkerStats counts;
+
+	void send(const std::string &, std::string_view payload = {});
+	void receive();
+	void upload();
+	void play(size_t);
+	bool nextBattle();
+	void syntheticBattle(std::mt19937 &);
+	void seal(size_t);
+	void saveModel(uint32_t, const std::string &);
+};
+
+int coordinate(int, char **);
+int work(int, char **);
+} // namespace pokezero
+
+#endif /* CLUSTER_HH */
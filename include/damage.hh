@@ -0,0 +1,62 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DAMAGE_HH
+#define DAMAGE_HH
+
+#include <array>
+
+#include "battle_parser.hh"
+
+namespace pokezero {
+// showdown draws one of 16 damage rolls, 85% to 100% of the base damage
+constexpr size_t NumRolls = 16;
+typedef std::array<float, NumRolls> DamageRolls;
+
+struct DamageTable {
+	float expected[4][6] = {}; // expected hp lost by each target to each move, capped at its current hp
+	float ko[4][6] = {};       // chance each move knocks out each target from its current hp
+	float hp[6] = {};          // current hp of each target, 0 if fainted or unknown
+};
+
+/*
+ * damage calculator following showdown's integer damage pipeline
+ *
+ * rolls() is the scalar formula for one attack. compute() evaluates every
+ * move of one Pokemon against the whole opposing party at once; the party is
+ * laid out as structure of arrays padded to a fixed lane count so the inner
+ * loops vectorize. Accuracy is folded into both expected damage and KO
+ * chance. Crits, items, abilities, weather, screens and burns are not
+ * modelled.
+ */
+class DamageCalc {
+public:
+	// constructors
+	DamageCalc(double level = 100) : level(level) {}
+
+	static DamageRolls rolls(double, double, double, double, bool, double);
+	DamageTable compute(const MLVec &, size_t, int attacker = -1) const;
+
+	// level assumed for every Pokemon, since the MLVec does not store it
+	double level;
+};
+
+int benchDamage(int, char **);
+} // namespace pokezero
+
+#endif /* DAMAGE_HH */
@@ -0,0 +1,147 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DATASET_HH
+#define DATASET_HH
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trajectory.hh"
+
+namespace pokezero {
+/*
+ * random access to the records of a set of trajectory shards
+ *
+ * shards are mapped read only and left to the page cache, so the dataset can
+ * be far larger than memory; the only index kept is where each shard starts.
+ * Records are numbered in the order their shards were added and keep their
+ * numbers when older shards are dropped
+ */
+class TrajectoryDataset {
+public:
+	// constructors
+	TrajectoryDataset() {}
+	TrajectoryDataset(const std::vector<std::string> &);
+	TrajectoryDataset(const TrajectoryDataset &) = delete;
+
+	// destructor
+	~TrajectoryDataset();
+
+	void add(const std::string &);
+	size_t trim(uint64_t);
+
+	uint64_t begin();
+	uint64_t end();
+
+	void read(const uint64_t *, size_t, TrajectoryRecord *);
+
+	// fills in record numbers from the range held when called, as
+	// pick(begin, end, numbers)
+	typedef std::function<void(uint64_t, uint64_t, std::vector<uint64_t> &)> Picker;
+	bool sample(const Picker &, std::vector<uint64_t> &, TrajectoryRecord *);
+
+private:
+	struct Shard {
+		std::string path;
+		const TrajectoryHeader *header;
+		size_t size; // bytes mapped
+		uint64_t first; // number of the shard's first record
+	};
+
+	std::shared_mutex lock;
+	std::deque<Shard> shards;
+	uint64_t first = 0; // number of the first record still held
+	uint64_t last = 0;  // one past the number of the newest record
+
+	const TrajectoryRecord &record(uint64_t) const;
+};
+
+/*
+ * one mini-batch laid out contiguously for the trainer
+ */
+struct Batch {
+	size_t size = 0;
+	std::vector<float> states;   // size x BattleStateSize
+	std::vector<float> policies; // size x ActionCount
+	std::vector<uint32_t> masks;
+	std::vector<float> outcomes;
+};
+
+/*
+ * serves shuffled mini-batches of a dataset, gathered ahead of time by a
+ * background thread
+ *
+ * with no window every record is visited once per epoch, in an order given
+ * by a keyed permutation rather than a shuffled index array, so shuffling
+ * billions of records needs no memory. With a window it acts as a replay
+ * buffer: each batch is drawn uniformly, with replacement, from the newest
+ * `window` records, and shards added to the dataset are picked up as they
+ * arrive
+ */
+class BatchLoader {
+public:
+	// constructors
+	BatchLoader(TrajectoryDataset &, size_t batch_size, uint64_t window = 0, size_t depth = 4, uint64_t seed = 0);
+
+	// destructor
+	~BatchLoader();
+
+	void next(Batch &);
+
+	uint64_t epoch();
+
+private:
+	TrajectoryDataset &dataset;
+	size_t batch_size;
+	uint64_t window;
+	uint64_t seed;
+
+	std::mutex lock;
+	std::condition_variable ready;    // a batch was gathered
+	std::condition_variable consumed; // a batch was taken
+	std::deque<Batch> batches;
+	std::vector<Batch> spare;
+	size_t depth;
+	bool stopping = false;
+
+	// position in the current epoch's permutation, or batches drawn from the
+	// replay window
+	uint64_t epochs = 0;
+	uint64_t position = 0;
+	uint64_t epoch_begin = 0;
+	uint64_t epoch_count = 0;
+
+	std::vector<std::thread> threads;
+
+	void loop();
+	void gather(Batch &, std::vector<uint64_t> &, std::vector<TrajectoryRecord> &);
+	void pick(uint64_t, uint64_t, std::vector<uint64_t> &);
+};
+
+int benchDataset(int, char **);
+} // namespace pokezero
+
+#endif /* DATASET_HH */
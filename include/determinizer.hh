@@ -0,0 +1,106 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DETERMINIZER_HH
+#define DETERMINIZER_HH
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "battle_parser.hh"
+#include "dex.hh"
+
+namespace pokezero {
+/*
+ * what has been seen of one opposing Pokemon; ids are the ones used in the
+ * MLVec (data/ability_id.json, item_id.json, move_id.json)
+ */
+struct Revealed {
+	std::string species;    // pokedex key, e.g. "garchomp"
+	int ability = -1;       // -1 until revealed
+	int item = -1;          // -1 until revealed
+	std::vector<int> moves; // moves seen so far
+	double level = 100;     // level the set's stats are computed for
+};
+
+struct SampledSet {
+	int ability = -1;
+	int item = -1;
+	int moves[4] = {-1, -1, -1, -1};
+	double stats[6] = {0, 0, 0, 0, 0, 0}; // raw hp, atk, def, spa, spd, spe
+	uint32_t types = 0;                   // bit set of type ids
+};
+
+/*
+ * samples plausible hidden opponent sets consistent with what has been
+ * revealed
+ *
+ * per species ability, move and item distributions are built once from the
+ * dex data into alias tables so each draw is O(1) and never touches json
+ *
+ * the dex has no learnsets, so the move pools are a placeholder: damaging
+ * moves of the species' own types plus status moves shared by every species
+ */
+class Determinizer {
+public:
+	// damaging moves of its own types kept per species
+	static constexpr size_t MovePoolSize = 24;
+
+	static const Determinizer &get();
+
+	bool knows(const std::string &species) const { return this->species.count(species) > 0; }
+	SampledSet sample(const Revealed &, std::mt19937 &) const;
+	void determinize(MLVec &, size_t, const std::vector<std::string> &, const std::vector<Revealed> &,
+	                 std::mt19937 &) const;
+
+private:
+	// constructors
+	Determinizer();
+
+	/*
+	 * Walker alias table for O(1) draws from a fixed discrete distribution
+	 */
+	struct AliasTable {
+		std::vector<float> probability;
+		std::vector<uint32_t> alias;
+		std::vector<int> values;
+
+		AliasTable() {}
+		AliasTable(const std::vector<int> &, const std::vector<double> &);
+		int draw(std::mt19937 &) const;
+	};
+
+	struct SpeciesTables {
+		double base_stats[6];
+		uint32_t types;
+		AliasTable abilities;
+		AliasTable moves;
+	};
+
+	std::unordered_map<std::string, SpeciesTables> species;
+	AliasTable items;
+	AliasTable status_moves;
+};
+
+int benchDeterminizer(int, char **);
+} // namespace pokezero
+
+#endif /* DETERMINIZER_HH */
@@ -0,0 +1,75 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEX_HH
+#define DEX_HH
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace pokezero {
+// number of Pokemon types, in the order of data/type_id.json
+constexpr size_t NumTypes = 18;
+
+enum MoveCategory : uint8_t { PHYSICAL, SPECIAL, STATUS };
+
+struct MoveInfo {
+	float base_power = 0;           // 0 for status and variable power moves
+	float accuracy = 1;             // hit chance in [0, 1]; 1 for moves that never miss
+	uint8_t type = 0;               // type id
+	MoveCategory category = STATUS; // damage class
+	int8_t priority = 0;            // move priority bracket
+	uint8_t pp = 0;                 // base pp; 1 for z-moves and max moves
+};
+
+/*
+ * compact tables precomputed once from the json files in data/ for code that
+ * needs move and type data without touching json on the hot path
+ *
+ * moves are indexed by their id from data/move_id.json, the same id stored
+ * in Move::id of the MLVec
+ */
+class Dex {
+public:
+	static const Dex &get();
+
+	const MoveInfo &move(size_t id) const { return this->moves.at(id); }
+	const std::string &moveName(size_t id) const { return this->move_names.at(id); }
+	size_t numMoves() const { return this->moves.size(); }
+
+	// damage multiplier of an attack of one type against a defender of another
+	float effectiveness(size_t attack, size_t defend) const { return this->type_chart[attack][defend]; }
+	float matchup(size_t, uint32_t) const;
+	int typeId(const std::string &) const;
+	const std::string &typeName(size_t id) const { return this->type_names.at(id); }
+
+private:
+	// constructors
+	Dex();
+
+	std::vector<MoveInfo> moves;
+	std::vector<std::string> move_names;
+	std::vector<std::string> type_names;
+	std::map<std::string, int> type_ids;
+	float type_chart[NumTypes][NumTypes];
+};
+} // namespace pokezero
+
+#endif /* DEX_HH */
@@ -0,0 +1,135 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENDGAME_HH
+#define ENDGAME_HH
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "battle_parser.hh"
+#include "damage.hh"
+#include "search.hh"
+
+namespace pokezero {
+struct Action {
+	enum Kind : uint8_t { PASS, MOVE, SWITCH };
+
+	Kind kind = PASS;
+	uint8_t index = 0; // move index or party index, both in MLVec order
+};
+
+struct EndgameConfig {
+	// the solver takes over once both sides have at most this many Pokemon
+	// left; 0 disables it
+	size_t threshold = 2;
+
+	// time allowed per solve
+	std::chrono::microseconds budget = std::chrono::milliseconds(200);
+
+	// deepest horizon (in turns) tried by iterative deepening
+	size_t max_depth = 16;
+
+	// level assumed by the damage formula
+	double level = 100;
+};
+
+struct EndgameResult {
+	Action action;           // action drawn from the strategy for the solved side
+	std::vector<std::pair<Action, double>> strategy; // equilibrium mix over the solved side's actions
+	double value = 0;        // game value in [-1, 1] for the solved side
+	size_t depth = 0;        // deepest fully searched horizon
+	uint64_t nodes = 0;      // decision nodes expanded
+	uint64_t cache_hits = 0; // decision nodes answered from the cache
+	bool exact = false;      // every line reached the end of the battle
+};
+
+/*
+ * expectiminimax solver for positions with few Pokemon left
+ *
+ * each turn both sides choose simultaneously, so every turn is a zero-sum
+ * matrix game over the joint choices, solved for its mixed equilibrium, with
+ * chance nodes for accuracy, damage rolls and speed ties. Search is
+ * iterative deepening in turns with a transposition cache over the dynamic
+ * state. Status moves, items and abilities are not modelled.
+ */
+class EndgameSolver {
+public:
+	// constructors
+	EndgameSolver(EndgameConfig config = EndgameConfig()) : config(config) {}
+
+	bool applies(const MLVec &) const;
+	EndgameResult solve(const MLVec &, size_t);
+
+	EndgameConfig config;
+
+private:
+	struct Mon {
+		float hp;         // current hp
+		float maxhp;      // maximum hp
+		float stats[5];   // boosted atk, def, spa, spd, spe
+		uint32_t types;   // bit set of type ids
+		int16_t moves[4]; // move ids in MLVec order, -1 if missing or unusable
+	};
+
+	struct SideState {
+		Mon mons[6];    // party in MLVec order
+		uint8_t active; // index of the active Pokemon
+	};
+
+	struct CacheEntry {
+		double value;
+		bool exact; // the value did not depend on the search horizon
+	};
+
+	struct State {
+		SideState sides[2];
+	};
+
+	struct Outcome {
+		double probability;
+		State state;
+	};
+
+	struct Aborted {};
+
+	std::unordered_map<uint64_t, CacheEntry> cache;
+	uint64_t nodes = 0;
+	uint64_t cache_hits = 0;
+	bool hit_horizon = false;
+	const Deadline *deadline = nullptr;
+	std::mt19937 rng{std::random_device{}()};
+
+	State compact(const MLVec &, size_t) const;
+	std::vector<Action> actions(const State &, size_t) const;
+	void resolve(const State &, const Action (&)[2], std::vector<Outcome> &) const;
+	void attack(const Outcome &, size_t, const Action &, std::vector<Outcome> &) const;
+	DamageRolls damage(const Mon &, const Mon &, uint16_t) const;
+
+	double search(const State &, size_t, std::vector<double> *strategy = nullptr);
+	double turnValue(const State &, const Action &, const Action &, size_t);
+	double heuristic(const State &) const;
+	uint64_t hash(const State &, size_t) const;
+};
+} // namespace pokezero
+
+#endif /* ENDGAME_HH */
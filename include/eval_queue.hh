@@ -0,0 +1,99 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVAL_QUEUE_HH
+#define EVAL_QUEUE_HH
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "action_space.hh"
+#include "battle_parser.hh"
+
+namespace pokezero {
+// size of the policy head: one output per action of the fixed action space
+constexpr size_t PolicySize = ActionCount;
+
+struct Evaluation {
+	float value;                          // expected outcome in [-1, 1] for the side to move
+	std::array<float, PolicySize> policy; // prior probability of each action
+};
+
+// evaluates n contiguous states at once, writing one Evaluation per state
+typedef std::function<void(const MLVec *, size_t, Evaluation *)> BatchEvaluator;
+
+struct EvalQueueStats {
+	uint64_t batches = 0;       // number of batched evaluator calls
+	uint64_t evaluations = 0;   // number of states evaluated
+	double mean_fill = 0;       // mean batch size / max batch size
+	double mean_latency_us = 0; // mean time from submit() to result
+	double max_latency_us = 0;  // worst time from submit() to result
+};
+
+class EvalQueue {
+public:
+	// constructors
+	EvalQueue(BatchEvaluator, size_t max_batch = 64,
+	          std::chrono::microseconds max_delay = std::chrono::microseconds(200));
+
+	// destructor
+	~EvalQueue();
+
+	std::future<Evaluation> submit(const MLVec &);
+	EvalQueueStats stats();
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	struct Pending {
+		MLVec state;
+		std::promise<Evaluation> result;
+		clock::time_point enqueued;
+	};
+
+	BatchEvaluator evaluator;
+	size_t max_batch;
+	std::chrono::microseconds max_delay;
+
+	std::mutex queue_lock;
+	std::condition_variable queue_cv;
+	std::deque<Pending> pending;
+	bool stopping = false;
+
+	// metrics, written only by the batching thread
+	std::atomic<uint64_t> batches{0};
+	std::atomic<uint64_t> evaluations{0};
+	std::atomic<uint64_t> latency_ns_sum{0};
+	std::atomic<uint64_t> latency_ns_max{0};
+
+	std::vector<std::thread> threads;
+
+	void loop();
+	void runBatch(std::vector<Pending> &, std::vector<MLVec> &, std::vector<Evaluation> &);
+};
+} // namespace pokezero
+
+#endif /* EVAL_QUEUE_HH */
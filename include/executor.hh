@@ -0,0 +1,307 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXECUTOR_HH
+#define EXECUTOR_HH
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace showdown {
+/*
+ * where a Task keeps its result or the exception it ended with
+ */
+template <class T>
+struct TaskResult {
+	std::optional<T> value;
+	std::exception_ptr exception;
+
+	void return_value(T value) { this->value = std::move(value); }
+
+	T take()
+	{
+		if (this->exception) {
+			std::rethrow_exception(this->exception);
+		}
+		return std::move(*this->value);
+	}
+};
+
+template <>
+struct TaskResult<void> {
+	std::exception_ptr exception;
+
+	void return_void() {}
+
+	void take()
+	{
+		if (this->exception) {
+			std::rethrow_exception(this->exception);
+		}
+	}
+};
+
+/*
+ * lazily started coroutine producing a T
+ *
+ * awaiting a Task starts it; when it finishes it resumes the awaiting
+ * coroutine directly (symmetric transfer), so chains of Tasks do not grow the
+ * stack or bounce through the executor
+ */
+template <class T = void>
+class Task {
+public:
+	struct promise_type : TaskResult<T> {
+		std::coroutine_handle<> continuation = std::noop_coroutine();
+
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		void unhandled_exception() { this->exception = std::current_exception(); }
+
+		struct FinalAwaiter {
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+			{
+				return handle.promise().continuation;
+			}
+			void await_resume() noexcept {}
+		};
+
+		FinalAwaiter final_suspend() noexcept { return {}; }
+	};
+
+	// constructors
+	Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+	Task(const Task &) = delete;
+
+	// destructor
+	~Task()
+	{
+		if (this->handle) {
+			this->handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+	{
+		this->handle.promise().continuation = awaiter;
+		return this->handle;
+	}
+	T await_resume() { return this->handle.promise().take(); }
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+/*
+ * a small fixed pool of worker threads that resume coroutines, plus one
+ * reactor thread that waits on file descriptors with epoll
+ *
+ * coroutines waiting on a socket or a move directive hold no thread, so the
+ * thread count does not grow with the number of battles
+ */
+class Executor {
+public:
+	// constructors
+	Executor(size_t threads = 0, std::vector<int> cpus = {});
+
+	// destructor
+	~Executor();
+
+	static Executor &shared();
+
+	void post(std::coroutine_handle<>);
+
+	// resumes the awaiting coroutine on a worker thread
+	struct Schedule {
+		Executor &executor;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { this->executor.post(handle); }
+		void await_resume() const noexcept {}
+	};
+
+	// resumes the awaiting coroutine once the descriptor is readable (or
+	// closed)
+	struct Readable {
+		Executor &executor;
+		int fd;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { this->executor.watch(this->fd, handle); }
+		void await_resume() const noexcept {}
+	};
+
+	Schedule schedule() { return {*this}; }
+	Readable readable(int fd) { return {*this, fd}; }
+	size_t workers() const { return this->threads.size() - 1; }
+
+private:
+	std::mutex lock;
+	std::condition_variable ready_cv;
+	std::deque<std::coroutine_handle<>> ready;
+	bool stopping = false;
+
+	int epoll_fd = -1;
+	int wake_fd = -1;
+
+	std::vector<std::thread> threads;
+	std::vector<int> cpus; // every thread is pinned to these, unless empty
+
+	void watch(int, std::coroutine_handle<>);
+	void work();
+	void react();
+};
+
+/*
+ * result of a Task that was started right away, awaited some time later
+ *
+ * the result is kept until it is consumed, so the awaiting coroutine does not
+ * have to be suspended when the Task finishes; only one coroutine may await a
+ * Future
+ */
+template <class T>
+class Future {
+public:
+	bool await_ready()
+	{
+		std::lock_guard<std::mutex> lk(this->state->lock);
+		return this->state->done;
+	}
+
+	bool await_suspend(std::coroutine_handle<> handle)
+	{
+		std::lock_guard<std::mutex> lk(this->state->lock);
+		if (this->state->done) {
+			return false;
+		}
+		this->state->waiter = handle;
+		return true;
+	}
+
+	T await_resume() { return this->state->result.take(); }
+
+private:
+	friend class TaskGroup;
+
+	struct State {
+		std::mutex lock;
+		TaskResult<T> result;
+		bool done = false;
+		std::coroutine_handle<> waiter;
+	};
+
+	std::shared_ptr<State> state = std::make_shared<State>();
+
+	static Task<void> fill(Executor &, std::shared_ptr<State>, Task<T>);
+};
+
+/*
+ * runs Tasks to completion on an executor without anyone awaiting them and
+ * lets a plain thread wait for all of them to finish
+ */
+class TaskGroup {
+public:
+	// constructors
+	TaskGroup(Executor &executor) : executor(executor) {}
+
+	// destructor
+	~TaskGroup() { this->wait(); }
+
+	void spawn(Task<void>);
+	void wait();
+
+	template <class T>
+	Future<T> start(Task<T>);
+
+private:
+	// eagerly started coroutine that frees itself when it finishes
+	struct Detached {
+		struct promise_type {
+			Detached get_return_object() { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+
+	Executor &executor;
+
+	std::mutex lock;
+	std::condition_variable done;
+	size_t running = 0;
+
+	static Detached run(TaskGroup *, Task<void>);
+};
+
+/*
+ * run the Task to completion and hand its result, or exception, to whoever
+ * awaits the Future
+ */
+template <class T>
+Task<void>
+Future<T>::fill(Executor &executor, std::shared_ptr<State> state, Task<T> task)
+{
+	try {
+		if constexpr (std::is_void_v<T>) {
+			co_await task;
+		} else {
+			state->result.return_value(co_await task);
+		}
+	} catch (...) {
+		state->result.exception = std::current_exception();
+	}
+
+	std::unique_lock<std::mutex> lk(state->lock);
+	state->done = true;
+	std::coroutine_handle<> waiter = std::exchange(state->waiter, nullptr);
+	lk.unlock();
+
+	if (waiter) {
+		executor.post(waiter);
+	}
+}
+
+/*
+ * start a task on the executor now and return a Future for its result; like
+ * spawn(), wait() also waits for it
+ */
+template <class T>
+Future<T>
+TaskGroup::start(Task<T> task)
+{
+	Future<T> future;
+	this->spawn(Future<T>::fill(this->executor, future.state, std::move(task)));
+	return future;
+}
+} // namespace showdown
+
+#endif /* EXECUTOR_HH */
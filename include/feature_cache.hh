@@ -0,0 +1,101 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FEATURE_CACHE_HH
+#define FEATURE_CACHE_HH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "battle_parser.hh"
+
+namespace pokezero {
+/*
+ * everything the manager takes from one response of the node process
+ */
+struct Features {
+	BattleParser::ResponseType type = BattleParser::EMPTY;
+	MLVec vec;
+
+	// each side's showdown choice for every action in MLVec order
+	std::array<std::vector<std::string>, 2> choices;
+	// whether each side has a request to answer in this state
+	std::array<bool, 2> requested{true, true};
+
+	std::string winner;
+};
+
+struct FeatureCacheStats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	size_t entries = 0;
+	double hit_rate = 0; // hits / lookups
+};
+
+/*
+ * Features of responses already parsed, keyed by a hash of the raw response
+ * bytes, so a repeated state costs a hash instead of a parse
+ *
+ * the entries are split over shards by hash, each with its own lock and
+ * least recently used eviction, so concurrent lookups from many battles
+ * rarely contend
+ */
+class FeatureCache {
+public:
+	static constexpr size_t Shards = 16;
+
+	// default bound on entries held, about 6KB each
+	static constexpr size_t default_capacity = 8192;
+
+	// constructors
+	FeatureCache(size_t capacity = default_capacity);
+
+	static FeatureCache &shared();
+
+	bool lookup(uint64_t, Features &);
+	void insert(uint64_t, const Features &);
+
+	FeatureCacheStats stats();
+
+private:
+	struct alignas(64) Shard {
+		typedef std::list<std::pair<uint64_t, Features>> Entries;
+
+		std::mutex lock;
+		Entries entries; // most recently used first
+		std::unordered_map<uint64_t, Entries::iterator> index;
+	};
+
+	size_t shard_capacity;
+	std::array<Shard, Shards> shards;
+
+	std::atomic<uint64_t> hits{0};
+	std::atomic<uint64_t> misses{0};
+
+	Shard &shard(uint64_t hash) { return this->shards[hash % Shards]; }
+};
+} // namespace pokezero
+
+#endif /* FEATURE_CACHE_HH */
@@ -0,0 +1,417 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FEATURE_SCHEMA_HH
+#define FEATURE_SCHEMA_HH
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace pokezero {
+/*
+ * raw values in [lo, hi] are stored scaled onto [-1, 1]; a range with lo ==
+ * hi stores them as they are
+ */
+struct FeatureRange {
+	double lo = 0;
+	double hi = 0;
+
+	constexpr bool identity() const { return this->lo == this->hi; }
+
+	constexpr double normalize(double raw) const
+	{
+		return this->identity() ? raw : (raw - this->lo) / (this->hi - this->lo) * 2 - 1;
+	}
+
+	constexpr double denormalize(double value) const
+	{
+		return this->identity() ? value : (value + 1) / 2 * (this->hi - this->lo) + this->lo;
+	}
+};
+
+constexpr FeatureRange FeatureId{};                // dex id, stored as is
+constexpr FeatureRange FeatureFlag{0, 1};          // -1 or 1
+constexpr FeatureRange FeatureRatio{0, 1};         // share of a maximum
+constexpr FeatureRange FeatureStat{0, 800};        // raw stat, Blissey's 714 hp being about the highest
+constexpr FeatureRange FeatureBoost{-6, 6};        // stat stage
+constexpr FeatureRange FeatureDuration{0, 7};      // turns left of a screen, tailwind, weather or terrain
+constexpr FeatureRange FeatureSpikes{0, 3};        // layers of spikes
+constexpr FeatureRange FeatureToxicSpikes{0, 2};   // layers of toxic spikes
+constexpr FeatureRange FeatureWishTurns{0, 1};     // turns until wish heals
+constexpr FeatureRange FeatureFutureTurns{0, 2};   // turns until a future move hits
+
+// value of every feature that is not set
+constexpr double FeatureAbsent = -1;
+} // namespace pokezero
+
+/*
+ * every feature of a battle state, in vector order
+ *
+ * FEATURE(name, count, range) is count values, or a single one for a count of
+ * 0, and RECORD(type, name, count) is count nested records. The records and
+ * FeatureSchemaHash are generated from these lists, so any change to them
+ * turns away shards and weights of the old layout
+ */
+#define MOVE_FEATURES(FEATURE, RECORD)                                                                           \
+	FEATURE(id, 0, FeatureId)         /* id of move */                                                       \
+	FEATURE(pp, 0, FeatureRatio)      /* current pp / max pp */                                              \
+	FEATURE(disabled, 0, FeatureFlag) /* whether the move is currently disabled */
+
+#define POKEMON_FEATURES(FEATURE, RECORD)                                                                        \
+	FEATURE(active, 0, FeatureFlag)  /* whether this Pokemon is currently active in battle */               \
+	FEATURE(types, 18, FeatureFlag)  /* whether the Pokemon has each type */                                \
+	FEATURE(ability, 0, FeatureId)   /* id of ability */                                                    \
+	FEATURE(item, 0, FeatureId)      /* id of item */                                                       \
+	FEATURE(status, 8, FeatureFlag)  /* whether the Pokemon has each status condition */                    \
+	FEATURE(hp, 0, FeatureRatio)     /* share of hp left */                                                 \
+	FEATURE(stats, 6, FeatureStat)   /* max hp, then the raw atk, def, spa, spd and spe */                  \
+	FEATURE(boosts, 7, FeatureBoost) /* stat boosts */                                                      \
+	FEATURE(trapped, 0, FeatureFlag) /* whether the Pokemon is trapped */                                   \
+	RECORD(Move, moves, 4)           /* moves Pokemon has, ordered by id */
+
+#define SIDE_FEATURES(FEATURE, RECORD)                                                                           \
+	RECORD(Pokemon, pokemon, 6)                 /* party, ordered by species id */                          \
+	FEATURE(volatiles, 15, FeatureFlag)         /* whether the active has each volatile condition */        \
+	FEATURE(stealthrock, 0, FeatureFlag)        /* if stealth rocks are up on given side */                 \
+	FEATURE(stickyweb, 0, FeatureFlag)          /* if sticky web is up on given side */                     \
+	FEATURE(spikes_ctr, 0, FeatureSpikes)       /* number of spikes on given side */                        \
+	FEATURE(tspikes_ctr, 0, FeatureToxicSpikes) /* number of toxic spikes on given side */                  \
+	FEATURE(ref_ctr, 0, FeatureDuration)        /* turns remaining of reflect on given side */              \
+	FEATURE(ls_ctr, 0, FeatureDuration)         /* turns remaining of light screen on given side */         \
+	FEATURE(av_ctr, 0, FeatureDuration)         /* turns remaining of aurora veil on given side */          \
+	FEATURE(tw_ctr, 0, FeatureDuration)         /* turns remaining of tailwind on given side */             \
+	FEATURE(wish_ctr, 0, FeatureWishTurns)      /* number of turns until wish heal on given side */         \
+	FEATURE(wish_hp, 0, FeatureStat)            /* amount of hp wish will heal */                           \
+	FEATURE(future_move, 0, FeatureFlag)        /* whether future sight has been casted on given side */    \
+	FEATURE(future_ctr, 0, FeatureFutureTurns)  /* turns until side's active takes future sight damage */
+
+#define BATTLE_STATE_FEATURES(FEATURE, RECORD)                                                                   \
+	RECORD(Side, sides, 2)                    /* both sides of Pokemon (self vs opponent) */                \
+	FEATURE(weather, 4, FeatureFlag)          /* whether each weather is up */                              \
+	FEATURE(weather_ctr, 0, FeatureDuration)  /* number of turns remaining of weather */                    \
+	FEATURE(terrain, 4, FeatureFlag)          /* whether each terrain is up */                              \
+	FEATURE(terrain_ctr, 0, FeatureDuration)  /* number of turns remaining of terrain */                    \
+	FEATURE(trick_room, 0, FeatureFlag)       /* whether trick room is up */                                \
+	FEATURE(tr_ctr, 0, FeatureDuration)       /* number of turns remaining of trick room */
+
+namespace {
+// the records only name a layout; their values are read through the views
+// below
+struct Move;
+struct Pokemon;
+struct Side;
+struct BattleState;
+} // namespace
+
+namespace pokezero {
+/*
+ * one entry of a record's schema
+ */
+struct FeatureField {
+	std::string_view name;
+	size_t count;              // 0 for a single value
+	FeatureRange range;        // of a value
+	const FeatureField *nested; // fields of a nested record, null for values
+	size_t nested_count;
+	size_t stride;             // values in one element
+	size_t offset = 0;         // index of the first value within the record
+
+	constexpr size_t elements() const { return this->count == 0 ? 1 : this->count; }
+	constexpr size_t width() const { return this->elements() * this->stride; }
+};
+
+/*
+ * fields of a record, with the offset of each and the record's width in
+ * values
+ */
+template <class Record>
+struct FeatureRecord;
+
+template <size_t N>
+constexpr std::array<FeatureField, N>
+layoutFeatures(std::array<FeatureField, N> fields)
+{
+	size_t offset = 0;
+	for (FeatureField &field: fields) {
+		field.offset = offset;
+		offset += field.width();
+	}
+	return fields;
+}
+
+#define FEATURE_FIELD(name, count, range) FeatureField{#name, count, range, nullptr, 0, 1},
+#define RECORD_FIELD(type, name, count)                                                                          \
+	FeatureField{#name, count, FeatureRange{}, FeatureRecord<type>::fields.data(),                           \
+	             FeatureRecord<type>::fields.size(), FeatureRecord<type>::width},
+
+#define FEATURE_RECORD(type, list)                                                                               \
+	template <>                                                                                              \
+	struct FeatureRecord<type> {                                                                             \
+		static constexpr auto fields =                                                                   \
+		        layoutFeatures(std::to_array<FeatureField>({list(FEATURE_FIELD, RECORD_FIELD)}));        \
+		static constexpr size_t width = fields.back().offset + fields.back().width();                     \
+	};
+
+FEATURE_RECORD(Move, MOVE_FEATURES)
+FEATURE_RECORD(Pokemon, POKEMON_FEATURES)
+FEATURE_RECORD(Side, SIDE_FEATURES)
+FEATURE_RECORD(BattleState, BATTLE_STATE_FEATURES)
+
+#undef FEATURE_FIELD
+#undef RECORD_FIELD
+#undef FEATURE_RECORD
+
+/*
+ * index of a field's first value within a record; throws
+ * std::invalid_argument for a name the record does not have, which fails the
+ * build where the offset is needed at compile time
+ */
+template <class Record>
+constexpr size_t
+featureOffset(std::string_view name)
+{
+	for (const FeatureField &field: FeatureRecord<Record>::fields) {
+		if (field.name == name) {
+			return field.offset;
+		}
+	}
+	throw std::invalid_argument("no such feature");
+}
+
+/*
+ * fnv-1a over the fields' names, shapes and ranges, nested records included
+ */
+constexpr uint64_t
+hashFeatureBytes(uint64_t hash, uint64_t value, size_t bytes = 8)
+{
+	for (size_t i = 0; i < bytes; i++) {
+		hash = (hash ^ ((value >> (8 * i)) & 0xff)) * 0x100000001b3;
+	}
+	return hash;
+}
+
+constexpr uint64_t
+hashFeatureFields(uint64_t hash, const FeatureField *fields, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		const FeatureField &field = fields[i];
+		for (char c: field.name) {
+			hash = hashFeatureBytes(hash, uint8_t(c), 1);
+		}
+		hash = hashFeatureBytes(hash, field.count);
+		hash = hashFeatureBytes(hash, std::bit_cast<uint64_t>(field.range.lo));
+		hash = hashFeatureBytes(hash, std::bit_cast<uint64_t>(field.range.hi));
+		if (field.nested) {
+			hash = hashFeatureBytes(hash, '{', 1);
+			hash = hashFeatureFields(hash, field.nested, field.nested_count);
+			hash = hashFeatureBytes(hash, '}', 1);
+		}
+	}
+	return hash;
+}
+
+// identifies the vector layout; stamped into shards and weights files
+constexpr uint64_t FeatureSchemaHash =
+        hashFeatureFields(0xcbf29ce484222325, FeatureRecord<BattleState>::fields.data(),
+                          FeatureRecord<BattleState>::fields.size());
+
+/*
+ * index into a vector of a feature named like "sides[1].pokemon[0].stats[3]";
+ * the element of an array may be left out for its first one. Throws
+ * std::invalid_argument for a name not in the schema, which fails the build
+ * where the index is needed at compile time
+ */
+constexpr size_t
+featureIndex(std::string_view name)
+{
+	const FeatureField *fields = FeatureRecord<BattleState>::fields.data();
+	size_t count = FeatureRecord<BattleState>::fields.size();
+	size_t index = 0;
+
+	while (true) {
+		size_t end = name.find_first_of("[.");
+		std::string_view part = name.substr(0, end);
+		name.remove_prefix(end == std::string_view::npos ? name.size() : end);
+
+		const FeatureField *field = nullptr;
+		for (size_t i = 0; i < count; i++) {
+			if (fields[i].name == part) {
+				field = &fields[i];
+			}
+		}
+		if (field == nullptr) {
+			throw std::invalid_argument("no such feature");
+		}
+		index += field->offset;
+
+		if (name.starts_with('[')) {
+			size_t element = 0;
+			size_t i = 1;
+			for (; i < name.size() && name[i] >= '0' && name[i] <= '9'; i++) {
+				element = element * 10 + size_t(name[i] - '0');
+			}
+			if (i == 1 || i == name.size() || name[i] != ']' || element >= field->elements()) {
+				throw std::invalid_argument("bad feature element");
+			}
+			index += element * field->stride;
+			name.remove_prefix(i + 1);
+		}
+
+		if (name.empty()) {
+			return index;
+		}
+		if (!name.starts_with('.') || field->nested == nullptr) {
+			throw std::invalid_argument("bad feature name");
+		}
+		name.remove_prefix(1);
+		fields = field->nested;
+		count = field->nested_count;
+	}
+}
+
+std::string featureName(size_t);
+FeatureRange featureRange(size_t);
+
+int featureSchema(int, char **);
+} // namespace pokezero
+
+namespace {
+// size of output state array
+constexpr size_t BattleStateSize = pokezero::FeatureRecord<BattleState>::width;
+typedef std::array<double, BattleStateSize> MLVec;
+
+/*
+ * what a view returns for a feature: a reference to its value, or a span
+ * over its values for a count above 0
+ */
+template <class T, size_t N>
+struct FeatureValues {
+	typedef std::span<T, N> type;
+	static type at(T *values) { return type(values, N); }
+};
+
+template <class T>
+struct FeatureValues<T, 0> {
+	typedef T &type;
+	static type at(T *values) { return *values; }
+};
+
+/*
+ * the nested records of a view, indexed and iterated as views of their own
+ */
+template <class View, size_t N>
+struct FeatureRecords {
+	typedef decltype(View::base) Pointer;
+	static constexpr size_t stride = pokezero::FeatureRecord<typename View::Record>::width;
+
+	struct iterator {
+		typedef std::input_iterator_tag iterator_category;
+		typedef View value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef void pointer;
+		typedef View reference;
+
+		Pointer at;
+
+		View operator*() const { return View{this->at}; }
+		iterator &operator++()
+		{
+			this->at += stride;
+			return *this;
+		}
+		iterator operator++(int)
+		{
+			iterator previous = *this;
+			++*this;
+			return previous;
+		}
+		bool operator==(const iterator &) const = default;
+	};
+
+	Pointer base;
+
+	View operator[](size_t i) const { return View{this->base + i * stride}; }
+	iterator begin() const { return {this->base}; }
+	iterator end() const { return {this->base + N * stride}; }
+	static constexpr size_t size() { return N; }
+};
+
+/*
+ * MoveView, PokemonView, SideView and BattleStateView: a record of a vector by
+ * name, over double for one that is written and const double for one that is
+ * only read. Each accessor is a load or store at an offset the schema fixes at
+ * compile time
+ */
+#define FEATURE_ACCESSOR(name, count, range)                                                                     \
+	typename FeatureValues<T, count>::type name() const                                                      \
+	{                                                                                                        \
+		constexpr size_t offset = pokezero::featureOffset<Record>(#name);                                \
+		return FeatureValues<T, count>::at(this->base + offset);                                         \
+	}
+#define RECORD_ACCESSOR(type, name, count)                                                                       \
+	FeatureRecords<type##View<T>, count> name() const                                                        \
+	{                                                                                                        \
+		constexpr size_t offset = pokezero::featureOffset<Record>(#name);                                \
+		return {this->base + offset};                                                                    \
+	}
+#define FEATURE_VIEW(type, list)                                                                                 \
+	template <class T>                                                                                       \
+	struct type##View {                                                                                      \
+		typedef type Record;                                                                             \
+		T *base;                                                                                         \
+                                                                                                                 \
+		operator type##View<const double>() const requires(!std::is_const_v<T>) { return {this->base}; } \
+                                                                                                                 \
+		list(FEATURE_ACCESSOR, RECORD_ACCESSOR)                                                          \
+	};
+
+FEATURE_VIEW(Move, MOVE_FEATURES)
+FEATURE_VIEW(Pokemon, POKEMON_FEATURES)
+FEATURE_VIEW(Side, SIDE_FEATURES)
+FEATURE_VIEW(BattleState, BATTLE_STATE_FEATURES)
+
+#undef FEATURE_ACCESSOR
+#undef RECORD_ACCESSOR
+#undef FEATURE_VIEW
+
+/*
+ * the features of a vector by name
+ */
+inline BattleStateView<double>
+features(MLVec &vec)
+{
+	return {vec.data()};
+}
+
+inline BattleStateView<const double>
+features(const MLVec &vec)
+{
+	return {vec.data()};
+}
+} // namespace
+
+#endif /* FEATURE_SCHEMA_HH */
@@ -0,0 +1,46 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FEATURIZE_HH
+#define FEATURIZE_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pokezero {
+struct FeaturizeConfig {
+	std::vector<std::string> inputs; // replay files, "-" for stdin
+	std::string prefix;              // output shard prefix
+	size_t threads = 0;              // parse and featurize workers; 0 uses one per hardware thread
+	size_t queue_depth = 256;        // battles waiting between two stages
+};
+
+struct FeaturizeStats {
+	uint64_t battles = 0;
+	uint64_t records = 0;
+	uint64_t errors = 0; // battles skipped because they failed to parse or featurize
+	double seconds = 0;
+};
+
+FeaturizeStats featurizeReplays(const FeaturizeConfig &);
+
+int featurize(int, char **);
+} // namespace pokezero
+
+#endif /* FEATURIZE_HH */
@@ -0,0 +1,39 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HASH_HH
+#define HASH_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace pokezero {
+uint64_t xxh64(const void *, size_t, uint64_t seed = 0);
+
+/*
+ * content hash of a message or serialized state
+ */
+inline uint64_t
+hashBytes(std::string_view bytes, uint64_t seed = 0)
+{
+	return xxh64(bytes.data(), bytes.size(), seed);
+}
+} // namespace pokezero
+
+#endif /* HASH_HH */
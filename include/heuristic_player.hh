@@ -0,0 +1,156 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEURISTIC_PLAYER_HH
+#define HEURISTIC_PLAYER_HH
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "damage.hh"
+#include "player.hh"
+
+namespace showdown {
+/*
+ * damage tables of one side's view of a state, computed once when the state
+ * is observed so a decision on it only looks them up: the opposing active
+ * Pokemon's moves against each of this side's Pokemon, and the moves of each
+ * of this side's living Pokemon against the opposing side
+ */
+struct StateTables {
+	void compute(const pokezero::DamageCalc &, const MLVec &, size_t);
+
+	// party index of each side's active Pokemon, -1 if there is none
+	int own = -1;
+	int foe = -1;
+
+	pokezero::DamageTable incoming;
+	std::array<pokezero::DamageTable, 6> outgoing; // by party index, empty for fainted ones
+};
+
+/*
+ * ranks the choices of a state by expected damage, KO chance and how safely
+ * a switch comes in
+ */
+class ChoiceRanker {
+public:
+	const std::vector<std::pair<size_t, double>> &rank(const MLVec &, const StateTables &, size_t,
+	                                                   const std::vector<std::string> &);
+
+private:
+	// actions with their scores, best first
+	std::vector<std::pair<size_t, double>> scores;
+};
+
+/*
+ * one turn playouts of a state for a search: a choice of one side against a
+ * reply from the opposing active Pokemon, picked the way HeuristicPlayer
+ * would, with knockouts drawn from their chances
+ *
+ * both sides are taken to act whatever the speed order, and a switch only
+ * counts the discounted share the incoming Pokemon could take next turn
+ */
+class TurnPlayout {
+public:
+	void prepare(const MLVec &, const StateTables &, size_t, const std::vector<std::string> &);
+	void reset() { this->prepared = false; }
+	bool ready() const { return this->prepared; }
+
+	double play(size_t, double, std::mt19937 &) const;
+
+private:
+	// what playing an action does to the opposing active Pokemon, and which
+	// of this side's Pokemon takes the reply
+	struct Outcome {
+		bool valid = false;
+		double share = 0; // share of the foe's hp taken
+		double ko = 0;    // chance of knocking it out
+		int target = -1;
+	};
+
+	bool prepared = false;
+	std::array<Outcome, pokezero::ActionCount> outcomes;
+
+	// the opposing active's moves against each of this side's Pokemon
+	double reply_share[6][4] = {};
+	double reply_ko[6][4] = {};
+	size_t reply_best[6] = {};
+};
+
+/*
+ * the last state a player observed and its damage tables, handed from the
+ * Manager's coroutine to the player's own
+ */
+class ObservedState {
+public:
+	void put(const MLVec &, size_t, const std::vector<std::string> &, uint32_t);
+	bool take(uint32_t, MLVec &, size_t &, std::vector<std::string> &, StateTables &);
+
+private:
+	pokezero::DamageCalc calc;
+	StateTables tables;
+
+	std::mutex lock;
+	bool valid = false;
+	uint32_t turn = 0;
+	MLVec vec;
+	size_t side = 0;
+	std::vector<std::string> choices;
+};
+
+/*
+ * cheap rollout policy: plays the best ranked choice offered, with an
+ * epsilon-random mix
+ *
+ * observe() keeps the state with its damage tables; the ranking is a lookup
+ * into them when the request is answered, on the player's own coroutine
+ */
+class HeuristicPlayer : public Player {
+public:
+	// chance of playing a uniformly random choice instead of the best one
+	static constexpr double default_epsilon = 0.1;
+
+	// constructor
+	HeuristicPlayer(const std::string &name, double epsilon = default_epsilon)
+	        : Player(name, "HeuristicPlayer"), epsilon(epsilon){};
+
+	void observe(const MLVec &, size_t, const std::vector<std::string> &, uint32_t) override;
+
+	double epsilon;
+
+private:
+	ObservedState observed;
+	ChoiceRanker ranker;
+
+	// the state being answered, taken from observed
+	MLVec vec;
+	size_t side = 0;
+	std::vector<std::string> choices;
+	StateTables tables;
+
+	std::string_view decideOwnMove() override;
+};
+} // namespace showdown
+
+#endif /* HEURISTIC_PLAYER_HH */
@@ -0,0 +1,93 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INFERENCE_HH
+#define INFERENCE_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "battle_parser.hh"
+#include "eval_queue.hh"
+
+// magic number at the start of a weights file ("PZNN")
+#define WEIGHTS_MAGIC 0x4e4e5a50
+#define WEIGHTS_VERSION 2
+
+namespace pokezero {
+enum WeightType : uint32_t {
+	FLOAT32, // 32 bit float weights
+	INT8     // 8 bit weights with a float scale per output
+};
+
+/*
+ * a fully connected layer
+ *
+ * weights are stored transposed and packed as an in x out_padded matrix so the
+ * GEMM kernels can vectorize across outputs; the padding columns are zero
+ */
+struct Layer {
+	size_t in = 0;         // input width
+	size_t out = 0;        // output width
+	size_t out_padded = 0; // output width rounded up to the kernel column block
+	WeightType type = FLOAT32;
+
+	std::vector<float> weights;   // in x out_padded (FLOAT32)
+	std::vector<int8_t> qweights; // in x out_padded (INT8)
+	std::vector<float> scales;    // per output dequantization scale (INT8)
+	std::vector<float> bias;      // out_padded
+
+	void forward(const float *, size_t, float *) const;
+};
+
+/*
+ * multilayer perceptron with a ReLU trunk and policy/value heads
+ *
+ * the trunk input width is BattleStateSize; the policy head has PolicySize
+ * outputs passed through softmax and the value head has one output passed
+ * through tanh
+ */
+class Network {
+public:
+	// constructors
+	Network() {}
+	Network(const std::string &);
+
+	static Network random(const std::vector<size_t> &, uint32_t seed = 0);
+
+	void save(const std::string &) const;
+	Network quantize() const;
+
+	void forward(const MLVec *, size_t, Evaluation *) const;
+	BatchEvaluator evaluator() const;
+
+	WeightType weightType() const { return this->policy.type; }
+	size_t parameters() const;
+
+private:
+	std::vector<Layer> trunk;
+	Layer policy;
+	Layer value;
+};
+
+int benchInference(int, char **);
+int benchEvalQueue(int, char **);
+} // namespace pokezero
+
+#endif /* INFERENCE_HH */
@@ -0,0 +1,261 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOG_HH
+#define LOG_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * structured logging that stays cheap enough to leave on in hot paths
+ *
+ * LOG_INFO("socket", "accept failed", "socket", name, "errno", errno) copies
+ * its arguments, in binary, into a ring buffer owned by the calling thread;
+ * a background thread formats them as logfmt lines. The component, message
+ * and keys must be string literals; values may be numbers, bools or strings.
+ * A record that does not fit in the ring is counted and dropped rather than
+ * waited for.
+ *
+ * levels below POKEZERO_LOG_LEVEL are compiled out, and levels below the
+ * runtime level (INFO unless POKEZERO_LOG_LEVEL is set in the environment)
+ * cost one relaxed load
+ */
+#ifndef POKEZERO_LOG_LEVEL
+#define POKEZERO_LOG_LEVEL 0
+#endif
+
+#define LOG_AT(level, component, message, ...)                                                      \
+	do {                                                                                        \
+		if constexpr (level >= POKEZERO_LOG_LEVEL) {                                        \
+			if (pokezero::logEnabled(level)) {                                          \
+				pokezero::logWrite(level, component, message __VA_OPT__(, ) __VA_ARGS__); \
+			}                                                                           \
+		}                                                                                   \
+	} while (false)
+
+#define LOG_TRACE(...) LOG_AT(pokezero::LOG_TRACE_LEVEL, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(pokezero::LOG_DEBUG_LEVEL, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(pokezero::LOG_INFO_LEVEL, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(pokezero::LOG_WARN_LEVEL, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(pokezero::LOG_ERROR_LEVEL, __VA_ARGS__)
+
+namespace pokezero {
+enum LogLevel : uint8_t { LOG_TRACE_LEVEL, LOG_DEBUG_LEVEL, LOG_INFO_LEVEL, LOG_WARN_LEVEL, LOG_ERROR_LEVEL };
+
+inline std::atomic<uint8_t> log_level{LOG_INFO_LEVEL};
+
+inline bool
+logEnabled(LogLevel level)
+{
+	return level >= log_level.load(std::memory_order_relaxed);
+}
+
+void setLogLevel(LogLevel);
+bool parseLogLevel(std::string_view, LogLevel &);
+void logToFile(const char *);
+void logFromEnvironment();
+void logFlush();
+
+// tag in front of each encoded value
+enum LogType : uint8_t { LOG_INT, LOG_UINT, LOG_DOUBLE, LOG_BOOL, LOG_STRING };
+
+struct LogRecord {
+	uint32_t size; // bytes of the record and its arguments, a multiple of 8
+	LogLevel level;
+	uint8_t fields;        // key and value pairs that follow
+	const char *component; // null for padding at the end of the ring
+	const char *message;
+	int64_t time; // nanoseconds since the unix epoch
+};
+
+/*
+ * single producer, single consumer byte ring of one thread's records
+ *
+ * a record never wraps: one that does not fit before the end of the buffer
+ * is preceded by padding up to the end. Records are only 8 byte aligned, so
+ * a gap at the end too short for a padding header is skipped without one,
+ * by both sides
+ */
+class LogRing {
+public:
+	static constexpr size_t Capacity = 1 << 18;
+
+	int tid;
+	std::atomic<uint64_t> dropped{0};
+	std::atomic<bool> abandoned{false}; // set when the owning thread exits
+
+	// constructors
+	LogRing(int tid) : tid(tid) {}
+
+	/*
+	 * space for a record of `size` bytes, or null if the ring is full
+	 */
+	char *reserve(size_t size)
+	{
+		uint64_t tail = this->tail.load(std::memory_order_relaxed);
+		uint64_t free = Capacity - (tail - this->head.load(std::memory_order_acquire));
+		size_t offset = tail % Capacity;
+		size_t to_end = Capacity - offset;
+
+		if (size > to_end) {
+			if (to_end + size > free) {
+				return nullptr;
+			}
+
+			if (!skipsTail(tail)) {
+				LogRecord padding{uint32_t(to_end), LOG_TRACE_LEVEL, 0, nullptr, nullptr, 0};
+				std::memcpy(this->data + offset, &padding, sizeof(padding));
+			}
+			this->tail.store(tail + to_end, std::memory_order_release);
+			return this->data;
+		}
+
+		return size <= free ? this->data + offset : nullptr;
+	}
+
+	// a record is never placed where its header would not fit
+	static bool skipsTail(uint64_t position) { return Capacity - position % Capacity < sizeof(LogRecord); }
+
+	void commit(size_t size) { this->tail.fetch_add(size, std::memory_order_release); }
+
+	bool empty() const
+	{
+		return this->head.load(std::memory_order_relaxed) == this->tail.load(std::memory_order_acquire);
+	}
+
+	size_t drain(void (*)(const LogRing &, const LogRecord &, const char *, void *), void *);
+
+private:
+	alignas(64) std::atomic<uint64_t> head{0}; // read position, written by the consumer
+	alignas(64) std::atomic<uint64_t> tail{0}; // write position, written by the producer
+	alignas(8) char data[Capacity];
+};
+
+LogRing &logRing();
+
+template <class T>
+constexpr size_t
+logValueSize(const T &value)
+{
+	if constexpr (std::is_arithmetic_v<T>) {
+		return 1 + 8;
+	} else {
+		return 1 + 4 + std::string_view(value).size();
+	}
+}
+
+template <class T>
+char *
+logEncode(char *out, const T &value)
+{
+	if constexpr (std::is_same_v<T, bool>) {
+		*out++ = LOG_BOOL;
+		*out = value;
+		return out + 8;
+	} else if constexpr (std::is_floating_point_v<T>) {
+		double v = double(value);
+		*out++ = LOG_DOUBLE;
+		std::memcpy(out, &v, 8);
+		return out + 8;
+	} else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+		int64_t v = int64_t(value);
+		*out++ = LOG_INT;
+		std::memcpy(out, &v, 8);
+		return out + 8;
+	} else if constexpr (std::is_integral_v<T>) {
+		uint64_t v = uint64_t(value);
+		*out++ = LOG_UINT;
+		std::memcpy(out, &v, 8);
+		return out + 8;
+	} else {
+		std::string_view v(value);
+		uint32_t size = uint32_t(v.size());
+		*out++ = LOG_STRING;
+		std::memcpy(out, &size, 4);
+		std::memcpy(out + 4, v.data(), v.size());
+		return out + 4 + v.size();
+	}
+}
+
+inline size_t
+logFieldsSize()
+{
+	return 0;
+}
+
+template <class V, class... Rest>
+size_t
+logFieldsSize(const char *, const V &value, const Rest &...rest)
+{
+	return sizeof(const char *) + logValueSize(value) + logFieldsSize(rest...);
+}
+
+inline char *
+logEncodeFields(char *out)
+{
+	return out;
+}
+
+template <class V, class... Rest>
+char *
+logEncodeFields(char *out, const char *key, const V &value, const Rest &...rest)
+{
+	std::memcpy(out, &key, sizeof(key));
+	return logEncodeFields(logEncode(out + sizeof(key), value), rest...);
+}
+
+/*
+ * encode a record into the calling thread's ring; formatting happens on the
+ * writer thread
+ */
+template <class... Args>
+void
+logWrite(LogLevel level, const char *component, const char *message, const Args &...fields)
+{
+	static_assert(sizeof...(Args) % 2 == 0, "log fields are key and value pairs");
+
+	size_t size = (sizeof(LogRecord) + logFieldsSize(fields...) + 7) & ~size_t(7);
+	LogRing &ring = logRing();
+	if (size > LogRing::Capacity / 4) {
+		ring.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	char *out = ring.reserve(size);
+	if (out == nullptr) {
+		ring.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	                       std::chrono::system_clock::now().time_since_epoch())
+	                       .count();
+	LogRecord record{uint32_t(size), level, uint8_t(sizeof...(Args) / 2), component, message, time};
+	std::memcpy(out, &record, sizeof(record));
+	logEncodeFields(out + sizeof(record), fields...);
+
+	ring.commit(size);
+}
+} // namespace pokezero
+
+#endif /* LOG_HH */
@@ -0,0 +1,113 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAILBOX_HH
+#define MAILBOX_HH
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <string_view>
+
+namespace showdown {
+enum MoveType : uint8_t {
+	WAIT,     // tell the player class to wait for directive
+	OWN,      // let player class make move
+	DIRECTED, // use move from caller
+	CHOICE    // use the request choice matching a showdown choice string from caller
+};
+
+/*
+ * how a player should answer one request, in one cache line with no heap
+ * allocation
+ */
+struct alignas(64) MoveDirective {
+	// longest directed reply or choice string that fits inline
+	static constexpr size_t Capacity = 58;
+
+	char text[Capacity];
+	uint32_t turn = 0; // battle state the directive was decided on
+	uint8_t length = 0;
+	MoveType type = WAIT;
+
+	// constructors
+	MoveDirective() {}
+	MoveDirective(MoveType, std::string_view, uint32_t turn = 0);
+
+	std::string_view view() const { return std::string_view(this->text, this->length); }
+};
+
+/*
+ * lock free single producer, single consumer slot holding the latest move
+ * directive from the Manager to one player
+ *
+ * a directive that has not been taken yet is replaced by the next one, so
+ * the mailbox never fills up. It is a triple buffer: the producer writes its
+ * own slot and swaps it for the published one with one atomic exchange, and
+ * the consumer swaps the published slot for its own the same way. A consumer
+ * that finds the mailbox empty either parks a coroutine, which push() hands
+ * back to the producer to schedule, or parks its thread on a futex through
+ * std::atomic::wait, which push() only wakes when a thread is sleeping
+ */
+class Mailbox {
+public:
+	// type and turn of the directive waiting to be taken
+	struct Pending {
+		MoveType type = WAIT;
+		uint32_t turn = 0;
+	};
+
+	std::coroutine_handle<> push(const MoveDirective &);
+	bool pop(MoveDirective &);
+	MoveDirective wait();
+
+	bool empty() const { return !(this->published.load() & Fresh); }
+	Pending peek() const;
+
+	// co_await mailbox.next() for the next directive
+	struct Next {
+		Mailbox &mailbox;
+		MoveDirective directive;
+		bool popped = false;
+
+		bool await_ready() { return this->popped = this->mailbox.pop(this->directive); }
+		bool await_suspend(std::coroutine_handle<>);
+		MoveDirective await_resume();
+	};
+
+	Next next() { return {*this, MoveDirective(), false}; }
+
+private:
+	// the published word: slot index, whether it holds a directive not yet
+	// taken, and that directive's type and turn so peek() reads no slot
+	static constexpr uint64_t Slot = 3;
+	static constexpr uint64_t Fresh = 4;
+
+	alignas(64) std::atomic<uint64_t> published{1};
+	alignas(64) uint8_t back = 0;  // slot the producer writes next
+	alignas(64) uint8_t front = 2; // slot the consumer last took
+	alignas(64) std::atomic<void *> waiter{nullptr}; // parked consumer coroutine
+	std::atomic<uint32_t> sleepers{0};               // consumer threads in wait()
+
+	MoveDirective slots[3];
+};
+
+int benchMailbox(int, char **);
+} // namespace showdown
+
+#endif /* MAILBOX_HH */
@@ -19,28 +19,63 @@
 #ifndef MANAGER_HH
 #define MANAGER_HH
 
+#include <chrono>
 #include <nlohmann/json.hpp>
-#include <thread>
 
 #include "battle_parser.hh"
+#include "alloc_stats.hh"
 #include "common.hh"
+#include "endgame.hh"
+#include "executor.hh"
+#include "feature_cache.hh"
+#include "hash.hh"
+#include "log.hh"
+#include "metrics.hh"
 #include "player.hh"
 #include "random_player.hh"
 #include "showdown.hh"
 #include "socket_helper.hh"
+#include "trajectory.hh"
+#include "trace.hh"
 
 namespace pokezero {
 template <class P1 = showdown::RandomPlayer, class P2 = showdown::RandomPlayer>
 class Manager {
 public:
 	// constructors
-	Manager(const std::string &);
+	Manager(const std::string &, showdown::Executor &executor = showdown::Executor::shared());
 
 	// destructor
 	~Manager();
 
 	void start();
-	void loop();
+	void join();
+
+	const std::string &winner() const { return this->parser.winner; }
+	int winnerSide() const;
+	const showdown::Player &player(size_t side) const { return *this->players[side]; }
+
+	// the node process crashed or hung, so the battle was abandoned without
+	// a winner or samples
+	bool aborted() const { return this->failed; }
+
+	// configures when the endgame solver takes over from the players
+	EndgameSolver endgame;
+
+	// Features of responses seen before, by any battle; null to always parse
+	FeatureCache *features = &FeatureCache::shared();
+
+	// when set, every state of the battle is written here as a training
+	// sample for each side once the winner is known
+	TrajectorySink *trajectories = nullptr;
+
+	// the node process is killed if it takes longer than this to answer a
+	// request for a battle state; 0 waits forever
+	std::chrono::milliseconds request_timeout{30000};
+
+	// cpus the node process is pinned to, normally those the executor's
+	// threads run on; empty leaves it to the scheduler
+	std::vector<int> node_cpus;
 
 private:
 	std::string name;
@@ -49,27 +84,71 @@ private:
 	BattleParser parser = BattleParser();
 	std::array<showdown::Player *, 2> players;
 
-	std::vector<std::thread> threads;
+	// runs the players' request loops and this battle's loop
+	showdown::Executor &executor;
+	showdown::TaskGroup tasks;
 
 	showdown::Socket socket;
+	bool failed = false;
+
+	// process wide metrics, looked up once per battle
+	MetricsRegistry &metrics = MetricsRegistry::shared();
+	Counter &battles_started = metrics.counter("pokezero_battles_started_total", "Battles started");
+	Counter &battles_finished = metrics.counter("pokezero_battles_finished_total", "Battles played to the end");
+	Counter &battles_aborted =
+	        metrics.counter("pokezero_battles_aborted_total", "Battles abandoned after their node process failed");
+	Counter &turns = metrics.counter("pokezero_turns_total", "Battle states received from the node process");
+	Histogram &turn_time = metrics.histogram("pokezero_turn_seconds", "Time from one battle state to the next");
+	Histogram &featurize_time =
+	        metrics.histogram("pokezero_featurize_seconds", "Time to featurize a battle state for both sides");
+
+	// samples of this battle so far; the last `undecided` are waiting on
+	// the players' policies
+	std::vector<TrajectoryRecord> trajectory;
+	size_t undecided = 0;
+
+	// directives sent to each player, to match against the requests it has
+	// received
+	std::array<uint32_t, 2> directed{};
+
+	// requests each player had received when the last state was asked for;
+	// the node process makes a state before sending the requests it needs
+	// answered, so an EMPTY answer means no state is coming for these
+	std::array<uint32_t, 2> polled{};
+
+	showdown::Task<void> loop();
+	showdown::Task<Features> fetch(int);
+	showdown::Task<Features> fetchAnswered(int, std::array<uint32_t, 2>);
 
 	void requestGetBattleState(int);
 	void requestSetBattleState(int);
 	void requestSetExit();
+
+	void direct(size_t, showdown::MoveType, const std::string &, int);
+	void directMoves(const Features &, int);
+	void directUnanswered(int);
+	showdown::Task<void> solveEndgame(MLVec, size_t, std::vector<std::string>, int);
+	void abort(int);
+
+	void recordState(const Features &, int);
+	void recordPolicies();
+	void finishTrajectory();
 };
 
 /*
  * constructor
  */
 template <class P1, class P2>
-Manager<P1, P2>::Manager(const std::string &name)
+Manager<P1, P2>::Manager(const std::string &name, showdown::Executor &executor)
+        : executor(executor), tasks(executor)
 {
 	validateName(name);
 	this->name = name;
 	this->socket.socket_name = "/tmp/" + name;
 
-	this->players[0] = new P1("p1");
-	this->players[1] = new P2("p2");
+	// named after the battle, so battles can run side by side
+	this->players[0] = new P1(name + "p1");
+	this->players[1] = new P2(name + "p2");
 }
 
 /*
@@ -78,11 +157,10 @@ Manager<P1, P2>::Manager(const std::string &name)
 template <class P1, class P2>
 Manager<P1, P2>::~Manager()
 {
-	for (auto &t: this->threads) {
-		t.join();
-	}
+	this->join();
 
-	this->threads.clear();
+	// before the socket its exit callback uses is destroyed
+	this->sd.stop();
 
 	for (auto &p: this->players) {
 		delete p;
@@ -97,20 +175,52 @@ void
 Manager<P1, P2>::start()
 {
 	// TODO: don't force unlink of socket file?
-	this->socket.connect(true);
-
-	this->sd = showdown::Showdown();
+	this->socket.listen(true);
 
 	for (auto &p: this->players) {
-		p->loop();
+		this->tasks.spawn(p->run(this->executor));
 	}
 
+	// a node process that exits, for any reason, closes the battle's
+	// connection to it, so the loop never waits on a dead process
+	this->sd.onExit([this]() { this->socket.shutdown(); });
+	this->sd.pin(this->node_cpus);
+
 	// TODO: encode path better
 	// this->sd.start("./pokemon-showdown/.sim-dist/examples/battle-managing.js", this->name);
-	this->sd.start("./pokemon-showdown/.sim-dist/examples/battle-managing.js", this->name, this->players[0]->name,
-	               this->players[1]->name);
+	if (!this->sd.start("./pokemon-showdown/.sim-dist/examples/battle-managing.js", this->name,
+	                    this->players[0]->name, this->players[1]->name)) {
+		this->socket.shutdown();
+	}
 
-	this->loop();
+	this->tasks.spawn(this->loop());
+	this->battles_started.add();
+}
+
+/*
+ * index of the winning player, or -1 for a tie or an unfinished battle
+ */
+template <class P1, class P2>
+int
+Manager<P1, P2>::winnerSide() const
+{
+	for (size_t i = 0; i < this->players.size(); i++) {
+		if (!this->parser.winner.empty() && this->parser.winner == this->players[i]->name) {
+			return int(i);
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * wait for the battle to finish
+ */
+template <class P1, class P2>
+void
+Manager<P1, P2>::join()
+{
+	this->tasks.wait();
 }
 
 /*
@@ -121,12 +231,17 @@ template <class P1, class P2>
 void
 Manager<P1, P2>::requestGetBattleState(int turn)
 {
+	ALLOC_SCOPE(ALLOC_MANAGER);
 	nlohmann::json send_msg;
 
 	send_msg["method"] = "get";
 	send_msg["item"] = "battleState";
 	send_msg["turn"] = turn;
 
+	// disarmed by fetch() once the state arrives
+	if (this->request_timeout.count() > 0) {
+		this->sd.arm(this->request_timeout);
+	}
 	this->socket.sendMessage(send_msg.dump());
 }
 
@@ -162,39 +277,346 @@ Manager<P1, P2>::requestSetExit()
 	this->socket.closeClient();
 }
 
+/*
+ * send one player the directive for its next request, tagged with the turn
+ * of the state it was decided on
+ */
 template <class P1, class P2>
 void
-Manager<P1, P2>::loop()
+Manager<P1, P2>::direct(size_t i, showdown::MoveType type, const std::string &move, int turn)
 {
-	this->threads.push_back(std::thread([this]() {
-		int turn = 0;
-		while (true) {
-			this->requestGetBattleState(turn);
-			std::string res = this->socket.recvMessage();
+	this->directed[i]++;
+	this->players[i]->notifyMove(type, move, uint32_t(turn));
+}
 
-			if (res.empty()) {
-				// shouldn't get here in proper usage
-				throw std::runtime_error("Socket closed before receiving Battle END");
-			}
+/*
+ * tell each player with a request in the state how to answer it: once the
+ * position is small enough the endgame solver's choice is directed, otherwise
+ * the player decides on its own
+ *
+ * a side without a request gets nothing, since a directive it did not use
+ * would be taken for its next request. Endgame solves run as tasks on the
+ * executor's workers, one per side, and direct their player when done, so
+ * the loop goes on to fetch the next state meanwhile
+ */
+template <class P1, class P2>
+void
+Manager<P1, P2>::directMoves(const Features &state, int turn)
+{
+	TRACE_SCOPE("Manager::directMoves");
+	ALLOC_SCOPE(ALLOC_MANAGER);
+
+	bool endgame = this->endgame.applies(state.vec);
+
+	for (size_t i = 0; i < this->players.size(); i++) {
+		this->players[i]->observe(state.vec, i, state.choices[i], uint32_t(turn));
+		if (!state.requested[i]) {
+			continue;
+		}
+
+		if (endgame) {
+			this->directed[i]++;
+			this->tasks.spawn(this->solveEndgame(state.vec, i, state.choices[i], turn));
+			continue;
+		}
+
+		this->direct(i, showdown::OWN, "", turn);
+	}
+}
+
+/*
+ * direct one side with the endgame solver's choice, or let its player decide
+ * if the solver passes or fails; the directive is already counted in
+ * directed, so one is always sent
+ *
+ * each solve has its own solver, so both sides can be solved at once
+ */
+template <class P1, class P2>
+showdown::Task<void>
+Manager<P1, P2>::solveEndgame(MLVec vec, size_t side, std::vector<std::string> choices, int turn)
+{
+	std::string choice;
+	try {
+		EndgameSolver solver(this->endgame.config);
+		EndgameResult result = solver.solve(vec, side);
+		if (result.action.kind != Action::PASS) {
+			choice = choices.at(result.action.index + (result.action.kind == Action::SWITCH ? 4 : 0));
+		}
+	} catch (std::exception &e) {
+		LOG_WARN("manager", "endgame solve failed", "battle", this->name, "side", side, "error", e.what());
+	}
+
+	if (!choice.empty()) {
+		this->players[side]->notifyMove(showdown::CHOICE, choice, uint32_t(turn));
+	} else {
+		this->players[side]->notifyOwnMove(uint32_t(turn));
+	}
+
+	co_return;
+}
+
+/*
+ * let each player decide its own answer to requests it had received before
+ * the last poll that no state has directed, such as team preview, which comes
+ * before any state
+ *
+ * a request that arrived after the poll may be for the state the next poll
+ * returns, which directs it
+ */
+template <class P1, class P2>
+void
+Manager<P1, P2>::directUnanswered(int turn)
+{
+	for (size_t i = 0; i < this->players.size(); i++) {
+		if (int32_t(this->polled[i] - this->directed[i]) > 0) {
+			this->direct(i, showdown::OWN, "", turn);
+		}
+	}
+}
+
+/*
+ * give up on a battle whose node process is gone: its players are stopped
+ * and its samples dropped, since the battle has no outcome
+ */
+template <class P1, class P2>
+void
+Manager<P1, P2>::abort(int turn)
+{
+	LOG_ERROR("manager", "node process failed, battle aborted", "battle", this->name, "turn", turn);
+
+	for (auto &p: this->players) {
+		p->stop();
+	}
+	this->socket.shutdown();
+
+	this->trajectory.clear();
+	this->undecided = 0;
+	this->parser.winner.clear();
+	this->battles_aborted.add();
+}
+
+/*
+ * start a sample of the state for each side with a request; their policies
+ * are filled in once the players have decided
+ */
+template <class P1, class P2>
+void
+Manager<P1, P2>::recordState(const Features &state, int turn)
+{
+	if (this->trajectories == nullptr) {
+		return;
+	}
+
+	this->undecided = 0;
+	for (size_t i = 0; i < this->players.size(); i++) {
+		if (state.requested[i]) {
+			this->trajectory.push_back(sampleState(state.vec, state.choices[i], turn, i));
+			this->undecided++;
+		}
+	}
+}
 
-			for (auto &p: this->players) {
-				p->notifyOwnMove();
+template <class P1, class P2>
+void
+Manager<P1, P2>::recordPolicies()
+{
+	// a sample whose answer left no policy, such as a directed reply, is
+	// dropped rather than trained on an all zero policy; the mask is the
+	// request's own legal set rather than sampleState's guess from the state
+	size_t kept = this->trajectory.size() - this->undecided;
+	for (size_t i = kept; i < this->trajectory.size(); i++) {
+		TrajectoryRecord &record = this->trajectory[i];
+		std::array<float, ActionCount> policy;
+		uint32_t mask;
+		if (this->players[record.side]->policyFor(record.turn, policy, mask)) {
+			std::copy(policy.begin(), policy.end(), record.policy);
+			record.mask = mask;
+			this->trajectory[kept++] = record;
+		}
+	}
+
+	this->trajectory.resize(kept);
+	this->undecided = 0;
+}
+
+/*
+ * back-fill the outcome for each side into the battle's samples and hand them
+ * to the sink, in one append per battle even if it has none
+ */
+template <class P1, class P2>
+void
+Manager<P1, P2>::finishTrajectory()
+{
+	if (this->trajectories == nullptr) {
+		return;
+	}
+
+	const std::string &winner = this->parser.winner;
+	for (TrajectoryRecord &record: this->trajectory) {
+		if (winner.empty()) {
+			record.outcome = 0;
+		} else {
+			record.outcome = winner == this->players[record.side]->name ? 1 : -1;
+		}
+	}
+
+	this->trajectories->append(this->trajectory.data(), this->trajectory.size());
+	this->trajectory.clear();
+}
+
+/*
+ * ask the node process for the state of a turn, then parse and featurize it,
+ * or take its Features from the cache if the same response was seen before
+ *
+ * the parser is only touched here, and fetches never overlap, so the loop can
+ * direct the players with one set of Features while the next is being filled
+ */
+template <class P1, class P2>
+showdown::Task<Features>
+Manager<P1, P2>::fetch(int turn)
+{
+	for (size_t i = 0; i < this->players.size(); i++) {
+		this->polled[i] = this->players[i]->requestsReceived();
+	}
+
+	this->requestGetBattleState(turn);
+	TRACE_WAIT_BEGIN(wait);
+	std::string res = co_await this->socket.recvMessageAsync(this->executor);
+	TRACE_WAIT_END("manager state wait", wait);
+	this->sd.disarm();
+
+	if (res.empty()) {
+		// the node process crashed or was killed for missing its deadline
+		this->failed = true;
+		co_return Features();
+	}
+
+	TRACE_SCOPE("Manager::fetch");
+	ALLOC_SCOPE(ALLOC_MANAGER);
+
+	Features state;
+	uint64_t key = hashBytes(res);
+	if (this->features == nullptr || !this->features->lookup(key, state)) {
+		state.type = this->parser.handleResponse(res);
+		if (state.type == BattleParser::BATTLESTATE) {
+			// a cache hit skips the parser, so its latest state is not
+			// necessarily this turn's
+			int latest = this->parser.lastTurn();
+
+			{
+				ScopedTimer timer(this->featurize_time);
+				state.vec = this->parser.getMLVec(latest);
+				for (size_t i = 0; i < state.choices.size(); i++) {
+					state.choices[i] = this->parser.getChoices(latest, i);
+					state.requested[i] = this->parser.hasRequest(latest, i);
+				}
 			}
+			state.winner = this->parser.winner;
 
-			switch (this->parser.handleResponse(res)) {
-			case BattleParser::END:
-				this->requestSetExit();
-				return;
-			case BattleParser::EMPTY:
-				// do nothing
-				break;
-			case BattleParser::BATTLESTATE:
-				this->parser.getMLVec(turn);
-				turn++;
-				break;
+			if (this->features != nullptr) {
+				this->features->insert(key, state);
 			}
-		};
-	}));
+		}
+	} else if (!state.winner.empty()) {
+		this->parser.winner = state.winner;
+	}
+
+	co_return state;
+}
+
+/*
+ * fetch() of the next turn once each player has sent the given number of
+ * replies in all, which is when the battle can have reached it
+ *
+ * the node process answers a request for a turn it has not reached with an
+ * EMPTY state, so asking any earlier only polls. The deadline is armed for
+ * the wait too, since a node process that hangs sends the players nothing to
+ * reply to
+ */
+template <class P1, class P2>
+showdown::Task<Features>
+Manager<P1, P2>::fetchAnswered(int turn, std::array<uint32_t, 2> replies)
+{
+	if (this->request_timeout.count() > 0) {
+		this->sd.arm(this->request_timeout);
+	}
+
+	for (size_t i = 0; i < this->players.size(); i++) {
+		TRACE_WAIT_BEGIN(wait);
+		co_await this->players[i]->replied(replies[i]);
+		TRACE_WAIT_END("manager reply wait", wait);
+	}
+
+	co_return co_await this->fetch(turn);
+}
+
+/*
+ * the fetch of the next turn starts before the players are directed, and
+ * sends its request the moment the last reply it needs has gone out, on the
+ * thread that sent it; its response is then received and featurized there
+ * rather than after the loop gets back to it
+ */
+template <class P1, class P2>
+showdown::Task<void>
+Manager<P1, P2>::loop()
+{
+	co_await this->socket.acceptAsync(this->executor);
+
+	int turn = 0;
+	if (this->socket.sockfd < 0) {
+		// the node process never connected
+		this->failed = true;
+		this->abort(turn);
+		co_return;
+	}
+
+	Features state = co_await this->fetch(turn);
+	while (true) {
+		if (this->failed) {
+			this->abort(turn);
+			co_return;
+		}
+
+		switch (state.type) {
+		case BattleParser::END:
+			this->directUnanswered(turn);
+			this->recordPolicies();
+			this->finishTrajectory();
+			this->requestSetExit();
+			this->battles_finished.add();
+			co_return;
+		case BattleParser::EMPTY:
+			this->directUnanswered(turn);
+			state = co_await this->fetchAnswered(turn, this->directed);
+			continue;
+		case BattleParser::BATTLESTATE:
+			// the node process only moves on once both players have
+			// answered, so their decisions for the previous state are in;
+			// an EMPTY poll says nothing about them
+			this->recordPolicies();
+			this->recordState(state, turn);
+			this->turns.add();
+			turn++;
+			break;
+		}
+		int state_turn = turn - 1;
+
+		// directMoves() directs each side with a request exactly once
+		std::array<uint32_t, 2> replies = this->directed;
+		for (size_t i = 0; i < replies.size(); i++) {
+			replies[i] += state.requested[i];
+		}
+
+		TRACE_WAIT_BEGIN(wait);
+		auto turn_start = std::chrono::steady_clock::now();
+		showdown::Future<Features> next = this->tasks.start(this->fetchAnswered(turn, replies));
+		this->directMoves(state, state_turn);
+		state = co_await next;
+		TRACE_WAIT_END("turn", wait);
+		this->turn_time.record(
+		        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - turn_start)
+		                .count());
+	}
 }
 } // namespace pokezero
 
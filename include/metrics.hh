@@ -0,0 +1,180 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICS_HH
+#define METRICS_HH
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+namespace pokezero {
+/*
+ * monotonically increasing count, safe to add to from any thread
+ */
+class Counter {
+public:
+	void add(uint64_t n = 1) { this->value.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t get() const { return this->value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> value{0};
+};
+
+/*
+ * distribution of nanosecond durations in log-linear buckets, as in an HDR
+ * histogram: each power of two is split into 16 buckets, so a quantile is
+ * within about 6% of the recorded value
+ *
+ * recording is a few relaxed atomic adds and never blocks
+ */
+class Histogram {
+public:
+	static constexpr size_t SubBuckets = 16;
+	static constexpr size_t BucketCount = (64 - 3) * SubBuckets;
+
+	// recordings in each bucket; the difference of two is the histogram of
+	// what was recorded in between
+	typedef std::array<uint64_t, BucketCount> Counts;
+
+	void record(uint64_t);
+
+	uint64_t count() const { return this->total.load(std::memory_order_relaxed); }
+	uint64_t sum() const { return this->total_ns.load(std::memory_order_relaxed); }
+	Counts counts() const;
+	uint64_t quantile(double q) const { return quantile(this->counts(), q); }
+	static uint64_t quantile(const Counts &, double);
+
+	static size_t bucket(uint64_t);
+	static uint64_t bucketValue(size_t);
+
+private:
+	std::array<std::atomic<uint64_t>, BucketCount> buckets{};
+	std::atomic<uint64_t> total{0};
+	std::atomic<uint64_t> total_ns{0};
+};
+
+/*
+ * records the time until the end of the enclosing block into a histogram
+ */
+class ScopedTimer {
+public:
+	// constructors
+	ScopedTimer(Histogram &histogram) : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+	// destructor
+	~ScopedTimer()
+	{
+		this->histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		                               std::chrono::steady_clock::now() - this->start)
+		                               .count());
+	}
+
+	ScopedTimer(const ScopedTimer &) = delete;
+	ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+	Histogram &histogram;
+	std::chrono::steady_clock::time_point start;
+};
+
+/*
+ * named counters and histograms of the whole process, written in the
+ * Prometheus text format
+ *
+ * looking a metric up takes a lock, so hot paths look theirs up once and keep
+ * the reference, which stays valid for the life of the registry
+ */
+class MetricsRegistry {
+public:
+	static MetricsRegistry &shared();
+
+	// labels are in Prometheus form without the braces, such as
+	// socket="/tmp/p1"
+	Counter &counter(const std::string &, const std::string &, const std::string &labels = "");
+	Histogram &histogram(const std::string &, const std::string &, const std::string &labels = "");
+
+	void write(std::ostream &);
+
+private:
+	template <class T>
+	struct Metric {
+		std::string name;
+		std::string help;
+		std::string labels;
+		T value;
+
+		// constructors
+		Metric(const std::string &name, const std::string &help, const std::string &labels)
+		        : name(name), help(help), labels(labels)
+		{
+		}
+	};
+
+	std::mutex lock;
+	std::deque<Metric<Counter>> counters;
+	std::deque<Metric<Histogram>> histograms;
+};
+
+/*
+ * publishes a registry while it is alive: rewritten into a text file every
+ * interval, for the node exporter's textfile collector, and/or served to
+ * every client of a Unix socket, for scraping through a local proxy
+ *
+ * an empty path leaves that export off
+ */
+class MetricsExporter {
+public:
+	// constructors
+	MetricsExporter(const std::string &file, const std::string &socket,
+	                std::chrono::milliseconds interval = std::chrono::seconds(10),
+	                MetricsRegistry &registry = MetricsRegistry::shared());
+
+	// destructor
+	~MetricsExporter();
+
+	void writeFile();
+
+private:
+	MetricsRegistry &registry;
+	std::string file;
+	std::string socket;
+	std::chrono::milliseconds interval;
+
+	int server_fd = -1;
+
+	std::mutex lock;
+	std::condition_variable stop_cv;
+	bool stopping = false;
+
+	std::thread file_thread;
+	std::thread socket_thread;
+
+	void fileLoop();
+	void socketLoop();
+};
+} // namespace pokezero
+
+#endif /* METRICS_HH */
@@ -0,0 +1,86 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PLACEMENT_HH
+#define PLACEMENT_HH
+
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "executor.hh"
+
+namespace showdown {
+/*
+ * how battles are spread over the machine: not at all, one domain per NUMA
+ * node, or one per last level cache (a core complex on chips that have them)
+ */
+enum PlacementPolicy { PLACE_NONE, PLACE_NUMA, PLACE_CACHE };
+
+// cpus of one placement domain, all on the same NUMA node
+struct CpuDomain {
+	int node = 0;
+	std::vector<int> cpus;
+};
+
+PlacementPolicy parsePlacement(std::string_view);
+const char *placementName(PlacementPolicy);
+
+std::vector<int> parseCpuList(std::string_view);
+std::vector<CpuDomain> cpuDomains(PlacementPolicy);
+bool pinThread(const std::vector<int> &);
+
+/*
+ * one executor per domain, its threads pinned to the domain's cpus, handed
+ * out to battles in turn
+ *
+ * a battle runs its manager and players on its slot's executor and pins its
+ * node process to the same cpus, so the IPC between them stays within one
+ * cache and memory node; memory the battle touches from those threads is
+ * allocated on that node by the kernel's default first touch policy
+ */
+class Placement {
+public:
+	struct Slot {
+		Executor &executor;
+		const CpuDomain *domain; // null when unpinned
+
+		std::vector<int> cpus() const { return this->domain ? this->domain->cpus : std::vector<int>(); }
+	};
+
+	// constructors
+	Placement(PlacementPolicy);
+
+	static Placement &shared();
+
+	Slot next();
+
+	PlacementPolicy policy() const { return this->placement_policy; }
+	const std::vector<CpuDomain> &domains() const { return this->cpu_domains; }
+
+private:
+	PlacementPolicy placement_policy;
+	std::vector<CpuDomain> cpu_domains;
+	std::vector<std::unique_ptr<Executor>> executors;
+	std::atomic<size_t> cursor{0};
+};
+} // namespace showdown
+
+#endif /* PLACEMENT_HH */
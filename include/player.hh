@@ -19,26 +19,27 @@
 #ifndef PLAYER_HH
 #define PLAYER_HH
 
+#include <array>
 #include <atomic>
-#include <condition_variable>
+#include <coroutine>
 #include <mutex>
 #include <random>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "action_space.hh"
+#include "battle_parser.hh"
+#include "executor.hh"
+#include "mailbox.hh"
+#include "metrics.hh"
 #include "socket_helper.hh"
 
 namespace showdown {
-enum MoveType {
-	WAIT,    // tell the player class to wait for directive
-	OWN,     // let player class make move
-	DIRECTED // use move from caller
-};
-
 class Player {
 public:
 	[[maybe_unused]] static constexpr bool force_create = true;
 	std::string name = "";
-	std::atomic<MoveType> move_type{WAIT};
 
 	// constructor
 	Player(const std::string &, const std::string &);
@@ -46,10 +47,42 @@ public:
 	// destructor
 	virtual ~Player(){};
 
-	virtual void loop() = 0;
-	void notifyMove(MoveType, const std::string &);
-	void notifyOwnMove();
+	Task<void> run(Executor &);
+
+	// sees each battle state, this player's side, the showdown choice for
+	// each action in MLVec order and the turn its directive will carry before
+	// it is asked to move; called from the Manager's coroutine, not the
+	// player's
+	virtual void observe(const MLVec &, size_t, const std::vector<std::string> &, uint32_t){};
+
+	void notifyMove(MoveType, const std::string &, uint32_t);
+	void notifyOwnMove(uint32_t);
 	void requestSetExit();
+	void stop();
+
+	// requests read from the node process so far
+	uint32_t requestsReceived() const { return this->requests_received.load(); }
+
+	/*
+	 * awaitable that resumes once the player has sent a number of replies in
+	 * all, or its connection to the node process has closed
+	 */
+	struct Replied {
+		Player &player;
+		uint32_t count;
+
+		bool await_ready() const { return false; }
+		bool await_suspend(std::coroutine_handle<>);
+		void await_resume() const {}
+	};
+	Replied replied(uint32_t count) { return Replied{*this, count}; }
+
+	bool policyFor(uint32_t, std::array<float, pokezero::ActionCount> &, uint32_t &);
+
+	// processor time this player has spent deciding its own moves, and how
+	// many it has decided
+	std::chrono::nanoseconds cpuTime() const { return this->cpu_time; }
+	uint64_t ownDecisions() const { return this->own_decisions; }
 
 protected:
 	std::string className;
@@ -58,12 +91,66 @@ protected:
 
 	std::mt19937 rng;
 
-	std::string move;
-	std::mutex move_lock;
-	std::condition_variable move_cv;
+	// directives from the controlling thread, one per request
+	Mailbox directives;
+	// turn of the directive being answered
+	uint32_t answering = 0;
+
+	Executor *executor = nullptr;
+
+	// the current request and its legal actions
+	std::string request;
+	pokezero::RequestActions actions;
+
+	size_t randomInt(size_t, size_t);
+	std::string_view reply(size_t);
+	std::string_view replyAction(size_t);
+	std::string_view replyForChoice(std::string_view);
+	std::string_view takeMove();
+	void recordPolicy(const std::array<float, pokezero::ActionCount> &);
+
+	// the returned reply must stay valid until the next request arrives
+	virtual std::string_view decideOwnMove() { return ""; };
+
+private:
+	// replies are built here and directives taken early are kept here, so
+	// answering a request needs no allocation
+	pokezero::ReplyBuffer reply_buffer;
+	MoveDirective taken;
+
+	// time taken by decideOwnMove(), labelled with the class name
+	pokezero::Histogram *decision_seconds = nullptr;
+	std::chrono::nanoseconds cpu_time{0};
+	uint64_t own_decisions = 0;
+
+	std::atomic<uint32_t> requests_received{0};
+	std::atomic<uint32_t> replies_sent{0};
+
+	// the coroutine waiting in replied(), and the replies it waits for
+	std::mutex reply_lock;
+	std::coroutine_handle<> reply_waiter;
+	uint32_t reply_target = 0;
+	bool replies_closed = false;
+
+	// share of each recent decision given to each action, and the legal
+	// actions of the request it answered, by the turn of the directive, so the
+	// Manager can read the decision for a state after the next request has
+	// arrived. reply() makes it one-hot on the choice played unless
+	// recordPolicy() was called for the request
+	struct LatchedPolicy {
+		uint32_t turn = 0;
+		bool known = false;
+		uint32_t mask = 0;
+		std::array<float, pokezero::ActionCount> policy{};
+	};
+	static constexpr size_t LatchedPolicies = 4;
+	std::mutex policy_lock;
+	std::array<LatchedPolicy, LatchedPolicies> policies{};
+	bool policy_recorded = false;
 
-	std::string waitDirectedMove();
-	virtual std::string decideOwnMove() { return ""; };
+	Task<void> serve();
+	std::string_view answer(const MoveDirective &);
+	void wakeReplied(bool);
 };
 } // namespace showdown
 
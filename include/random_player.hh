@@ -19,10 +19,8 @@
 #ifndef RANDOM_PLAYER_HH
 #define RANDOM_PLAYER_HH
 
-#include <nlohmann/json.hpp>
 #include <string>
-#include <thread>
-#include <vector>
+#include <string_view>
 
 #include "player.hh"
 
@@ -32,18 +30,8 @@ public:
 	// constructor
 	RandomPlayer(const std::string &name) : Player(name, "RandomPlayer"){};
 
-	// destructor
-	~RandomPlayer();
-
-	void loop() override;
-
 private:
-	std::string className;
-	std::vector<std::thread> threads;
-	nlohmann::json last_request = nullptr;
-
-	size_t randomInt(size_t, size_t);
-	std::string decideOwnMove() override;
+	std::string_view decideOwnMove() override;
 };
 } // namespace showdown
 
@@ -0,0 +1,90 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEARCH_HH
+#define SEARCH_HH
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace pokezero {
+/*
+ * wall clock budget for a single decision
+ */
+class Deadline {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	// constructors
+	Deadline(std::chrono::microseconds budget) : budget(budget), start(clock::now()), end(start + budget) {}
+
+	bool expired() const { return clock::now() >= this->end; }
+	std::chrono::microseconds elapsed() const;
+	std::chrono::microseconds remaining() const;
+
+	const std::chrono::microseconds budget;
+
+private:
+	const clock::time_point start;
+	const clock::time_point end;
+};
+
+struct SearchStats {
+	size_t best = 0;                      // index of the chosen action
+	uint64_t iterations = 0;              // samples taken before stopping
+	std::chrono::microseconds elapsed{0}; // time spent searching
+	std::chrono::microseconds budget{0};  // time allowed for the search
+	bool early_stop = false;              // stopped because the best action could no longer change
+	bool interrupted = false;             // stopped by the caller's interrupt predicate
+};
+
+/*
+ * anytime UCB1 search over the actions available at the root
+ *
+ * every iteration picks an action and calls the sample function for a noisy
+ * outcome in [-1, 1]; the most visited action is always available as the
+ * current best, so the search can be stopped at any point
+ */
+class AnytimeSearch {
+public:
+	typedef std::function<double(size_t)> Sampler;
+	typedef std::function<bool()> Interrupt;
+
+	// constructors
+	AnytimeSearch(size_t actions, double exploration = 1.4);
+
+	SearchStats run(const Deadline &, const Sampler &, const Interrupt &interrupt = nullptr);
+
+	size_t best() const;
+	uint64_t visits(size_t action) const { return this->action_visits[action]; }
+	double mean(size_t action) const;
+
+private:
+	double exploration;
+	uint64_t total_visits = 0;
+	std::vector<uint64_t> action_visits;
+	std::vector<double> action_totals;
+
+	size_t select() const;
+	bool decided(uint64_t) const;
+};
+} // namespace pokezero
+
+#endif /* SEARCH_HH */
@@ -0,0 +1,92 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEARCH_PLAYER_HH
+#define SEARCH_PLAYER_HH
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+#include "heuristic_player.hh"
+#include "player.hh"
+#include "search.hh"
+
+namespace showdown {
+/*
+ * player that searches over its choices for a fixed wall clock budget per
+ * decision instead of a fixed number of iterations
+ *
+ * each rollout is a one turn TurnPlayout of the observed state, with the
+ * opponent replying like HeuristicPlayer
+ */
+class SearchPlayer : public Player {
+public:
+	// default time allowed for each decision
+	static constexpr std::chrono::microseconds default_budget = std::chrono::milliseconds(100);
+
+	// chance the opponent's reply in a rollout is a random move
+	static constexpr double rollout_epsilon = HeuristicPlayer::default_epsilon;
+
+	// constructors
+	SearchPlayer(const std::string &name, std::chrono::microseconds budget = default_budget)
+	        : SearchPlayer(name, "SearchPlayer", budget){};
+
+	void observe(const MLVec &, size_t, const std::vector<std::string> &, uint32_t) override;
+
+	pokezero::SearchStats lastStats() const { return this->last_stats; }
+
+protected:
+	SearchPlayer(const std::string &, const std::string &, std::chrono::microseconds);
+
+	std::chrono::microseconds budget;
+
+	virtual double rollout(size_t);
+
+private:
+	pokezero::SearchStats last_stats;
+
+	ObservedState observed;
+	TurnPlayout playout;
+
+	// the state being answered, taken from observed
+	MLVec vec;
+	size_t side = 0;
+	std::vector<std::string> choices;
+	StateTables tables;
+
+	// action of each of the request's choices
+	std::vector<size_t> choice_actions;
+
+	std::string_view decideOwnMove() override;
+};
+
+/*
+ * search player with its budget fixed at compile time, so players of several
+ * budgets can be matched against each other by type
+ */
+template <int Millis>
+class BudgetSearchPlayer : public SearchPlayer {
+public:
+	// constructors
+	BudgetSearchPlayer(const std::string &name)
+	        : SearchPlayer(name, "SearchPlayer" + std::to_string(Millis) + "ms", std::chrono::milliseconds(Millis)){};
+};
+} // namespace showdown
+
+#endif /* SEARCH_PLAYER_HH */
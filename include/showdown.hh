@@ -16,21 +16,32 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+
 #ifndef SHOWDOWN_HH
 #define SHOWDOWN_HH
 
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "supervisor.hh"
+
 namespace showdown {
+/*
+ * one node process running a battle, started and watched by the Supervisor
+ */
 class Showdown {
 public:
 	/* constructors */
 	Showdown();
+	Showdown(const Showdown &) = delete;
+	Showdown &operator=(const Showdown &) = delete;
 	~Showdown();
 
 	bool start(const std::string &, const std::vector<std::string> &);
-	bool start(const std::string &) { return this->start(showdown_script, {}); }
+	bool start(const std::string &showdown_script) { return this->start(showdown_script, {}); }
 
 	template <typename... Ts>
 	bool start(const std::string &showdown_script, Ts &...args)
@@ -38,14 +49,24 @@ public:
 		return this->start(showdown_script, {args...});
 	}
 
+	// called from the supervisor's thread once the process exits, unless
+	// stop() was called first; set before start()
+	void onExit(std::function<void()> callback) { this->on_exit = std::move(callback); }
+
+	// cpus to pin the process to; set before start()
+	void pin(std::vector<int> cpus) { this->cpus = std::move(cpus); }
+
+	void arm(std::chrono::milliseconds);
+	void disarm();
+	bool exited();
+	void stop(std::chrono::milliseconds grace = std::chrono::seconds(5));
+
 private:
 	std::string showdown_script = "";
+	std::function<void()> on_exit;
+	std::vector<int> cpus;
 
-	struct {
-		pid_t pid = 0;
-		int readfd = -1;
-		int writefd = -1;
-	} child;
+	std::shared_ptr<Supervisor::Child> child;
 };
 } // namespace showdown
 
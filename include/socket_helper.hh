@@ -24,17 +24,28 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
-#include <sstream>
 #include <string>
-#include <thread>
-#include <vector>
+#include <string_view>
+
+#include "executor.hh"
+#include "metrics.hh"
 
 #define RECV_BUFSIZE 4096
 
 namespace showdown {
+/*
+ * a stream socket carrying null terminated messages, with one client at a
+ * time
+ *
+ * socket_name is a Unix socket path, or "tcp:host:port" for TCP, where an
+ * empty host or "*" listens on every interface
+ */
 struct Socket {
 public:
+	enum RecvStatus { RECV_MESSAGE, RECV_AGAIN, RECV_CLOSED };
+
 	std::atomic_int sockfd = -1;
 	std::mutex socket_lock;
 	std::condition_variable socket_ready;
@@ -45,17 +56,35 @@ public:
 	int createSocket(const std::string &, bool force = false);
 	void closeServer();
 
-	void connect(bool force = false);
-	bool connectHelper();
+	void listen(bool force = false, int backlog = 1);
+	Task<void> acceptAsync(Executor &);
+	std::unique_ptr<Socket> accept();
+	bool connect(const std::string &);
 	std::string recvMessage();
-	void sendMessage(const std::string &msg);
+	bool recvBytes(std::string &, size_t);
+	RecvStatus pollMessage(std::string &);
+	Task<std::string> recvMessageAsync(Executor &);
+	void sendMessage(std::string_view msg, std::string_view payload = {});
 	void closeClient();
+	void shutdown();
 
 	~Socket();
 
 private:
-	std::stringstream recv_stream;
-	std::vector<std::thread> threads;
+	std::string pending; // bytes read past the last message
+	bool tcp = false;
+
+	// set by shutdown(); nothing waits for a client after this
+	std::atomic<bool> shut{false};
+
+	// labelled with the socket name, looked up by listen()
+	pokezero::Counter *sent_total = nullptr;
+	pokezero::Counter *received_total = nullptr;
+
+	int createTcpSocket(const std::string &);
+	void setClient(int);
+	void countReceived(size_t);
+	bool waitReadable();
 };
 
 struct SocketClientHandler {
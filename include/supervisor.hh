@@ -0,0 +1,103 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SUPERVISOR_HH
+#define SUPERVISOR_HH
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.hh"
+
+namespace showdown {
+struct SupervisorStats {
+	uint64_t spawned = 0;
+	uint64_t crashed = 0;   // exited with an error or a signal it was not sent by a stop
+	uint64_t hung = 0;      // killed for missing a request deadline
+	uint64_t restarts = 0;  // battles retried on a new child after one failed
+	size_t running = 0;
+};
+
+/*
+ * owns the node processes of every battle
+ *
+ * one thread reads the children's stdout and stderr into the logger, kills a
+ * child that misses its request deadline, and reaps children as they exit,
+ * calling the exit callback they were spawned with. Nothing else waits on a
+ * child, so a hung or crashed simulator never blocks a battle's threads.
+ */
+class Supervisor {
+public:
+	struct Child;
+
+	// constructors
+	Supervisor();
+
+	// destructor
+	~Supervisor();
+
+	static Supervisor &shared();
+
+	std::shared_ptr<Child> spawn(const std::vector<std::string> &, std::function<void()>,
+	                             const std::vector<int> &cpus = {});
+
+	void arm(Child &, std::chrono::milliseconds);
+	void disarm(Child &);
+	bool exited(Child &);
+	bool wait(Child &, std::chrono::milliseconds);
+	void stop(Child &, std::chrono::milliseconds);
+
+	void countRestart();
+	SupervisorStats stats();
+
+private:
+	std::mutex lock;
+	std::condition_variable exit_cv;
+	std::vector<std::shared_ptr<Child>> children;
+	bool stopping = false;
+
+	int wake_fd = -1;
+	std::thread thread;
+
+	pokezero::Counter &spawned = pokezero::MetricsRegistry::shared().counter(
+	        "pokezero_node_spawned_total", "Simulator processes started");
+	pokezero::Counter &crashed = pokezero::MetricsRegistry::shared().counter(
+	        "pokezero_node_crashes_total", "Simulator processes that exited with an error");
+	pokezero::Counter &hung = pokezero::MetricsRegistry::shared().counter(
+	        "pokezero_node_hangs_total", "Simulator processes killed for missing a request deadline");
+	pokezero::Counter &restarts = pokezero::MetricsRegistry::shared().counter(
+	        "pokezero_node_restarts_total", "Battles restarted on a new simulator process");
+
+	void wake();
+	void run();
+	void drainOutput(Child &, bool);
+	void reap();
+	void expire();
+};
+} // namespace showdown
+
+#endif /* SUPERVISOR_HH */
@@ -0,0 +1,72 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TOURNAMENT_HH
+#define TOURNAMENT_HH
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pokezero {
+/*
+ * round robin between player types: every pair of entrants plays the same
+ * number of games, alternating sides, spread over a pool of battle threads
+ */
+struct TournamentConfig {
+	std::vector<std::string> entrants; // from entrantNames(), all of them when empty
+	size_t games = 20;                 // games per pairing
+	size_t concurrency = 0;            // battles side by side, 0 for one per two hardware threads
+	size_t resamples = 200;            // bootstrap resamples for the rating intervals
+};
+
+struct EntrantResult {
+	std::string name;
+	double elo = 0;                   // relative to the first entrant
+	double elo_low = 0, elo_high = 0; // 95% bootstrap interval
+	double score = 0;                 // wins plus half the ties
+	uint64_t games = 0;
+
+	// processor time spent on this entrant's own decisions over all its
+	// games, and how many it made
+	std::chrono::nanoseconds cpu{0};
+	uint64_t decisions = 0;
+};
+
+// results of one pairing, from the first entrant's point of view
+struct PairingResult {
+	size_t first, second;
+	uint64_t wins = 0, ties = 0, losses = 0;
+};
+
+struct TournamentResult {
+	std::vector<EntrantResult> entrants;
+	std::vector<PairingResult> pairings;
+	uint64_t aborted = 0; // games whose node process failed every attempt, left out
+	double seconds = 0;
+};
+
+const std::vector<std::string> &entrantNames();
+std::vector<double> fitElo(size_t, const std::vector<PairingResult> &);
+TournamentResult runTournament(const TournamentConfig &);
+
+int tournament(int, char **);
+} // namespace pokezero
+
+#endif /* TOURNAMENT_HH */
@@ -0,0 +1,111 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/*
+ * timeline of what each thread spent its time on, written as Chrome trace
+ * json that chrome://tracing and Perfetto load
+ *
+ * TRACE_SCOPE("name") records the time until the end of the enclosing block
+ * on the calling thread; TRACE_WAIT_BEGIN/TRACE_WAIT_END time a wait across a
+ * co_await, which can finish on another thread than it started on, as its
+ * own track. Names must be string literals. Events go into a buffer owned by
+ * the recording thread, so recording takes no locks.
+ *
+ * tracing is only compiled in with POKEZERO_TRACE defined (`make TRACE=1`);
+ * otherwise the macros are empty
+ */
+#ifdef POKEZERO_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT_(a, b)
+
+#define TRACE_SCOPE(name) pokezero::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#define TRACE_WAIT_BEGIN(var) int64_t var = pokezero::traceNow()
+
+#define TRACE_WAIT_END(name, var) pokezero::traceRecord(name, var, pokezero::traceNow() - var, true)
+#else
+#define TRACE_SCOPE(name) \
+	do {              \
+	} while (false)
+
+#define TRACE_WAIT_BEGIN(var) \
+	do {                  \
+	} while (false)
+
+#define TRACE_WAIT_END(name, var) \
+	do {                      \
+	} while (false)
+#endif
+
+namespace pokezero {
+#ifdef POKEZERO_TRACE
+constexpr bool TraceEnabled = true;
+#else
+constexpr bool TraceEnabled = false;
+#endif
+
+/*
+ * nanoseconds on the steady clock
+ */
+inline int64_t
+traceNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+	        .count();
+}
+
+void traceRecord(const char *, int64_t, int64_t, bool wait = false);
+
+class TraceScope {
+public:
+	// constructors
+	TraceScope(const char *name) : name(name), start(traceNow()) {}
+
+	// destructor
+	~TraceScope() { traceRecord(this->name, this->start, traceNow() - this->start); }
+
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+	const char *name;
+	int64_t start;
+};
+
+struct TraceStats {
+	uint64_t events = 0;
+	uint64_t dropped = 0; // events not recorded because a thread's buffer was full
+	size_t threads = 0;
+};
+
+void dumpTrace(std::ostream &);
+bool dumpTrace(const std::string &);
+TraceStats traceStats();
+
+void traceToFile(const std::string &);
+} // namespace pokezero
+
+#endif /* TRACE_HH */
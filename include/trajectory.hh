@@ -0,0 +1,143 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRAJECTORY_HH
+#define TRAJECTORY_HH
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "action_space.hh"
+#include "battle_parser.hh"
+
+namespace pokezero {
+/*
+ * one training sample: a state seen by one side, the legal actions and the
+ * side's visit distribution over them, and how the battle ended for the side
+ */
+struct TrajectoryRecord {
+	float state[BattleStateSize];
+	float policy[ActionCount];
+	uint32_t mask;   // legal actions
+	uint16_t turn;
+	uint8_t side;
+	int8_t outcome;  // 1 if the side won, -1 if it lost, 0 for a tie
+};
+
+static_assert(std::is_trivially_copyable_v<TrajectoryRecord>, "records are copied straight into shards");
+
+TrajectoryRecord sampleState(const MLVec &, const std::vector<std::string> &, int, size_t);
+
+/*
+ * start of every shard file, followed by `records` TrajectoryRecords
+ */
+struct alignas(64) TrajectoryHeader {
+	static constexpr char Magic[8] = {'P', 'Z', 'T', 'R', 'A', 'J', '0', '1'};
+
+	char magic[8];
+	uint32_t record_size;
+	uint32_t state_size;
+	uint32_t action_count;
+	uint32_t reserved = 0;
+	uint64_t records;
+	uint64_t schema; // FeatureSchemaHash of the states
+};
+
+struct TrajectoryWriterStats {
+	uint64_t records = 0;      // records handed to the disk
+	uint64_t shards = 0;       // shard files started
+	uint64_t buffer_swaps = 0; // full buffers handed to the flushing thread
+	size_t max_backlog = 0;    // most full buffers waiting to be flushed at once
+};
+
+/*
+ * where the samples of finished battles go
+ */
+class TrajectorySink {
+public:
+	// destructor
+	virtual ~TrajectorySink() {}
+
+	virtual void append(const TrajectoryRecord *, size_t) = 0;
+};
+
+/*
+ * appends trajectory records to memory mapped shard files
+ *
+ * battles only copy records into an in-memory buffer; a full buffer is
+ * swapped for an empty one and copied into the current shard by a background
+ * thread, so appending never waits on the disk. A shard is truncated to its
+ * records and a new one started once the next buffer would not fit
+ */
+class TrajectoryWriter : public TrajectorySink {
+public:
+	static constexpr size_t default_shard_bytes = 256 << 20;
+	static constexpr size_t default_buffer_records = 1024;
+
+	// constructors
+	TrajectoryWriter(const std::string &prefix, size_t shard_bytes = default_shard_bytes,
+	                 size_t buffer_records = default_buffer_records);
+
+	// destructor
+	~TrajectoryWriter();
+
+	void append(const TrajectoryRecord *, size_t) override;
+	void flush();
+
+	TrajectoryWriterStats stats();
+
+	static std::string shardName(const std::string &, uint64_t);
+
+private:
+	std::string prefix;
+	size_t shard_records; // records that fit in one shard
+	size_t buffer_records;
+
+	std::mutex lock;
+	std::condition_variable ready;   // a buffer is full, or the writer is stopping
+	std::condition_variable flushed; // the flushing thread finished a buffer
+	std::vector<TrajectoryRecord> active;
+	std::deque<std::vector<TrajectoryRecord>> full;
+	std::vector<std::vector<TrajectoryRecord>> spare;
+	bool writing = false;
+	bool stopping = false;
+
+	// the shard being written, touched only by the flushing thread
+	int fd = -1;
+	TrajectoryHeader *shard = nullptr;
+	size_t shard_size = 0;
+
+	TrajectoryWriterStats counts;
+
+	std::vector<std::thread> threads;
+
+	void swap();
+	void loop();
+	void write(const std::vector<TrajectoryRecord> &);
+	void openShard();
+	void closeShard();
+};
+} // namespace pokezero
+
+#endif /* TRAJECTORY_HH */
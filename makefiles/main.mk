@@ -17,6 +17,18 @@ LDLIBS := -lpthread
 DEPFLAGS = -MQ $@ -MD -MP -MF $(DEPDIR)/$*.Td
 
 CXXFLAGS := -std=c++20 $(BASE_FLAGS)
+# `make release TRACE=1` compiles in the Chrome trace timeline (see trace.hh)
+ifeq ($(TRACE), 1)
+	CXXFLAGS += -DPOKEZERO_TRACE
+endif
+# `make release ALLOC_STATS=1` counts allocations by subsystem (see alloc_stats.hh)
+ifeq ($(ALLOC_STATS), 1)
+	CXXFLAGS += -DPOKEZERO_ALLOC_STATS
+endif
+# `make release LOG_LEVEL=2` compiles out log levels below info (see log.hh)
+ifneq ($(LOG_LEVEL),)
+	CXXFLAGS += -DPOKEZERO_LOG_LEVEL=$(LOG_LEVEL)
+endif
 SYSINCLUDE :=
 CXXINCLUDE := -Iinclude $(shell pkg-config nlohmann_json --cflags)
 CXXSRC := $(wildcard src/*.cc)
@@ -0,0 +1,275 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "action_space.hh"
+
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+/*
+ * just enough of a json reader to walk the top level of a request: strings
+ * come back as views of the raw text, everything else is skipped over
+ */
+struct Scanner {
+	const char *p;
+	const char *end;
+
+	[[noreturn]] void fail() const { throw std::invalid_argument("malformed player request"); }
+
+	void space()
+	{
+		while (this->p < this->end && (*this->p == ' ' || *this->p == '\n' || *this->p == '\r' || *this->p == '\t')) {
+			this->p++;
+		}
+	}
+
+	bool consume(char c)
+	{
+		this->space();
+		if (this->p < this->end && *this->p == c) {
+			this->p++;
+			return true;
+		}
+		return false;
+	}
+
+	void expect(char c)
+	{
+		if (!this->consume(c)) {
+			this->fail();
+		}
+	}
+
+	bool peek(char c)
+	{
+		this->space();
+		return this->p < this->end && *this->p == c;
+	}
+
+	// contents of the string at p, escapes left as they are
+	std::string_view string()
+	{
+		this->expect('"');
+		const char *start = this->p;
+		while (this->p < this->end && *this->p != '"') {
+			this->p += *this->p == '\\' ? 2 : 1;
+		}
+		if (this->p >= this->end) {
+			this->fail();
+		}
+		return std::string_view(start, size_t(this->p++ - start));
+	}
+
+	void value()
+	{
+		this->space();
+		if (this->p >= this->end) {
+			this->fail();
+		}
+
+		if (*this->p == '"') {
+			this->string();
+			return;
+		}
+
+		if (*this->p == '{' || *this->p == '[') {
+			char close = *this->p == '{' ? '}' : ']';
+			this->p++;
+			if (this->consume(close)) {
+				return;
+			}
+			do {
+				if (close == '}') {
+					this->string();
+					this->expect(':');
+				}
+				this->value();
+			} while (this->consume(','));
+			this->expect(close);
+			return;
+		}
+
+		// number, true, false or null
+		const char *start = this->p;
+		while (this->p < this->end && std::strchr(",]} \n\r\t", *this->p) == nullptr) {
+			this->p++;
+		}
+		if (this->p == start) {
+			this->fail();
+		}
+	}
+};
+
+pokezero::RequestActions::Command
+command(std::string_view name)
+{
+	if (name == "active") {
+		return pokezero::RequestActions::ACTIVE;
+	} else if (name == "forceSwitch") {
+		return pokezero::RequestActions::FORCE_SWITCH;
+	} else if (name == "teamPreview") {
+		return pokezero::RequestActions::TEAM_PREVIEW;
+	}
+	return pokezero::RequestActions::UNKNOWN;
+}
+
+/*
+ * copy text into the buffer, returning one past the end
+ */
+char *
+put(char *out, std::string_view text)
+{
+	std::memcpy(out, text.data(), text.size());
+	return out + text.size();
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * action index of a showdown choice string such as "move 2", "move 2 mega"
+ * or "switch 3", or NoAction if it is not one
+ */
+size_t
+parseChoice(std::string_view choice)
+{
+	bool move = choice.starts_with("move ");
+	if (!move && !choice.starts_with("switch ")) {
+		return NoAction;
+	}
+
+	choice.remove_prefix(move ? 5 : 7);
+	size_t slot = 0;
+	auto [rest, err] = std::from_chars(choice.data(), choice.data() + choice.size(), slot);
+	if (err != std::errc() || slot < 1 || slot > (move ? MoveSlots : SwitchSlots)) {
+		return NoAction;
+	}
+
+	bool option = rest != choice.data() + choice.size();
+	if (option && (!move || *rest != ' ')) {
+		return NoAction;
+	}
+
+	return move ? (slot - 1) * MoveOptions + option : MoveActions + slot - 1;
+}
+
+/*
+ * legal actions of a request from the node process, read from its
+ * "command" and "choices" without building a json document
+ *
+ * choices outside the action space still count towards choice_count, so
+ * reply() indices stay the request's own; throws std::invalid_argument if the
+ * request is not a json object
+ */
+RequestActions
+RequestActions::decode(std::string_view request)
+{
+	RequestActions actions;
+	Scanner scan{request.data(), request.data() + request.size()};
+
+	scan.expect('{');
+	if (scan.consume('}')) {
+		return actions;
+	}
+
+	do {
+		std::string_view key = scan.string();
+		scan.expect(':');
+
+		if (key == "command" && scan.peek('"')) {
+			actions.command = ::command(scan.string());
+		} else if (key == "choices" && scan.peek('[')) {
+			scan.expect('[');
+			if (scan.consume(']')) {
+				continue;
+			}
+
+			size_t index = 0;
+			do {
+				size_t action = NoAction;
+				if (scan.peek('"')) {
+					action = parseChoice(scan.string());
+				} else {
+					scan.value();
+				}
+
+				if (index >= UINT8_MAX) {
+					throw std::invalid_argument("player request has too many choices");
+				}
+				if (action != NoAction && !actions.legal(action)) {
+					actions.mask |= uint32_t(1) << action;
+					actions.choice[action] = uint8_t(index);
+				}
+				index++;
+			} while (scan.consume(','));
+			scan.expect(']');
+
+			actions.choice_count = uint8_t(index);
+		} else {
+			scan.value();
+		}
+	} while (scan.consume(','));
+	scan.expect('}');
+
+	return actions;
+}
+
+/*
+ * reply to the request that picks the given index into its choices, written
+ * into the buffer
+ *
+ * a request with an unknown command gets a reply with no choice in it
+ */
+std::string_view
+RequestActions::reply(size_t choice, ReplyBuffer &buffer) const
+{
+	char *out = put(buffer.data(), "{\"type\":\"move\"");
+
+	switch (this->command) {
+	case ACTIVE:
+	case FORCE_SWITCH:
+		out = put(out, this->command == ACTIVE ? ",\"active\":" : ",\"switch\":");
+		out = std::to_chars(out, buffer.data() + buffer.size() - 1, choice).ptr;
+		break;
+	case TEAM_PREVIEW:
+		out = put(out, ",\"teamPreview\":\"default\"");
+		break;
+	case UNKNOWN:
+		break;
+	}
+
+	*out++ = '}';
+	return std::string_view(buffer.data(), size_t(out - buffer.data()));
+}
+
+/*
+ * reply to the request that takes a legal action; throws std::out_of_range
+ * for one the request does not offer
+ */
+std::string_view
+RequestActions::replyAction(size_t action, ReplyBuffer &buffer) const
+{
+	if (!this->legal(action)) {
+		throw std::out_of_range("Action " + std::to_string(action) + " is not legal in this request");
+	}
+
+	return this->reply(this->choice[action], buffer);
+}
+} // namespace pokezero
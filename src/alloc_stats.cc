@@ -0,0 +1,250 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "alloc_stats.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+/*
+ * counts of one tag, on a cache line of their own so threads working in
+ * different subsystems do not share one
+ */
+struct alignas(64) TagCounts {
+	std::atomic<uint64_t> allocations{0};
+	std::atomic<uint64_t> bytes{0};
+};
+
+TagCounts counts[pokezero::ALLOC_TAG_COUNT];
+
+#ifdef POKEZERO_ALLOC_STATS
+void
+count(size_t size)
+{
+	TagCounts &tag = counts[pokezero::alloc_tag];
+	tag.allocations.fetch_add(1, std::memory_order_relaxed);
+	tag.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void *
+allocate(size_t size)
+{
+	count(size);
+	return std::malloc(size > 0 ? size : 1);
+}
+
+void *
+allocateAligned(size_t size, std::align_val_t alignment)
+{
+	count(size);
+
+	void *p = nullptr;
+	size_t align = std::max(size_t(alignment), sizeof(void *));
+	if (posix_memalign(&p, align, size > 0 ? size : 1) != 0) {
+		return nullptr;
+	}
+	return p;
+}
+#endif
+} // namespace
+
+namespace pokezero {
+const char *const AllocTagNames[ALLOC_TAG_COUNT] = {"other", "manager", "socket", "parse", "featurize", "player"};
+
+thread_local AllocTag alloc_tag = ALLOC_OTHER;
+
+AllocStats
+AllocStats::operator-(const AllocStats &earlier) const
+{
+	AllocStats diff;
+	for (size_t i = 0; i < ALLOC_TAG_COUNT; i++) {
+		diff.allocations[i] = this->allocations[i] - earlier.allocations[i];
+		diff.bytes[i] = this->bytes[i] - earlier.bytes[i];
+	}
+
+	return diff;
+}
+
+/*
+ * allocations counted so far against each tag; all zero unless accounting is
+ * compiled in
+ */
+AllocStats
+allocStats()
+{
+	AllocStats stats;
+	for (size_t i = 0; i < ALLOC_TAG_COUNT; i++) {
+		stats.allocations[i] = counts[i].allocations.load(std::memory_order_relaxed);
+		stats.bytes[i] = counts[i].bytes.load(std::memory_order_relaxed);
+	}
+
+	return stats;
+}
+
+/*
+ * one line per tag with allocations and bytes per turn
+ */
+void
+writeAllocReport(std::ostream &out, const AllocStats &stats, uint64_t turns)
+{
+	double per = turns > 0 ? double(turns) : 1;
+
+	out << "allocations per turn over " << turns << " turns:\n";
+	for (size_t i = 0; i < ALLOC_TAG_COUNT; i++) {
+		out << "    " << AllocTagNames[i] << ": " << double(stats.allocations[i]) / per << " allocations, "
+		    << double(stats.bytes[i]) / per << " bytes\n";
+	}
+}
+} // namespace pokezero
+
+#ifdef POKEZERO_ALLOC_STATS
+/*
+ * replacements of the global allocation functions, which every container and
+ * nlohmann::json allocate through; frees are not attributed
+ */
+void *
+operator new(size_t size)
+{
+	void *p = allocate(size);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *
+operator new[](size_t size)
+{
+	return ::operator new(size);
+}
+
+void *
+operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void *
+operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void *
+operator new(size_t size, std::align_val_t alignment)
+{
+	void *p = allocateAligned(size, alignment);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *
+operator new[](size_t size, std::align_val_t alignment)
+{
+	return ::operator new(size, alignment);
+}
+
+void *
+operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	return allocateAligned(size, alignment);
+}
+
+void *
+operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	return allocateAligned(size, alignment);
+}
+
+void
+operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete[](void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete(void *p, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete(void *p, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete[](void *p, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete[](void *p, size_t, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+
+void
+operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	std::free(p);
+}
+#endif
@@ -0,0 +1,192 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "arena.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "alloc_stats.hh"
+#include "feature_cache.hh"
+#include "heuristic_player.hh"
+#include "metrics.hh"
+#include "random_player.hh"
+
+namespace pokezero {
+/*
+ * HeuristicPlayer against RandomPlayer, swapping sides every battle, with the
+ * heuristic's win rate and the wall time per battle
+ *
+ * arguments: [battles] [trajectory shard prefix]
+ */
+int
+headToHead(int argc, char **argv)
+{
+	size_t battles = argc > 0 ? std::stoul(argv[0]) : 20;
+	size_t wins = 0, losses = 0, ties = 0, aborted = 0;
+
+	std::unique_ptr<TrajectoryWriter> trajectories;
+	if (argc > 1) {
+		trajectories = std::make_unique<TrajectoryWriter>(argv[1]);
+	}
+
+	Counter &turns = MetricsRegistry::shared().counter("pokezero_turns_total",
+	                                                   "Battle states received from the node process");
+	uint64_t turns_before = turns.get();
+	AllocStats allocs_before = allocStats();
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < battles; i++) {
+		bool heuristic_first = i % 2 == 0;
+		BattleResult result;
+		if (heuristic_first) {
+			result = playBattle<showdown::HeuristicPlayer, showdown::RandomPlayer>(trajectories.get());
+		} else {
+			result = playBattle<showdown::RandomPlayer, showdown::HeuristicPlayer>(trajectories.get());
+		}
+
+		if (result.aborted) {
+			aborted++;
+			std::cout << "battle " << i + 1 << ": aborted\n";
+			continue;
+		}
+
+		int winner = result.winner;
+		if (winner < 0) {
+			ties++;
+		} else if ((winner == 0) == heuristic_first) {
+			wins++;
+		} else {
+			losses++;
+		}
+
+		std::cout << "battle " << i + 1 << ": " << (winner < 0 ? "tie" : winner == 0 ? "p1" : "p2") << " won ("
+			  << (heuristic_first ? "heuristic p1" : "heuristic p2") << ")\n";
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// ties count as half a win; aborted battles are left out
+	size_t played = wins + losses + ties;
+	double rate = played > 0 ? (double(wins) + 0.5 * double(ties)) / double(played) : 0;
+	double interval = played > 0 ? 1.96 * std::sqrt(rate * (1 - rate) / double(played)) : 0;
+
+	std::cout << "heuristic vs random: " << wins << " wins, " << losses << " losses, " << ties << " ties";
+	if (aborted > 0) {
+		std::cout << ", " << aborted << " aborted and left out";
+	}
+	std::cout << "\n"
+		  << "win rate " << rate << " +/- " << interval << " (95%), " << elapsed.count() / double(battles)
+		  << "s per battle\n";
+
+	FeatureCacheStats cache = FeatureCache::shared().stats();
+	std::cout << "feature cache: " << cache.hit_rate * 100 << "% hits over " << cache.hits + cache.misses
+		  << " responses\n";
+
+	showdown::SupervisorStats nodes = showdown::Supervisor::shared().stats();
+	if (nodes.crashed + nodes.hung > 0) {
+		std::cout << "node processes: " << nodes.spawned << " started, " << nodes.crashed << " crashed, "
+			  << nodes.hung << " hung, " << nodes.restarts << " battles restarted\n";
+	}
+
+	if (AllocStatsEnabled) {
+		writeAllocReport(std::cout, allocStats() - allocs_before, turns.get() - turns_before);
+	}
+
+	if (trajectories) {
+		trajectories->flush();
+		TrajectoryWriterStats written = trajectories->stats();
+		std::cout << "trajectories: " << written.records << " samples in " << written.shards << " shards\n";
+	}
+
+	return 0;
+}
+
+/*
+ * RandomPlayer self-play with battles side by side, once per placement
+ * policy, with the battles and turns per second and the turn latency of each
+ *
+ * every battle thread takes one slot for all its battles and pins itself to
+ * it, so its Managers are allocated on the slot's node too
+ *
+ * arguments: [battles] [concurrent battles] [policies...], by default 40
+ * battles, one per two hardware threads and none, numa and cache
+ */
+int
+benchPlacement(int argc, char **argv)
+{
+	size_t battles = argc > 0 ? std::stoul(argv[0]) : 40;
+	size_t concurrency = argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency() / 2);
+
+	std::vector<showdown::PlacementPolicy> policies;
+	for (int i = 2; i < argc; i++) {
+		policies.push_back(showdown::parsePlacement(argv[i]));
+	}
+	if (policies.empty()) {
+		policies = {showdown::PLACE_NONE, showdown::PLACE_NUMA, showdown::PLACE_CACHE};
+	}
+
+	MetricsRegistry &metrics = MetricsRegistry::shared();
+	Counter &turns = metrics.counter("pokezero_turns_total", "Battle states received from the node process");
+	Histogram &turn_time = metrics.histogram("pokezero_turn_seconds", "Time from one battle state to the next");
+
+	for (showdown::PlacementPolicy policy: policies) {
+		showdown::Placement placement(policy);
+		std::atomic<size_t> started{0};
+
+		uint64_t turns_before = turns.get();
+		Histogram::Counts latency = turn_time.counts();
+		auto start = std::chrono::steady_clock::now();
+
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < concurrency; t++) {
+			threads.emplace_back([&, t]() {
+				showdown::Placement::Slot slot = placement.next();
+				showdown::pinThread(slot.cpus());
+
+				std::string name = "bench" + std::to_string(t);
+				while (started++ < battles) {
+					playBattle<showdown::RandomPlayer, showdown::RandomPlayer>(nullptr, name, slot);
+				}
+			});
+		}
+		for (auto &thread: threads) {
+			thread.join();
+		}
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		Histogram::Counts after = turn_time.counts();
+		for (size_t i = 0; i < latency.size(); i++) {
+			latency[i] = after[i] - latency[i];
+		}
+		uint64_t played = turns.get() - turns_before;
+
+		std::cout << showdown::placementName(policy) << " (" << std::max<size_t>(1, placement.domains().size())
+			  << " domains): " << double(battles) / elapsed.count() << " battles/s, "
+			  << double(played) / elapsed.count() << " turns/s, turn p50 "
+			  << double(Histogram::quantile(latency, 0.5)) / 1e6 << "ms p99 "
+			  << double(Histogram::quantile(latency, 0.99)) / 1e6 << "ms\n";
+	}
+
+	return 0;
+}
+} // namespace pokezero
@@ -18,16 +18,31 @@
 
 #include "battle_parser.hh"
 
+#include <algorithm>
 #include <fstream>
-#include <iomanip>
-#include <iostream>
 #include <iterator>
 #include <map>
 #include <nlohmann/json.hpp>
+#include <set>
 #include <sstream>
 #include <stdexcept>
+#include <utility>
 
+#include "alloc_stats.hh"
 #include "debug_helper.hh"
+#include "log.hh"
+#include "metrics.hh"
+#include "trace.hh"
+
+namespace {
+pokezero::Histogram &
+parseTime()
+{
+	static pokezero::Histogram &histogram = pokezero::MetricsRegistry::shared().histogram(
+	        "pokezero_parse_seconds", "Time to parse a response from the node process");
+	return histogram;
+}
+} // namespace
 
 namespace pokezero {
 BattleParser::BattleParser()
@@ -72,26 +87,16 @@ BattleParser::readPokedexData()
 }
 
 /*
- * Print each field of BattleState
- *
- * TODO: finish implementation
+ * every feature of a vector that is set, one "name value" per line
  */
 std::string
-BattleParser::stringifyBattleState(BattleState &state)
+BattleParser::stringifyBattleState(const MLVec &vec)
 {
 	std::stringstream output;
 
-	std::string indent = "    ";
-	std::string double_indent = "        ";
-	for (size_t i = 0; i < 2; i++) {
-		if (i == 0) {
-			output << "Side: Self" << std::endl;
-		} else {
-			output << "Side: Opponent" << std::endl;
-		}
-		for (size_t j = 1; j < 7; j++) {
-			output << indent << "Pokemon " << j << ":" << std::endl;
-			output << double_indent << "isActive: " << state.sides[i].pokemon[j].active << std::endl;
+	for (size_t i = 0; i < vec.size(); i++) {
+		if (vec[i] != FeatureAbsent) {
+			output << featureName(i) << ' ' << vec[i] << '\n';
 		}
 	}
 
@@ -106,7 +111,26 @@ BattleParser::stringifyBattleState(BattleState &state)
 BattleParser::ResponseType
 BattleParser::handleResponse(const std::string &response)
 {
-	auto res_json = nlohmann::json::parse(response);
+	ALLOC_SCOPE(ALLOC_PARSE);
+
+	nlohmann::json res_json;
+	{
+		TRACE_SCOPE("BattleParser::parse");
+		ScopedTimer timer(parseTime());
+		res_json = nlohmann::json::parse(response);
+	}
+
+	return this->handleParsedResponse(std::move(res_json));
+}
+
+/*
+ * handleResponse() for a response that has already been parsed, such as one
+ * read back from a replay log
+ */
+BattleParser::ResponseType
+BattleParser::handleParsedResponse(nlohmann::json res_json)
+{
+	ALLOC_SCOPE(ALLOC_PARSE);
 
 	if (res_json["type"] == nullptr) {
 		return BattleParser::EMPTY;
@@ -114,12 +138,12 @@ BattleParser::handleResponse(const std::string &response)
 		return BattleParser::END;
 	}
 
-	addState(res_json);
-
 	if (res_json["winner"] != nullptr) {
 		this->winner = res_json["winner"];
 	}
 
+	addState(std::move(res_json));
+
 	return BATTLESTATE;
 }
 
@@ -131,7 +155,18 @@ BattleParser::handleResponse(const std::string &response)
 void
 BattleParser::addState(nlohmann::json state)
 {
-	this->turns.insert(this->turns.end(), state);
+	this->turns.insert(this->turns.end(), std::move(state));
+}
+
+/*
+ * forget every state and the winner, to parse another battle without
+ * reloading the pokedex data
+ */
+void
+BattleParser::reset()
+{
+	this->turns = nlohmann::json::array({});
+	this->winner = "";
 }
 
 std::string
@@ -145,6 +180,111 @@ BattleParser::getStateId(int turn_num)
 	return this->turns.at(turn_num)["id"];
 }
 
+/*
+ * whether a side has a request waiting on an answer in the state of a turn;
+ * a state that does not say is taken to have one
+ */
+bool
+BattleParser::hasRequest(int turn_num, size_t side)
+{
+	const nlohmann::json &side_state = this->turns.at(turn_num)["battleState"]["sides"][side];
+	auto request_state = side_state.find("requestState");
+	if (request_state == side_state.end() || !request_state->is_string()) {
+		return true;
+	}
+
+	return !request_state->get<std::string>().empty();
+}
+
+/*
+ * showdown choice string for a switch to, or a move of the active Pokemon at,
+ * the given index in MLVec order for one side of a turn
+ *
+ * getMLVec orders a side's Pokemon by species id and their moves by move id,
+ * while showdown choices count party positions and move slots from 1
+ */
+std::string
+BattleParser::getChoice(int turn_num, size_t side, bool is_switch, size_t index)
+{
+	nlohmann::json &pokemon = this->turns.at(turn_num)["battleState"]["sides"][side]["pokemon"];
+
+	if (is_switch) {
+		std::map<std::string, size_t> poke_order;
+		for (size_t i = 0; i < pokemon.size(); i++) {
+			poke_order.insert(std::make_pair(pokemon[i]["speciesState"]["id"], i));
+		}
+
+		if (index >= poke_order.size()) {
+			throw std::out_of_range("No Pokemon at index " + std::to_string(index));
+		}
+		return "switch " + std::to_string(std::next(poke_order.begin(), index)->second + 1);
+	}
+
+	for (nlohmann::json &mon: pokemon) {
+		if (!mon["isActive"]) {
+			continue;
+		}
+
+		std::map<int, size_t> move_order;
+		for (size_t i = 0; i < mon["moveSlots"].size(); i++) {
+			std::string move_id = mon["moveSlots"][i]["id"];
+			move_order.insert(std::make_pair(this->dex_data.all_moves[move_id], i));
+		}
+
+		if (index >= move_order.size()) {
+			throw std::out_of_range("No move at index " + std::to_string(index));
+		}
+		return "move " + std::to_string(std::next(move_order.begin(), index)->second + 1);
+	}
+
+	throw std::out_of_range("No active Pokemon on side " + std::to_string(side));
+}
+
+/*
+ * showdown choice strings for every action in MLVec order: the active
+ * Pokemon's 4 moves followed by switches to each of the 6 party slots, with ""
+ * where there is no such Pokemon or move
+ */
+std::vector<std::string>
+BattleParser::getChoices(int turn_num, size_t side)
+{
+	TRACE_SCOPE("BattleParser::getChoices");
+	ALLOC_SCOPE(ALLOC_FEATURIZE);
+
+	nlohmann::json &pokemon = this->turns.at(turn_num)["battleState"]["sides"][side]["pokemon"];
+	std::vector<std::string> choices(4 + 6);
+
+	for (nlohmann::json &mon: pokemon) {
+		if (!mon["isActive"]) {
+			continue;
+		}
+
+		for (size_t i = 0; i < std::min<size_t>(mon["moveSlots"].size(), 4); i++) {
+			choices[i] = this->getChoice(turn_num, side, false, i);
+		}
+	}
+
+	for (size_t i = 0; i < std::min<size_t>(pokemon.size(), 6); i++) {
+		choices[4 + i] = this->getChoice(turn_num, side, true, i);
+	}
+
+	return choices;
+}
+
+/*
+ * species id of each of one side's Pokemon in a turn, in MLVec order
+ */
+std::vector<std::string>
+BattleParser::getSpecies(int turn_num, size_t side)
+{
+	std::set<std::string> species;
+	for (nlohmann::json &mon: this->turns.at(turn_num)["battleState"]["sides"][side]["pokemon"]) {
+		species.insert(mon["speciesState"]["id"].get<std::string>());
+	}
+
+	return std::vector<std::string>(species.begin(), species.end());
+}
+
 /*
  * Parses nlohmann::json string of battle state and returns array of extracted important
  * variables, as outlined in comments for BattleState struct.
@@ -152,17 +292,14 @@ BattleParser::getStateId(int turn_num)
 MLVec
 BattleParser::getMLVec(int turn_num)
 {
-	nlohmann::json state = this->turns.at(turn_num)["battleState"];
+	TRACE_SCOPE("BattleParser::getMLVec");
+	ALLOC_SCOPE(ALLOC_FEATURIZE);
 
-	std::array<double, BattleStateSize> state_arr;
-	state_arr.fill(-1);
-	BattleState *pokestate = (BattleState *) state_arr.data();
+	nlohmann::json state = this->turns.at(turn_num)["battleState"];
 
-	if (this->debug) {
-		std::cout << "sizeof BattleState: " << sizeof(BattleState) << '\n';
-		std::cout << "sizeof double: " << sizeof(double) << '\n';
-		std::cout << "BattleState num elements: " << BattleStateSize << '\n';
-	}
+	MLVec state_arr;
+	state_arr.fill(FeatureAbsent);
+	auto pokestate = features(state_arr);
 
 	for (size_t side_i = 0; side_i < 2; side_i++) {
 		// Iterate through map of Pokemon
@@ -174,24 +311,24 @@ BattleParser::getMLVec(int turn_num)
 
 		int poke_idx = 0;
 		for (auto &[_, pokemon_curr]: poke_map) {
-			auto poke = &(pokestate->sides[side_i].pokemon[poke_idx]);
+			auto poke = pokestate.sides()[side_i].pokemon()[poke_idx];
 
 			// Append their active status
-			poke->active = 2 * int(pokemon_curr["isActive"]) - 1;
+			poke.active() = FeatureFlag.normalize(int(pokemon_curr["isActive"]));
 
 			// Append Pokemon ability
 			std::string ability = pokemon_curr["ability"];
-			poke->ability = this->dex_data.abilities[ability];
+			poke.ability() = this->dex_data.abilities[ability];
 
 			// Append Pokemon item
 			std::string item = pokemon_curr["item"];
-			poke->item = this->dex_data.items[item];
+			poke.item() = this->dex_data.items[item];
 
 			// Append Pokemon types
 			for (std::string mon_type: pokemon_curr["types"]) {
 				if (this->dex_data.all_types.contains(mon_type)) {
 					int type_id = this->dex_data.all_types[mon_type];
-					poke->types[type_id] = 1;
+					poke.types()[type_id] = 1;
 				}
 			}
 
@@ -204,38 +341,38 @@ BattleParser::getMLVec(int turn_num)
 
 			int move_idx = 0;
 			for (auto &[move_id, move_json]: move_map) {
-				poke->moves[move_idx].id = move_id;
-				poke->moves[move_idx].pp =
-					2 * double((move_json)["pp"]) / double((move_json)["maxpp"]) - 1;
-				poke->moves[move_idx].disabled = 2 * int((move_json)["disabled"]) - 1;
+				poke.moves()[move_idx].id() = move_id;
+				double pp = double((move_json)["pp"]) / double((move_json)["maxpp"]);
+				poke.moves()[move_idx].pp() = FeatureRatio.normalize(pp);
+				poke.moves()[move_idx].disabled() = FeatureFlag.normalize(int((move_json)["disabled"]));
 				move_idx++;
 			}
 
 			// Append status
 			std::string curr_status = pokemon_curr["status"];
-			poke->status[this->dex_data.all_status[curr_status]] = 1;
+			poke.status()[this->dex_data.all_status[curr_status]] = 1;
 
 			// Append stats
-			poke->stats[0] =
-				2 * double(pokemon_curr["hp"]) / double(pokemon_curr["baseStoredStats"]["hp"]) - 1;
-			poke->stats[1] = this->normStat(pokemon_curr["baseStoredStats"]["hp"]);
-			poke->stats[2] = this->normStat(pokemon_curr["baseStoredStats"]["atk"]);
-			poke->stats[3] = this->normStat(pokemon_curr["baseStoredStats"]["def"]);
-			poke->stats[4] = this->normStat(pokemon_curr["baseStoredStats"]["spa"]);
-			poke->stats[5] = this->normStat(pokemon_curr["baseStoredStats"]["spd"]);
-			poke->stats[6] = this->normStat(pokemon_curr["baseStoredStats"]["spe"]);
+			poke.hp() = FeatureRatio.normalize(double(pokemon_curr["hp"]) /
+			                                        double(pokemon_curr["baseStoredStats"]["hp"]));
+			poke.stats()[0] = FeatureStat.normalize(pokemon_curr["baseStoredStats"]["hp"]);
+			poke.stats()[1] = FeatureStat.normalize(pokemon_curr["baseStoredStats"]["atk"]);
+			poke.stats()[2] = FeatureStat.normalize(pokemon_curr["baseStoredStats"]["def"]);
+			poke.stats()[3] = FeatureStat.normalize(pokemon_curr["baseStoredStats"]["spa"]);
+			poke.stats()[4] = FeatureStat.normalize(pokemon_curr["baseStoredStats"]["spd"]);
+			poke.stats()[5] = FeatureStat.normalize(pokemon_curr["baseStoredStats"]["spe"]);
 
 			// Append stat boosts
-			poke->boosts[0] = this->normBoost(pokemon_curr["boosts"]["atk"]);
-			poke->boosts[1] = this->normBoost(pokemon_curr["boosts"]["def"]);
-			poke->boosts[2] = this->normBoost(pokemon_curr["boosts"]["spa"]);
-			poke->boosts[3] = this->normBoost(pokemon_curr["boosts"]["spd"]);
-			poke->boosts[4] = this->normBoost(pokemon_curr["boosts"]["spe"]);
-			poke->boosts[5] = this->normBoost(pokemon_curr["boosts"]["accuracy"]);
-			poke->boosts[6] = this->normBoost(pokemon_curr["boosts"]["evasion"]);
+			poke.boosts()[0] = FeatureBoost.normalize(pokemon_curr["boosts"]["atk"]);
+			poke.boosts()[1] = FeatureBoost.normalize(pokemon_curr["boosts"]["def"]);
+			poke.boosts()[2] = FeatureBoost.normalize(pokemon_curr["boosts"]["spa"]);
+			poke.boosts()[3] = FeatureBoost.normalize(pokemon_curr["boosts"]["spd"]);
+			poke.boosts()[4] = FeatureBoost.normalize(pokemon_curr["boosts"]["spe"]);
+			poke.boosts()[5] = FeatureBoost.normalize(pokemon_curr["boosts"]["accuracy"]);
+			poke.boosts()[6] = FeatureBoost.normalize(pokemon_curr["boosts"]["evasion"]);
 
 			// Append trapped
-			poke->trapped = 2 * int(pokemon_curr["trapped"]) - 1;
+			poke.trapped() = FeatureFlag.normalize(int(pokemon_curr["trapped"]));
 
 			// Append Pokemon volatiles if active
 			if (pokemon_curr["isActive"]) {
@@ -243,8 +380,8 @@ BattleParser::getMLVec(int turn_num)
 					for (nlohmann::json &vol: pokemon_curr["volatiles"]) {
 						if (this->dex_data.all_volatiles.contains(vol["id"])) {
 							std::string vol_id = vol["id"];
-							pokestate->sides[side_i]
-								.volatiles[this->dex_data.all_volatiles[vol_id]] = 1;
+							pokestate.sides()[side_i]
+								.volatiles()[this->dex_data.all_volatiles[vol_id]] = 1;
 						}
 					}
 				}
@@ -259,21 +396,21 @@ BattleParser::getMLVec(int turn_num)
 				if (this->dex_data.side_conds.contains(cond["id"])) {
 					std::string cond_id = cond["id"];
 					if (cond_id == "stealthrock") {
-						pokestate->sides[side_i].stealthrock = 1;
+						pokestate.sides()[side_i].stealthrock() = 1;
 					} else if (cond_id == "stickyweb") {
-						pokestate->sides[side_i].stickyweb = 1;
+						pokestate.sides()[side_i].stickyweb() = 1;
 					} else if (cond_id == "spikes") {
-						pokestate->sides[side_i].spikes_ctr = double(this->dex_data.side_conds["spikes"]["layers"]) / 3 * 2 - 1;
+						pokestate.sides()[side_i].spikes_ctr() = FeatureSpikes.normalize(this->dex_data.side_conds["spikes"]["layers"]);
 					} else if (cond_id == "toxicspikes") {
-						pokestate->sides[side_i].tspikes_ctr = double(this->dex_data.side_conds["toxicspikes"]["layers"]) - 1;
+						pokestate.sides()[side_i].tspikes_ctr() = FeatureToxicSpikes.normalize(this->dex_data.side_conds["toxicspikes"]["layers"]);
 					} else if (cond_id == "reflect") {
-						pokestate->sides[side_i].ref_ctr = double(this->dex_data.side_conds["reflect"]["duration"]) / 7 * 2 - 1;
+						pokestate.sides()[side_i].ref_ctr() = FeatureDuration.normalize(this->dex_data.side_conds["reflect"]["duration"]);
 					} else if (cond_id == "lightscreen") {
-						pokestate->sides[side_i].ls_ctr = double(this->dex_data.side_conds["lightscreen"]["duration"]) / 7 * 2 - 1;
+						pokestate.sides()[side_i].ls_ctr() = FeatureDuration.normalize(this->dex_data.side_conds["lightscreen"]["duration"]);
 					} else if (cond_id == "auroraveil") {
-						pokestate->sides[side_i].av_ctr = double(this->dex_data.side_conds["auroraveil"]["duration"]) / 7 * 2 - 1;
+						pokestate.sides()[side_i].av_ctr() = FeatureDuration.normalize(this->dex_data.side_conds["auroraveil"]["duration"]);
 					} else if (cond_id == "tailwind") {
-						pokestate->sides[side_i].tw_ctr = double(this->dex_data.side_conds["tailwind"]["duration"]) / 7 * 2 - 1;
+						pokestate.sides()[side_i].tw_ctr() = FeatureDuration.normalize(this->dex_data.side_conds["tailwind"]["duration"]);
 					}
 				}
 			}
@@ -286,14 +423,13 @@ BattleParser::getMLVec(int turn_num)
 				if (this->dex_data.slot_conds.contains(cond["id"])) {
 					std::string cond_id = cond["id"];
 					if (cond_id == "wish") {
-						pokestate->sides[side_i].wish_ctr =
-							double(this->dex_data.slot_conds["wish"]["duration"]) * 2 - 1;
-						pokestate->sides[side_i].wish_hp =
-							this->normStat(double(this->dex_data.slot_conds["wish"]["hp"]));
+						nlohmann::json &wish = this->dex_data.slot_conds["wish"];
+						pokestate.sides()[side_i].wish_ctr() = FeatureWishTurns.normalize(wish["duration"]);
+						pokestate.sides()[side_i].wish_hp() = FeatureStat.normalize(wish["hp"]);
 					} else if (cond_id == "futuremove") {
-						pokestate->sides[side_i].future_move = 1;
-						pokestate->sides[side_i].future_ctr =
-							double(this->dex_data.slot_conds["futuremove"]["duration"]) - 1;
+						pokestate.sides()[side_i].future_move() = 1;
+						pokestate.sides()[side_i].future_ctr() = FeatureFutureTurns.normalize(
+							this->dex_data.slot_conds["futuremove"]["duration"]);
 					}
 				}
 			}
@@ -303,41 +439,36 @@ BattleParser::getMLVec(int turn_num)
 	// Append weather
 	if (state["field"]["weatherState"].size() > 1) {
 		std::string w_id = state["field"]["weatherState"]["id"];
-		pokestate->weather[this->dex_data.all_weather[w_id]] = 1;
-		pokestate->weather_ctr = double(state["field"]["weatherState"]["duration"]) / 7 * 2 - 1;
+		pokestate.weather()[this->dex_data.all_weather[w_id]] = 1;
+		pokestate.weather_ctr() = FeatureDuration.normalize(state["field"]["weatherState"]["duration"]);
 	}
 
 	// Append terrain
 	if (state["field"]["terrainState"].size() > 1) {
 		std::string t_id = state["field"]["terrainState"]["id"];
-		pokestate->terrain[this->dex_data.all_terrain[t_id]] = 1;
-		pokestate->terrain_ctr = double(state["field"]["terrainState"]["duration"]) / 7 * 2 - 1;
+		pokestate.terrain()[this->dex_data.all_terrain[t_id]] = 1;
+		pokestate.terrain_ctr() = FeatureDuration.normalize(state["field"]["terrainState"]["duration"]);
 	}
 
 	// Append trick room
 	if (state["field"]["pseudoWeather"].size() > 0) {
 		for (nlohmann::json pweather: state["field"]["pseudoWeather"]) {
 			if (pweather["id"] == "trickroom") {
-				pokestate->trick_room = 1;
-				pokestate->tr_ctr = pweather["duration"];
+				pokestate.trick_room() = 1;
+				pokestate.tr_ctr() = FeatureDuration.normalize(pweather["duration"]);
 			}
 		}
 	}
 
-	if (this->debug) {
-		// Print out state vector
-		std::cout << "{\n";
-		size_t count = 0;
-		for (double &i: state_arr) {
-			std::cout.precision(5);
-			std::cout << std::setfill(' ') << std::setw(10) << i << " ";
-			count++;
-			if (count % 10 == 0) {
-				std::cout << '\n';
-			}
+	if (this->debug && logEnabled(LOG_DEBUG_LEVEL)) {
+		std::ostringstream values;
+		values.precision(5);
+		for (double v: state_arr) {
+			values << v << ' ';
 		}
-		std::cout << "\n}\n";
-		std::cout << this->stringifyBattleState(*pokestate);
+
+		LOG_DEBUG("parser", "state vector", "turn", turn_num, "elements", BattleStateSize, "values", values.str(),
+		          "features", this->stringifyBattleState(state_arr));
 	}
 
 	return state_arr;
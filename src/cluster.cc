@@ -0,0 +1,684 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "cluster.hh"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <stdexcept>
+
+#include "arena.hh"
+#include "heuristic_player.hh"
+#include "inference.hh"
+#include "log.hh"
+#include "placement.hh"
+
+namespace {
+/*
+ * message of the given type, or one with an empty type if the text is not
+ * a json object
+ */
+nlohmann::json
+parseMessage(const std::string &text)
+{
+	nlohmann::json msg = nlohmann::json::parse(text, nullptr, false);
+	if (!msg.is_object() || !msg.contains("type") || !msg["type"].is_string()) {
+		return {{"type", ""}};
+	}
+	return msg;
+}
+
+/*
+ * unsigned number field of a message, or 0 if it is missing or not one
+ */
+uint64_t
+countOf(const nlohmann::json &msg, const char *key)
+{
+	auto field = msg.find(key);
+	return field != msg.end() && field->is_number_unsigned() ? field->get<uint64_t>() : 0;
+}
+
+std::string_view
+bytesOf(const std::vector<pokezero::TrajectoryRecord> &records)
+{
+	return std::string_view(reinterpret_cast<const char *>(records.data()),
+	                        records.size() * sizeof(pokezero::TrajectoryRecord));
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * constructor
+ */
+Coordinator::Coordinator(const CoordinatorConfig &config) : config(config), writer(config.prefix) {}
+
+/*
+ * destructor
+ */
+Coordinator::~Coordinator()
+{
+	this->server.shutdown();
+	for (auto &t: this->threads) {
+		if (t.joinable()) {
+			t.join();
+		}
+	}
+}
+
+/*
+ * hand out every battle, and return once each has finished and every worker
+ * has gone
+ *
+ * a worker that disconnects with battles unfinished gives them back, to be
+ * handed out again
+ */
+CoordinatorStats
+Coordinator::run()
+{
+	this->server.socket_name = this->config.address;
+	this->server.listen(true, SOMAXCONN);
+	if (this->server.server_sockfd < 0) {
+		throw std::runtime_error("Could not listen on " + this->config.address);
+	}
+
+	std::shared_ptr<const std::string> model;
+	this->refreshModel(model);
+	LOG_INFO("coordinator", "listening", "address", this->config.address, "battles", this->config.battles);
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread acceptor([this]() {
+		while (std::unique_ptr<showdown::Socket> client = this->server.accept()) {
+			std::lock_guard<std::mutex> lk(this->lock);
+			this->threads.emplace_back(&Coordinator::serve, this, std::move(client));
+		}
+	});
+
+	std::unique_lock<std::mutex> lk(this->lock);
+	while (this->handed < this->config.battles || this->connected > 0) {
+		this->changed.wait(lk);
+	}
+	lk.unlock();
+
+	this->server.shutdown();
+	acceptor.join();
+	for (auto &t: this->threads) {
+		t.join();
+	}
+	this->threads.clear();
+	this->writer.flush();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	this->counts.seconds = elapsed.count();
+	return this->counts;
+}
+
+/*
+ * take up to a job's worth of the battles not yet handed out
+ */
+uint64_t
+Coordinator::takeBattles()
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	uint64_t take = std::min<uint64_t>(this->config.job_battles, this->config.battles - this->handed);
+	this->handed += take;
+	return take;
+}
+
+/*
+ * reload the weights file if it has changed, returning its version and
+ * contents; version 0 means there is no model
+ */
+uint32_t
+Coordinator::refreshModel(std::shared_ptr<const std::string> &bytes)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	if (this->config.model.empty()) {
+		return 0;
+	}
+
+	std::error_code err;
+	auto time = std::filesystem::last_write_time(this->config.model, err);
+	if (!err && (this->model_version == 0 || time != this->model_time)) {
+		std::ifstream in(this->config.model, std::ios::binary);
+		std::stringstream contents;
+		contents << in.rdbuf();
+
+		this->model_bytes = std::make_shared<const std::string>(contents.str());
+		this->model_time = time;
+		this->model_version++;
+		LOG_INFO("coordinator", "model loaded", "path", this->config.model, "version", this->model_version,
+		         "bytes", this->model_bytes->size());
+	}
+
+	bytes = this->model_bytes;
+	return this->model_version;
+}
+
+/*
+ * answer one worker until it says goodbye or disconnects
+ */
+void
+Coordinator::serve(std::unique_ptr<showdown::Socket> client)
+{
+	nlohmann::json hello = parseMessage(client->recvMessage());
+	if (hello["type"] != "hello") {
+		LOG_WARN("coordinator", "connection without a hello");
+		return;
+	}
+
+	std::string worker = hello.value("worker", "unknown");
+	if (hello.value("record_size", size_t(0)) != sizeof(TrajectoryRecord) ||
+	    hello.value("schema", uint64_t(0)) != FeatureSchemaHash) {
+		LOG_ERROR("coordinator", "worker has a different record layout or feature schema, turning it away", "worker", worker);
+		client->sendMessage(nlohmann::json({{"type", "done"}}).dump());
+		return;
+	}
+
+	std::string label = "worker=\"" + worker + '"';
+	Counter &battles = this->metrics.counter("pokezero_cluster_battles_total", "Battles finished by a worker", label);
+	Counter &records =
+	        this->metrics.counter("pokezero_cluster_records_total", "Samples received from a worker", label);
+	Counter &turns = this->metrics.counter("pokezero_cluster_turns_total", "Battle turns played by a worker", label);
+
+	std::unique_lock<std::mutex> lk(this->lock);
+	this->connected++;
+	this->counts.workers++;
+	lk.unlock();
+	LOG_INFO("coordinator", "worker joined", "worker", worker, "concurrency", hello.value("concurrency", 0));
+
+	// battles handed to this worker that it has not reported finished
+	uint64_t outstanding = 0;
+	uint32_t sent_version = 0;
+	std::string payload;
+
+	while (true) {
+		std::string text = client->recvMessage();
+		if (text.empty()) {
+			break;
+		}
+
+		nlohmann::json msg = parseMessage(text);
+		if (msg["type"] == "request") {
+			std::shared_ptr<const std::string> model;
+			uint32_t version = this->refreshModel(model);
+			if (version != sent_version) {
+				client->sendMessage(
+				        nlohmann::json({{"type", "model"}, {"version", version}, {"bytes", model->size()}}).dump(),
+				        *model);
+				sent_version = version;
+			}
+
+			uint64_t take = this->takeBattles();
+			outstanding += take;
+			client->sendMessage(take > 0 ? nlohmann::json({{"type", "job"}, {"battles", take}}).dump()
+			                             : nlohmann::json({{"type", "done"}}).dump());
+		} else if (msg["type"] == "records") {
+			uint64_t count = countOf(msg, "count");
+			if (count > MaxUploadRecords) {
+				LOG_ERROR("coordinator", "upload too large, dropping the worker", "worker", worker, "records",
+				          count, "max", MaxUploadRecords);
+				break;
+			}
+			if (!client->recvBytes(payload, count * sizeof(TrajectoryRecord))) {
+				break;
+			}
+			this->writer.append(reinterpret_cast<const TrajectoryRecord *>(payload.data()), count);
+
+			uint64_t finished = std::min(outstanding, countOf(msg, "battles"));
+			uint64_t played = countOf(msg, "turns");
+			outstanding -= finished;
+			battles.add(finished);
+			records.add(count);
+			turns.add(played);
+
+			lk.lock();
+			this->counts.battles += finished;
+			this->counts.records += count;
+			this->counts.turns += played;
+			lk.unlock();
+
+			client->sendMessage(nlohmann::json({{"type", "ack"}}).dump());
+		} else if (msg["type"] == "bye") {
+			break;
+		} else {
+			LOG_WARN("coordinator", "unknown message", "worker", worker, "message", text);
+		}
+	}
+
+	lk.lock();
+	this->connected--;
+	this->handed -= outstanding;
+	lk.unlock();
+	this->changed.notify_all();
+
+	if (outstanding > 0) {
+		LOG_WARN("coordinator", "worker left with battles unfinished, handing them out again", "worker", worker,
+		         "battles", outstanding);
+	}
+	LOG_INFO("coordinator", "worker left", "worker", worker);
+}
+
+/*
+ * constructor
+ */
+Worker::Worker(const WorkerConfig &config) : config(config), uploads(std::max<size_t>(1, config.window))
+{
+	if (this->config.concurrency == 0) {
+		this->config.concurrency = std::max(1u, std::thread::hardware_concurrency() / 2);
+	}
+}
+
+/*
+ * play battles for the coordinator until it has no more, then send what is
+ * left and leave
+ */
+WorkerStats
+Worker::run()
+{
+	if (!this->socket.connect(this->config.address)) {
+		throw std::runtime_error("Could not connect to " + this->config.address);
+	}
+
+	char host[256] = {};
+	gethostname(host, sizeof(host) - 1);
+	this->send(nlohmann::json({{"type", "hello"},
+	                           {"worker", std::string(host) + ':' + std::to_string(getpid())},
+	                           {"concurrency", this->config.concurrency},
+	                           {"record_size", sizeof(TrajectoryRecord)},
+	                           {"schema", FeatureSchemaHash}})
+	                   .dump());
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread receiver(&Worker::receive, this);
+	std::thread uploader(&Worker::upload, this);
+
+	std::vector<std::thread> battles;
+	for (size_t i = 0; i < this->config.concurrency; i++) {
+		battles.emplace_back(&Worker::play, this, i);
+	}
+	for (auto &t: battles) {
+		t.join();
+	}
+
+	// the last partial batch also reports the battles not yet reported
+	std::unique_lock<std::mutex> lk(this->batch_lock);
+	this->seal(this->batch.size());
+	lk.unlock();
+	this->uploads.close();
+	uploader.join();
+
+	this->send(nlohmann::json({{"type", "bye"}}).dump());
+	this->socket.shutdown();
+	receiver.join();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	this->counts.seconds = elapsed.count();
+	return this->counts;
+}
+
+void
+Worker::send(const std::string &msg, std::string_view payload)
+{
+	std::lock_guard<std::mutex> lk(this->send_lock);
+	this->socket.sendMessage(msg, payload);
+}
+
+/*
+ * handle the coordinator's messages until it closes the connection
+ */
+void
+Worker::receive()
+{
+	std::string payload;
+
+	while (true) {
+		std::string text = this->socket.recvMessage();
+		if (text.empty()) {
+			break;
+		}
+
+		nlohmann::json msg = parseMessage(text);
+		std::unique_lock<std::mutex> lk(this->lock, std::defer_lock);
+		if (msg["type"] == "model") {
+			uint64_t bytes = countOf(msg, "bytes");
+			if (bytes > MaxModelBytes) {
+				LOG_ERROR("worker", "model too large, leaving the coordinator", "bytes", bytes, "max",
+				          MaxModelBytes);
+				this->socket.shutdown();
+				break;
+			}
+			if (!this->socket.recvBytes(payload, bytes)) {
+				break;
+			}
+			this->saveModel(msg.value("version", 0u), payload);
+		} else if (msg["type"] == "job") {
+			lk.lock();
+			this->available += countOf(msg, "battles");
+			this->requested = false;
+		} else if (msg["type"] == "done") {
+			lk.lock();
+			this->done = true;
+			this->requested = false;
+		} else if (msg["type"] == "ack") {
+			lk.lock();
+			this->acked++;
+		} else {
+			LOG_WARN("worker", "unknown message", "message", text);
+		}
+
+		if (lk.owns_lock()) {
+			lk.unlock();
+			this->changed.notify_all();
+		}
+	}
+
+	std::unique_lock<std::mutex> lk(this->lock);
+	if (!this->done) {
+		LOG_ERROR("worker", "coordinator closed the connection", "address", this->config.address);
+	}
+	this->done = true;
+	this->closed = true;
+	lk.unlock();
+	this->changed.notify_all();
+}
+
+/*
+ * keep the newest weights where players can load them
+ */
+void
+Worker::saveModel(uint32_t version, const std::string &bytes)
+{
+	std::filesystem::path path =
+	        std::filesystem::path(this->config.model_dir) / ("pokezero-model-" + std::to_string(version) + ".pznn");
+	std::string tmp = path.string() + ".tmp";
+
+	std::ofstream(tmp, std::ios::binary).write(bytes.data(), std::streamsize(bytes.size()));
+	std::filesystem::rename(tmp, path);
+
+	try {
+		Network network(path.string());
+		LOG_INFO("worker", "model received", "version", version, "path", path.string(), "parameters",
+		         network.parameters());
+	} catch (std::exception &e) {
+		LOG_ERROR("worker", "model received is not usable", "version", version, "error", e.what());
+		return;
+	}
+
+	this->model_version = version;
+}
+
+/*
+ * take the next battle to play, asking for another job once fewer battles
+ * are left than run at once; false once the coordinator has no more
+ */
+bool
+Worker::nextBattle()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	while (true) {
+		bool ask = false;
+		bool take = this->available > 0;
+		if (take) {
+			this->available--;
+			ask = this->available < this->config.concurrency;
+		} else if (this->done) {
+			return false;
+		} else {
+			ask = true;
+		}
+
+		ask = ask && !this->requested && !this->done;
+		if (ask) {
+			this->requested = true;
+			lk.unlock();
+			this->send(nlohmann::json({{"type", "request"}}).dump());
+			lk.lock();
+		}
+
+		if (take) {
+			return true;
+		} else if (!ask) {
+			this->changed.wait(lk);
+		}
+	}
+}
+
+/*
+ * one of the battle threads, each with its own placement slot
+ */
+void
+Worker::play(size_t index)
+{
+	showdown::Placement::Slot slot = showdown::Placement::shared().next();
+	showdown::pinThread(slot.cpus());
+
+	std::string name = "w" + std::to_string(getpid()) + "s" + std::to_string(index);
+	std::mt19937 rng(uint32_t(getpid() * 7919 + index));
+
+	while (this->nextBattle()) {
+		if (this->config.synthetic) {
+			this->syntheticBattle(rng);
+		} else {
+			playBattle<showdown::HeuristicPlayer, showdown::HeuristicPlayer>(this, name, slot);
+		}
+
+		std::lock_guard<std::mutex> lk(this->lock);
+		this->counts.battles++;
+	}
+}
+
+/*
+ * samples of a battle of random states, for load testing a coordinator
+ * without a simulator
+ */
+void
+Worker::syntheticBattle(std::mt19937 &rng)
+{
+	constexpr size_t TURNS = 40;
+	std::uniform_real_distribution<float> uniform(0, 1);
+
+	std::vector<TrajectoryRecord> records(2 * TURNS);
+	for (size_t i = 0; i < records.size(); i++) {
+		TrajectoryRecord &record = records[i];
+		for (float &x: record.state) {
+			x = uniform(rng);
+		}
+		std::fill(std::begin(record.policy), std::end(record.policy), 1.0f / ActionCount);
+		record.mask = (uint32_t(1) << ActionCount) - 1;
+		record.turn = uint16_t(i / 2);
+		record.side = uint8_t(i % 2);
+		record.outcome = int8_t(i % 2 == 0 ? 1 : -1);
+	}
+
+	this->append(records.data(), records.size());
+}
+
+/*
+ * add a battle's samples, which may be none, to the current batch, queueing
+ * each batch that fills; waits while the upload queue is full
+ */
+void
+Worker::append(const TrajectoryRecord *records, size_t count)
+{
+	std::lock_guard<std::mutex> lk(this->batch_lock);
+	this->batch.insert(this->batch.end(), records, records + count);
+	this->battle_ends.push_back(this->batch.size());
+
+	while (this->batch.size() >= this->config.batch_records) {
+		this->seal(this->config.batch_records);
+	}
+}
+
+/*
+ * queue the first n samples of the batch, with the battles whose last
+ * sample is among them; called with batch_lock held
+ */
+void
+Worker::seal(size_t n)
+{
+	static Counter &turns = MetricsRegistry::shared().counter("pokezero_turns_total",
+	                                                          "Battle states received from the node process");
+
+	Upload upload;
+	upload.records.assign(this->batch.begin(), this->batch.begin() + n);
+	this->batch.erase(this->batch.begin(), this->batch.begin() + n);
+
+	auto sealed = std::upper_bound(this->battle_ends.begin(), this->battle_ends.end(), n);
+	upload.battles = uint64_t(sealed - this->battle_ends.begin());
+	this->battle_ends.erase(this->battle_ends.begin(), sealed);
+	for (size_t &end: this->battle_ends) {
+		end -= n;
+	}
+
+	uint64_t played = turns.get();
+	upload.turns = played - this->turns_reported;
+	this->turns_reported = played;
+
+	this->uploads.push(std::move(upload));
+}
+
+/*
+ * send queued batches in order, with at most `window` of them
+ * unacknowledged; returns once the coordinator has acknowledged them all
+ */
+void
+Worker::upload()
+{
+	Upload next;
+	size_t sent = 0;
+
+	while (this->uploads.pop(next)) {
+		std::unique_lock<std::mutex> lk(this->lock);
+		while (sent - this->acked >= this->config.window && !this->closed) {
+			this->changed.wait(lk);
+		}
+		if (this->closed) {
+			// dropped, so battle threads never wait on a full queue
+			continue;
+		}
+		lk.unlock();
+
+		this->send(nlohmann::json({{"type", "records"},
+		                           {"count", next.records.size()},
+		                           {"battles", next.battles},
+		                           {"turns", next.turns},
+		                           {"model", this->model_version.load()}})
+		                   .dump(),
+		           bytesOf(next.records));
+		sent++;
+		this->counts.uploads++;
+		this->counts.records += next.records.size();
+	}
+
+	std::unique_lock<std::mutex> lk(this->lock);
+	while (this->acked < sent && !this->closed) {
+		this->changed.wait(lk);
+	}
+}
+
+/*
+ * arguments: [-n battles] [-j battles per job] [-m weights file] <address>
+ * <shard prefix>
+ */
+int
+coordinate(int argc, char **argv)
+{
+	CoordinatorConfig config;
+
+	int i = 0;
+	for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		if (std::strcmp(argv[i], "-n") == 0) {
+			config.battles = std::stoull(argv[i + 1]);
+		} else if (std::strcmp(argv[i], "-j") == 0) {
+			config.job_battles = std::max(1ul, std::stoul(argv[i + 1]));
+		} else if (std::strcmp(argv[i], "-m") == 0) {
+			config.model = argv[i + 1];
+		} else {
+			break;
+		}
+	}
+
+	if (argc - i != 2) {
+		std::cerr << "usage: coordinator [-n battles] [-j battles per job] [-m weights file] <address> <shard prefix>"
+			  << std::endl;
+		return 1;
+	}
+	config.address = argv[i];
+	config.prefix = argv[i + 1];
+
+	Coordinator coordinator(config);
+	CoordinatorStats stats = coordinator.run();
+	std::cout << stats.battles << " battles, " << stats.records << " records, " << stats.turns << " turns from "
+		  << stats.workers << " workers in " << stats.seconds << "s: " << double(stats.battles) / stats.seconds
+		  << " battles/sec, " << double(stats.records) / stats.seconds << " records/sec" << std::endl;
+
+	return 0;
+}
+
+/*
+ * arguments: [-c concurrent battles] [-b batch records] [-w window] [-s]
+ * <address>
+ */
+int
+work(int argc, char **argv)
+{
+	WorkerConfig config;
+
+	int i = 0;
+	while (i < argc && argv[i][0] == '-') {
+		if (std::strcmp(argv[i], "-s") == 0) {
+			config.synthetic = true;
+			i++;
+		} else if (i + 1 < argc && std::strcmp(argv[i], "-c") == 0) {
+			config.concurrency = std::stoul(argv[i + 1]);
+			i += 2;
+		} else if (i + 1 < argc && std::strcmp(argv[i], "-b") == 0) {
+			config.batch_records = std::clamp<size_t>(std::stoul(argv[i + 1]), 1, MaxUploadRecords);
+			i += 2;
+		} else if (i + 1 < argc && std::strcmp(argv[i], "-w") == 0) {
+			config.window = std::max(1ul, std::stoul(argv[i + 1]));
+			i += 2;
+		} else {
+			break;
+		}
+	}
+
+	if (argc - i != 1) {
+		std::cerr << "usage: worker [-c concurrent battles] [-b batch records] [-w window] [-s] <address>"
+			  << std::endl;
+		return 1;
+	}
+	config.address = argv[i];
+
+	Worker worker(config);
+	WorkerStats stats = worker.run();
+	std::cout << stats.battles << " battles, " << stats.records << " records in " << stats.uploads
+		  << " uploads in " << stats.seconds << "s" << std::endl;
+
+	return 0;
+}
+} // namespace pokezero
@@ -0,0 +1,369 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "damage.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+
+#include "dex.hh"
+
+namespace {
+// targets are padded to this many int32 lanes, one AVX2 register
+constexpr size_t Lanes = 8;
+
+/*
+ * reference damage ranges worked through showdown's getDamage pipeline
+ * (sim/battle-actions.ts) for level, stats and base power as given; min and
+ * max are the lowest and highest rolls, sum is the total over all 16 rolls
+ */
+struct ReferenceCase {
+	const char *name;
+	double level, attack, defense, base_power;
+	bool stab;
+	double effectiveness;
+	float min, max, sum;
+};
+
+const ReferenceCase reference_cases[] = {
+	{"252+ atk garchomp earthquake vs 0 def heatran", 100, 394, 248, 100, true, 4, 684, 808, 11928},
+	{"252+ atk garchomp outrage vs 252+ def ferrothorn", 100, 394, 397, 120, true, 0.5, 64, 76, 1117},
+	{"252+ spa gengar shadow ball vs 0 spd alakazam", 100, 394, 226, 80, true, 2, 302, 356, 5252},
+	{"252 atk tyranitar stone edge vs 0 def charizard", 100, 367, 192, 100, true, 4, 820, 972, 14324},
+	{"0 atk blissey tackle vs 252+ def skarmory", 100, 56, 416, 40, false, 0.5, 2, 3, 33},
+	{"level 50 pikachu thunderbolt vs gyarados", 50, 102, 120, 90, true, 4, 172, 208, 3044},
+	{"normal move vs ghost", 100, 300, 200, 80, true, 0, 0, 0, 0},
+	{"doubly resisted chip damage", 100, 5, 400, 20, false, 0.25, 1, 1, 16},
+};
+
+double
+denormStat(double stat)
+{
+	return std::round(pokezero::FeatureStat.denormalize(stat));
+}
+
+// showdown floors boosted stats
+double
+boosted(double stat, double boost)
+{
+	double stage = std::round(pokezero::FeatureBoost.denormalize(boost));
+	return std::floor(stat * (stage >= 0 ? (2 + stage) / 2 : 2 / (2 - stage)));
+}
+
+/*
+ * random state with full parties of damaging moves for the benchmark
+ */
+MLVec
+randomState(std::mt19937 &rng, const std::vector<int> &moves)
+{
+	std::uniform_real_distribution<double> unit(0, 1);
+	std::uniform_int_distribution<size_t> type(0, pokezero::NumTypes - 1);
+	std::uniform_int_distribution<size_t> move(0, moves.size() - 1);
+
+	MLVec vec;
+	vec.fill(pokezero::FeatureAbsent);
+	auto state = features(vec);
+
+	for (auto side: state.sides()) {
+		for (size_t i = 0; i < 6; i++) {
+			auto poke = side.pokemon()[i];
+			poke.active() = i == 0 ? 1 : -1;
+			poke.types()[type(rng)] = 1;
+			poke.types()[type(rng)] = 1;
+			poke.hp() = pokezero::FeatureRatio.normalize(unit(rng));
+			for (size_t s = 0; s < 6; s++) {
+				poke.stats()[s] = pokezero::FeatureStat.normalize(150 + unit(rng) * 300);
+			}
+			std::fill(poke.boosts().begin(), poke.boosts().end(), 0);
+			for (auto m: poke.moves()) {
+				m.id() = double(moves[move(rng)]);
+				m.pp() = 1;
+				m.disabled() = -1;
+			}
+		}
+	}
+
+	return vec;
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * all 16 damage rolls of one attack, lowest first
+ *
+ * base damage is floor(floor(floor(2L/5 + 2) * BP * A / D) / 50) + 2, then
+ * each roll is floored, STAB is a 1.5x pokeRound (which for integers equals
+ * a floor) and type effectiveness doubles or halves with a floor. Anything
+ * that is not immune does at least 1.
+ */
+DamageRolls
+DamageCalc::rolls(double level, double attack, double defense, double base_power, bool stab,
+                  double effectiveness)
+{
+	DamageRolls out;
+	double base = std::floor(std::floor(std::floor(2 * level / 5 + 2) * base_power * attack /
+	                                    std::max(1.0, defense)) /
+	                         50) +
+	              2;
+
+	for (size_t r = 0; r < NumRolls; r++) {
+		double damage = std::floor(base * double(85 + r) / 100);
+		if (stab) {
+			damage = std::floor(damage * 1.5);
+		}
+		damage = std::floor(damage * effectiveness);
+
+		out[r] = effectiveness > 0 ? float(std::max(1.0, damage)) : 0;
+	}
+
+	return out;
+}
+
+/*
+ * expected damage and KO chance of each move of one Pokemon on one side
+ * against every Pokemon on the other side
+ *
+ * the attacker is a party index in MLVec order, or -1 for the active
+ * Pokemon. Missing moves, status moves and fainted or unknown targets get 0.
+ */
+DamageTable
+DamageCalc::compute(const MLVec &vec, size_t side, int attacker) const
+{
+	auto state = features(vec);
+	SideView<const double> self = state.sides()[side];
+	SideView<const double> other = state.sides()[1 - side];
+	const Dex &dex = Dex::get();
+	DamageTable table;
+
+	if (attacker < 0) {
+		for (size_t i = 0; i < 6; i++) {
+			if (self.pokemon()[i].active() > 0) {
+				attacker = int(i);
+			}
+		}
+		if (attacker < 0) {
+			return table;
+		}
+	}
+
+	PokemonView<const double> poke = self.pokemon()[attacker];
+	if (poke.stats()[0] <= -1) {
+		return table;
+	}
+
+	int64_t attack = int64_t(boosted(denormStat(poke.stats()[1]), poke.boosts()[0]));
+	int64_t special_attack = int64_t(boosted(denormStat(poke.stats()[3]), poke.boosts()[2]));
+
+	// targets as structure of arrays; padding lanes have 0 hp
+	alignas(32) int32_t hp[Lanes] = {};
+	alignas(32) int32_t defense[Lanes] = {};
+	alignas(32) int32_t special_defense[Lanes] = {};
+	alignas(32) int32_t has_type[NumTypes][Lanes] = {};
+
+	for (size_t i = 0; i < 6; i++) {
+		PokemonView<const double> target = other.pokemon()[i];
+		if (target.stats()[0] <= -1) {
+			continue;
+		}
+
+		hp[i] = int32_t(std::round(FeatureRatio.denormalize(target.hp()) * denormStat(target.stats()[0])));
+		table.hp[i] = float(hp[i]);
+		defense[i] = int32_t(std::max(1.0, boosted(denormStat(target.stats()[2]), target.boosts()[1])));
+		special_defense[i] = int32_t(std::max(1.0, boosted(denormStat(target.stats()[4]), target.boosts()[3])));
+		for (size_t t = 0; t < NumTypes; t++) {
+			has_type[t][i] = target.types()[t] > 0;
+		}
+	}
+
+	int64_t level_factor = int64_t(2 * this->level / 5 + 2);
+
+	for (size_t m = 0; m < 4; m++) {
+		if (poke.moves()[m].id() < 0) {
+			continue;
+		}
+
+		const MoveInfo &info = dex.move(size_t(poke.moves()[m].id()));
+		if (info.category == STATUS || info.base_power <= 0) {
+			continue;
+		}
+
+		bool physical = info.category == PHYSICAL;
+		int32_t stab = poke.types()[info.type] > 0;
+		int64_t numerator = level_factor * int64_t(info.base_power) * (physical ? attack : special_attack);
+		const int32_t *defend = physical ? defense : special_defense;
+
+		// showdown applies type effectiveness as a net number of doublings
+		// or halvings
+		alignas(32) int32_t doublings[Lanes] = {};
+		alignas(32) int32_t immune[Lanes] = {};
+		for (size_t t = 0; t < NumTypes; t++) {
+			float multiplier = dex.effectiveness(info.type, t);
+			int32_t step = multiplier > 1 ? 1 : (multiplier < 1 && multiplier > 0 ? -1 : 0);
+			int32_t none = multiplier == 0;
+			for (size_t l = 0; l < Lanes; l++) {
+				doublings[l] += has_type[t][l] * step;
+				immune[l] |= has_type[t][l] * none;
+			}
+		}
+
+		// floor(floor(x / D) / 50) is floor(x / 50D); immune targets take
+		// 0 and anything else at least 1
+		alignas(32) int32_t base[Lanes];
+		alignas(32) int32_t up[Lanes];
+		alignas(32) int32_t down[Lanes];
+		alignas(32) int32_t least[Lanes];
+		for (size_t l = 0; l < Lanes; l++) {
+			base[l] = int32_t(numerator / (50 * int64_t(std::max(1, defend[l])))) + 2;
+			up[l] = std::max(0, doublings[l]);
+			down[l] = std::max(0, -doublings[l]);
+			least[l] = 1 - immune[l];
+		}
+
+		// integer and branch free, as in showdown, so the lane loop
+		// vectorizes; fainted and padding lanes are dropped when the table
+		// is written
+		alignas(32) int32_t total[Lanes] = {};
+		alignas(32) int32_t kos[Lanes] = {};
+		for (int32_t r = 0; r < int32_t(NumRolls); r++) {
+			for (size_t l = 0; l < Lanes; l++) {
+				int32_t damage = base[l] * (85 + r) / 100;
+				damage += stab * (damage >> 1);
+				damage = (damage << up[l]) >> down[l];
+				damage = std::max(least[l], damage) * least[l];
+
+				total[l] += std::min(damage, hp[l]);
+				kos[l] += damage >= hp[l];
+			}
+		}
+
+		float scale = info.accuracy / float(NumRolls);
+		for (size_t i = 0; i < 6; i++) {
+			if (hp[i] > 0) {
+				table.expected[m][i] = float(total[i]) * scale;
+				table.ko[m][i] = float(kos[i]) * scale;
+			}
+		}
+	}
+
+	return table;
+}
+
+/*
+ * checks the calculator against the reference cases and against the scalar
+ * formula on random states, then times compute()
+ *
+ * arguments: [iterations]
+ */
+int
+benchDamage(int argc, char **argv)
+{
+	size_t iterations = argc > 0 ? std::stoul(argv[0]) : 200000;
+	const Dex &dex = Dex::get();
+	int failures = 0;
+
+	for (auto &c: reference_cases) {
+		DamageRolls r = DamageCalc::rolls(c.level, c.attack, c.defense, c.base_power, c.stab, c.effectiveness);
+		float sum = 0;
+		for (float d: r) {
+			sum += d;
+		}
+
+		bool ok = r.front() == c.min && r.back() == c.max && sum == c.sum;
+		failures += !ok;
+		std::cout << (ok ? "ok   " : "FAIL ") << c.name << ": " << r.front() << '-' << r.back() << " (expected "
+			  << c.min << '-' << c.max << ")\n";
+	}
+
+	std::vector<int> moves;
+	for (size_t m = 0; m < dex.numMoves(); m++) {
+		const MoveInfo &info = dex.move(m);
+		if (info.category != STATUS && info.base_power > 0 && info.pp > 1) {
+			moves.push_back(int(m));
+		}
+	}
+
+	std::mt19937 rng(0);
+	std::vector<MLVec> states;
+	for (size_t i = 0; i < 256; i++) {
+		states.push_back(randomState(rng, moves));
+	}
+
+	// the batched path must agree with the scalar formula
+	DamageCalc calc;
+	size_t mismatches = 0;
+	for (auto &vec: states) {
+		auto state = features(vec);
+		PokemonView<const double> poke = state.sides()[0].pokemon()[0];
+		DamageTable table = calc.compute(vec, 0);
+
+		for (size_t m = 0; m < 4; m++) {
+			const MoveInfo &info = dex.move(size_t(poke.moves()[m].id()));
+			bool physical = info.category == PHYSICAL;
+
+			for (size_t i = 0; i < 6; i++) {
+				PokemonView<const double> target = state.sides()[1].pokemon()[i];
+				uint32_t types = 0;
+				for (size_t t = 0; t < NumTypes; t++) {
+					types |= uint32_t(target.types()[t] > 0) << t;
+				}
+
+				double hp =
+				        std::round(FeatureRatio.denormalize(target.hp()) * denormStat(target.stats()[0]));
+				DamageRolls r = DamageCalc::rolls(calc.level, denormStat(poke.stats()[physical ? 1 : 3]),
+				                                  denormStat(target.stats()[physical ? 2 : 4]),
+				                                  info.base_power, poke.types()[info.type] > 0,
+				                                  dex.matchup(info.type, types));
+
+				double expected = 0, ko = 0;
+				for (float d: r) {
+					expected += std::min(double(d), hp);
+					ko += hp > 0 && d >= hp;
+				}
+				expected *= info.accuracy / NumRolls;
+				ko *= info.accuracy / NumRolls;
+
+				if (std::abs(expected - table.expected[m][i]) > 1e-3 * std::max(1.0, expected) ||
+				    std::abs(ko - table.ko[m][i]) > 1e-6) {
+					mismatches++;
+				}
+			}
+		}
+	}
+	failures += mismatches > 0;
+	std::cout << (mismatches ? "FAIL " : "ok   ") << "batched vs scalar: " << mismatches
+		  << " mismatches over " << states.size() * 24 << " move/target pairs\n";
+
+	float sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		DamageTable table = calc.compute(states[i % states.size()], i & 1);
+		sink += table.expected[0][0];
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	double calls = double(iterations) / elapsed.count();
+	std::cout << calls << " tables/sec, " << elapsed.count() * 1e9 / double(iterations * 24)
+		  << " ns per move/target pair (checksum " << sink << ")\n";
+
+	return failures ? 1 : 0;
+}
+} // namespace pokezero
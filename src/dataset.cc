@@ -0,0 +1,496 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "dataset.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+#include "hash.hh"
+
+namespace {
+/*
+ * keyed pseudo-random permutation of [0, n): a Feistel network over the
+ * smallest even number of bits that covers n, walking the cycle until it lands
+ * back inside the range
+ */
+class Permutation {
+public:
+	Permutation(uint64_t n, uint64_t key) : n(n), key(key)
+	{
+		while ((uint64_t(1) << (2 * this->half)) < n) {
+			this->half++;
+		}
+		this->mask = (uint64_t(1) << this->half) - 1;
+	}
+
+	uint64_t operator()(uint64_t i) const
+	{
+		do {
+			i = this->feistel(i);
+		} while (i >= this->n);
+		return i;
+	}
+
+private:
+	uint64_t n;
+	uint64_t key;
+	int half = 1;
+	uint64_t mask;
+
+	uint64_t feistel(uint64_t x) const
+	{
+		uint64_t left = x >> this->half;
+		uint64_t right = x & this->mask;
+		for (uint64_t round = 0; round < 4; round++) {
+			uint64_t block[2] = {right, this->key + round};
+			uint64_t next = left ^ (pokezero::xxh64(block, sizeof(block)) & this->mask);
+			left = right;
+			right = next;
+		}
+		return (left << this->half) | right;
+	}
+};
+
+// samples per batch and batches per run in bench-dataset
+constexpr size_t BENCH_BATCH = 256;
+constexpr size_t BENCH_BATCHES = 400;
+} // namespace
+
+namespace pokezero {
+/*
+ * constructor
+ *
+ * opens the given shards in order
+ */
+TrajectoryDataset::TrajectoryDataset(const std::vector<std::string> &paths)
+{
+	for (const std::string &path: paths) {
+		this->add(path);
+	}
+}
+
+/*
+ * destructor
+ */
+TrajectoryDataset::~TrajectoryDataset()
+{
+	for (Shard &shard: this->shards) {
+		munmap(const_cast<TrajectoryHeader *>(shard.header), shard.size);
+	}
+}
+
+/*
+ * map a finished shard and number its records after every record already
+ * held
+ *
+ * throws if the shard was written with a different record layout
+ */
+void
+TrajectoryDataset::add(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		throw std::system_error(errno, std::generic_category(), path);
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) < 0 || size_t(info.st_size) < sizeof(TrajectoryHeader)) {
+		close(fd);
+		throw std::runtime_error(path + ": not a trajectory shard");
+	}
+
+	size_t size = size_t(info.st_size);
+	void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		throw std::system_error(errno, std::generic_category(), path);
+	}
+
+	const TrajectoryHeader *header = static_cast<const TrajectoryHeader *>(map);
+	if (std::memcmp(header->magic, TrajectoryHeader::Magic, sizeof(header->magic)) != 0 ||
+	    header->record_size != sizeof(TrajectoryRecord) || header->state_size != BattleStateSize ||
+	    header->action_count != ActionCount ||
+	    size < sizeof(TrajectoryHeader) + header->records * sizeof(TrajectoryRecord)) {
+		munmap(map, size);
+		throw std::runtime_error(path + ": trajectory shard layout does not match this build");
+	}
+	if (header->schema != FeatureSchemaHash) {
+		munmap(map, size);
+		throw std::runtime_error(path + ": trajectory shard was written with a different feature schema");
+	}
+
+	// records are read at random, so readahead would mostly be wasted
+	madvise(map, size, MADV_RANDOM);
+
+	std::unique_lock<std::shared_mutex> lk(this->lock);
+	this->shards.push_back({path, header, size, this->last});
+	this->last += header->records;
+}
+
+/*
+ * unmap shards whose records all come before the given record number and
+ * return how many were dropped
+ */
+size_t
+TrajectoryDataset::trim(uint64_t keep)
+{
+	std::unique_lock<std::shared_mutex> lk(this->lock);
+
+	size_t dropped = 0;
+	while (!this->shards.empty() && this->shards.front().first + this->shards.front().header->records <= keep) {
+		Shard &shard = this->shards.front();
+		this->first = shard.first + shard.header->records;
+		munmap(const_cast<TrajectoryHeader *>(shard.header), shard.size);
+		this->shards.pop_front();
+		dropped++;
+	}
+
+	return dropped;
+}
+
+// number of the oldest record held
+uint64_t
+TrajectoryDataset::begin()
+{
+	std::shared_lock<std::shared_mutex> lk(this->lock);
+	return this->first;
+}
+
+// one past the number of the newest record held
+uint64_t
+TrajectoryDataset::end()
+{
+	std::shared_lock<std::shared_mutex> lk(this->lock);
+	return this->last;
+}
+
+/*
+ * copy out the records with the given numbers; throws std::out_of_range for
+ * one that is not held
+ */
+void
+TrajectoryDataset::read(const uint64_t *numbers, size_t count, TrajectoryRecord *out)
+{
+	std::shared_lock<std::shared_mutex> lk(this->lock);
+	for (size_t i = 0; i < count; i++) {
+		std::memcpy(&out[i], &this->record(numbers[i]), sizeof(TrajectoryRecord));
+	}
+}
+
+/*
+ * pick record numbers and copy those records out under one lock, so no trim
+ * can drop them in between; the numbers are sorted so reads from the same
+ * shard pages land together. False, with nothing picked, while the dataset
+ * is empty
+ */
+bool
+TrajectoryDataset::sample(const Picker &pick, std::vector<uint64_t> &numbers, TrajectoryRecord *out)
+{
+	std::shared_lock<std::shared_mutex> lk(this->lock);
+	if (this->first == this->last) {
+		return false;
+	}
+
+	pick(this->first, this->last, numbers);
+	std::sort(numbers.begin(), numbers.end());
+	for (size_t i = 0; i < numbers.size(); i++) {
+		std::memcpy(&out[i], &this->record(numbers[i]), sizeof(TrajectoryRecord));
+	}
+
+	return true;
+}
+
+/*
+ * find a record by binary search over the shards' first record numbers;
+ * called with the lock held
+ */
+const TrajectoryRecord &
+TrajectoryDataset::record(uint64_t number) const
+{
+	if (number < this->first || number >= this->last) {
+		throw std::out_of_range("Trajectory record " + std::to_string(number) + " is not held");
+	}
+
+	auto shard = std::upper_bound(this->shards.begin(), this->shards.end(), number,
+	                              [](uint64_t n, const Shard &s) { return n < s.first; });
+	shard--;
+
+	const TrajectoryRecord *records = reinterpret_cast<const TrajectoryRecord *>(shard->header + 1);
+	return records[number - shard->first];
+}
+
+/*
+ * constructor
+ *
+ * depth is how many batches the background thread gathers ahead of next()
+ */
+BatchLoader::BatchLoader(TrajectoryDataset &dataset, size_t batch_size, uint64_t window, size_t depth, uint64_t seed)
+        : dataset(dataset)
+{
+	if (batch_size == 0 || depth == 0) {
+		throw std::invalid_argument("BatchLoader batch_size and depth must be positive");
+	}
+
+	this->batch_size = batch_size;
+	this->window = window;
+	this->depth = depth;
+	this->seed = seed;
+
+	this->threads.push_back(std::thread([this]() { this->loop(); }));
+}
+
+/*
+ * destructor
+ */
+BatchLoader::~BatchLoader()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	this->stopping = true;
+	lk.unlock();
+	this->consumed.notify_all();
+
+	for (auto &t: this->threads) {
+		t.join();
+	}
+	this->threads.clear();
+}
+
+/*
+ * take the next gathered batch, waiting for one if the background thread is
+ * behind; the batch passed in is recycled for a later one
+ */
+void
+BatchLoader::next(Batch &batch)
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	while (this->batches.empty()) {
+		this->ready.wait(lk);
+	}
+
+	Batch used = std::move(batch);
+	batch = std::move(this->batches.front());
+	this->batches.pop_front();
+	if (used.size > 0) {
+		this->spare.push_back(std::move(used));
+	}
+	lk.unlock();
+
+	this->consumed.notify_one();
+}
+
+// full passes over the dataset completed; always 0 for a replay buffer
+uint64_t
+BatchLoader::epoch()
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	return this->epochs;
+}
+
+void
+BatchLoader::loop()
+{
+	std::vector<uint64_t> numbers(this->batch_size);
+	std::vector<TrajectoryRecord> records(this->batch_size);
+
+	std::unique_lock<std::mutex> lk(this->lock);
+	while (true) {
+		while (this->batches.size() >= this->depth && !this->stopping) {
+			this->consumed.wait(lk);
+		}
+		if (this->stopping) {
+			return;
+		}
+
+		Batch batch;
+		if (!this->spare.empty()) {
+			batch = std::move(this->spare.back());
+			this->spare.pop_back();
+		}
+		lk.unlock();
+
+		this->gather(batch, numbers, records);
+
+		lk.lock();
+		if (batch.size == 0) {
+			// nothing to sample from yet
+			this->consumed.wait_for(lk, std::chrono::milliseconds(10));
+			continue;
+		}
+		this->batches.push_back(std::move(batch));
+		this->ready.notify_one();
+	}
+}
+
+/*
+ * copy out the records of the next batch
+ */
+void
+BatchLoader::gather(Batch &batch, std::vector<uint64_t> &numbers, std::vector<TrajectoryRecord> &records)
+{
+	batch.size = 0;
+	auto pick = [this](uint64_t begin, uint64_t end, std::vector<uint64_t> &picked) {
+		this->pick(begin, end, picked);
+	};
+	if (!this->dataset.sample(pick, numbers, records.data())) {
+		return;
+	}
+
+	batch.size = this->batch_size;
+	batch.states.resize(batch.size * BattleStateSize);
+	batch.policies.resize(batch.size * ActionCount);
+	batch.masks.resize(batch.size);
+	batch.outcomes.resize(batch.size);
+
+	for (size_t i = 0; i < batch.size; i++) {
+		const TrajectoryRecord &record = records[i];
+		std::copy(std::begin(record.state), std::end(record.state), &batch.states[i * BattleStateSize]);
+		std::copy(std::begin(record.policy), std::end(record.policy), &batch.policies[i * ActionCount]);
+		batch.masks[i] = record.mask;
+		batch.outcomes[i] = float(record.outcome);
+	}
+}
+
+/*
+ * pick the next batch's record numbers from the records held, begin to end;
+ * called with the dataset's lock held
+ *
+ * records of the current epoch dropped since it started are skipped
+ */
+void
+BatchLoader::pick(uint64_t begin, uint64_t end, std::vector<uint64_t> &numbers)
+{
+	if (this->window > 0) {
+		begin = std::max(begin, end - std::min(end, this->window));
+
+		std::mt19937_64 rng(this->seed + this->position++);
+		std::uniform_int_distribution<uint64_t> pick(begin, end - 1);
+		for (uint64_t &n: numbers) {
+			n = pick(rng);
+		}
+	} else {
+		// an epoch covers the records held when it started
+		if (this->epoch_count == 0) {
+			this->epoch_begin = begin;
+			this->epoch_count = end - begin;
+		}
+
+		for (uint64_t &n: numbers) {
+			do {
+				if (this->position >= this->epoch_count) {
+					std::lock_guard<std::mutex> lk(this->lock);
+					this->epochs++;
+					this->position = 0;
+					this->epoch_begin = begin;
+					this->epoch_count = end - begin;
+				}
+				Permutation order(this->epoch_count, this->seed + this->epochs);
+				n = this->epoch_begin + order(this->position++);
+			} while (n < begin);
+		}
+	}
+}
+
+/*
+ * write synthetic shards, then report samples/sec for random single record
+ * reads, shuffled epochs and a replay window
+ *
+ * usage: bench-dataset [records] [directory]
+ */
+int
+benchDataset(int argc, char **argv)
+{
+	uint64_t count = argc > 0 ? std::stoull(argv[0]) : 100000;
+	std::string prefix = std::string(argc > 1 ? argv[1] : "/tmp") + "/pokezero-bench-dataset";
+
+	std::vector<std::string> paths;
+	{
+		TrajectoryWriter writer(prefix, 64 << 20);
+		std::vector<TrajectoryRecord> battle(100);
+		std::mt19937 rng(0);
+		std::uniform_real_distribution<float> value(-1, 1);
+		for (uint64_t written = 0; written < count; written += battle.size()) {
+			for (TrajectoryRecord &record: battle) {
+				std::generate(std::begin(record.state), std::end(record.state), [&]() { return value(rng); });
+				std::fill(std::begin(record.policy), std::end(record.policy), 1.0f / ActionCount);
+				record.mask = (uint32_t(1) << ActionCount) - 1;
+				record.turn = uint16_t(written % 100);
+				record.side = 0;
+				record.outcome = 1;
+			}
+			writer.append(battle.data(), std::min<uint64_t>(battle.size(), count - written));
+		}
+		writer.flush();
+
+		for (uint64_t i = 0; i < writer.stats().shards; i++) {
+			paths.push_back(TrajectoryWriter::shardName(prefix, i));
+		}
+	}
+
+	int status = 0;
+	try {
+		TrajectoryDataset dataset(paths);
+		std::cout << dataset.end() << " records in " << paths.size() << " shards of " << sizeof(TrajectoryRecord)
+			  << " bytes each\n";
+
+		std::mt19937_64 rng(1);
+		std::uniform_int_distribution<uint64_t> pick(0, dataset.end() - 1);
+		TrajectoryRecord record;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < BENCH_BATCH * BENCH_BATCHES; i++) {
+			uint64_t n = pick(rng);
+			dataset.read(&n, 1, &record);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "random reads: " << double(BENCH_BATCH * BENCH_BATCHES) / elapsed.count() << " samples/sec\n";
+
+		for (uint64_t window: {uint64_t(0), dataset.end() / 4}) {
+			BatchLoader loader(dataset, BENCH_BATCH, window);
+			Batch batch;
+			start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < BENCH_BATCHES; i++) {
+				loader.next(batch);
+			}
+			elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << (window == 0 ? "shuffled epochs: " : "replay window: ")
+				  << double(BENCH_BATCH * BENCH_BATCHES) / elapsed.count() << " samples/sec in batches of "
+				  << BENCH_BATCH << "\n";
+		}
+	} catch (std::exception &e) {
+		std::cerr << "bench-dataset: " << e.what() << std::endl;
+		status = 1;
+	}
+
+	for (const std::string &path: paths) {
+		unlink(path.c_str());
+	}
+
+	return status;
+}
+} // namespace pokezero
@@ -0,0 +1,461 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "determinizer.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+// items commonly seen on competitive sets get this much more weight than
+// other hold items and berries
+constexpr double COMMON_ITEM_WEIGHT = 20;
+const char *common_items[] = {
+	"leftovers",   "lifeorb",        "choiceband",  "choicespecs", "choicescarf", "focussash",
+	"assaultvest", "heavydutyboots", "sitrusberry", "lumberry",    "rockyhelmet", "expertbelt",
+	"blacksludge", "weaknesspolicy", "airballoon",  "lightclay",   "eviolite",    "toxicorb",
+	"flameorb",    "mentalherb",     "whiteherb",   "powerherb",   "redcard",
+};
+
+// share of the ability distribution given to the dex's most likely ability
+constexpr double LIKELY_ABILITY_WEIGHT = 0.6;
+
+// chance that a hidden move slot is drawn from the status moves
+constexpr double STATUS_MOVE_SHARE = 0.25;
+
+// draws allowed when filling a moveset before giving up on duplicates
+constexpr size_t MAX_MOVE_DRAWS = 64;
+
+// dex stat names in the order of SampledSet::stats
+const char *stat_names[] = {"hp", "attack", "defense", "special-attack", "special-defense", "speed"};
+
+// opposing party for the benchmark, in getMLVec's species id order
+const std::vector<std::string> bench_party = {"blissey", "dragonite", "ferrothorn", "garchomp", "gengar", "toxapex"};
+
+// ability and item planted in the benchmark's vector as the opponent's real set
+constexpr double BENCH_HIDDEN = 9999;
+
+/*
+ * dex names ("Sand Veil", "Heavy-Duty Boots") to the keys of the id files
+ * ("sandveil", "heavydutyboots")
+ */
+std::string
+toId(const std::string &name)
+{
+	std::string id;
+	for (unsigned char c: name) {
+		if (std::isalnum(c) || c == '(' || c == ')') {
+			id += char(std::tolower(c));
+		}
+	}
+
+	return id;
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * shared instance, loaded on first use
+ */
+const Determinizer &
+Determinizer::get()
+{
+	static const Determinizer determinizer;
+	return determinizer;
+}
+
+/*
+ * constructor
+ *
+ * placeholder until the dex has learnsets: each species' damaging move
+ * pool is the MovePoolSize moves of its own types weighted highest by base
+ * power and accuracy, and status moves, which carry no such score, are
+ * shared by every species and drawn uniformly
+ */
+Determinizer::Determinizer()
+{
+	std::ifstream ifpokedex("data/pokedex.json");
+	std::ifstream ifabilities("data/ability_id.json");
+	std::ifstream ifitem_ids("data/item_id.json");
+	std::ifstream ifitems("data/items.json");
+
+	nlohmann::json pokedex, ability_ids, item_ids, items_json;
+	ifpokedex >> pokedex;
+	ifabilities >> ability_ids;
+	ifitem_ids >> item_ids;
+	ifitems >> items_json;
+
+	const Dex &dex = Dex::get();
+
+	// item prior, shared by every species
+	std::vector<int> item_values;
+	std::vector<double> item_weights;
+	for (auto &item: items_json) {
+		if (item["type"] != "Hold items" && item["type"] != "Berries") {
+			continue;
+		}
+
+		std::string name = item["name"].is_object() ? item["name"]["english"] : item["name"];
+		std::string id = toId(name);
+		if (!item_ids.contains(id)) {
+			continue;
+		}
+
+		bool common = std::find(std::begin(common_items), std::end(common_items), id) != std::end(common_items);
+		item_values.push_back(item_ids[id]);
+		item_weights.push_back(common ? COMMON_ITEM_WEIGHT : 1);
+	}
+	this->items = AliasTable(item_values, item_weights);
+
+	// status moves, shared by every species; z-moves and max moves (1 pp)
+	// cannot be in a moveset
+	std::vector<int> status_values;
+	for (size_t m = 0; m < dex.numMoves(); m++) {
+		const MoveInfo &info = dex.move(m);
+		if (info.pp > 1 && info.category == STATUS) {
+			status_values.push_back(int(m));
+		}
+	}
+	this->status_moves = AliasTable(status_values, std::vector<double>(status_values.size(), 1));
+
+	for (auto &[key, entry]: pokedex.items()) {
+		SpeciesTables tables;
+
+		for (size_t s = 0; s < 6; s++) {
+			tables.base_stats[s] = entry["baseStats"][stat_names[s]];
+		}
+
+		tables.types = 0;
+		for (std::string type: entry["types"]) {
+			int id = dex.typeId(type);
+			if (id >= 0) {
+				tables.types |= 1u << id;
+			}
+		}
+
+		// abilities
+		std::vector<int> ability_values;
+		std::vector<double> ability_weights;
+		std::string likely = toId(entry.value("most_likely_ability", ""));
+		for (auto &[_, name]: entry["abilities"].items()) {
+			std::string id = toId(name);
+			if (!ability_ids.contains(id)) {
+				continue;
+			}
+			ability_values.push_back(ability_ids[id]);
+			ability_weights.push_back(id == likely ? LIKELY_ABILITY_WEIGHT : 1 - LIKELY_ABILITY_WEIGHT);
+		}
+		if (!ability_values.empty()) {
+			tables.abilities = AliasTable(ability_values, ability_weights);
+		}
+
+		// damaging moves of the species' own types, or of any type if it has
+		// none
+		std::vector<std::pair<double, int>> scored, stab;
+		for (size_t m = 0; m < dex.numMoves(); m++) {
+			const MoveInfo &info = dex.move(m);
+			if (info.pp <= 1 || info.category == STATUS) {
+				continue;
+			}
+
+			scored.push_back({info.base_power * info.accuracy, int(m)});
+			if ((tables.types >> info.type) & 1) {
+				stab.push_back(scored.back());
+			}
+		}
+		if (!stab.empty()) {
+			scored = std::move(stab);
+		}
+
+		size_t pool = std::min(MovePoolSize, scored.size());
+		std::partial_sort(scored.begin(), scored.begin() + pool, scored.end(),
+		                  [](auto &a, auto &b) { return a.first > b.first; });
+
+		std::vector<int> move_values;
+		std::vector<double> move_weights;
+		for (size_t i = 0; i < pool; i++) {
+			move_weights.push_back(scored[i].first);
+			move_values.push_back(scored[i].second);
+		}
+		tables.moves = AliasTable(move_values, move_weights);
+
+		this->species.emplace(key, std::move(tables));
+	}
+}
+
+/*
+ * draw one full set for a revealed Pokemon; revealed fields are kept as is
+ *
+ * hidden moves come from the placeholder pools built by the constructor, so
+ * they are plausible for the species' types rather than legal for it
+ */
+SampledSet
+Determinizer::sample(const Revealed &revealed, std::mt19937 &rng) const
+{
+	const SpeciesTables &tables = this->species.at(revealed.species);
+	SampledSet set;
+
+	if (revealed.ability >= 0 || tables.abilities.values.empty()) {
+		set.ability = revealed.ability;
+	} else {
+		set.ability = tables.abilities.draw(rng);
+	}
+	set.item = revealed.item >= 0 ? revealed.item : this->items.draw(rng);
+
+	size_t num_moves = 0;
+	for (int move: revealed.moves) {
+		if (num_moves < 4) {
+			set.moves[num_moves++] = move;
+		}
+	}
+	std::uniform_real_distribution<double> share(0, 1);
+	for (size_t draws = 0; num_moves < 4 && draws < MAX_MOVE_DRAWS; draws++) {
+		bool status = share(rng) < STATUS_MOVE_SHARE || tables.moves.values.empty();
+		const AliasTable &moves = status ? this->status_moves : tables.moves;
+		if (moves.values.empty()) {
+			continue;
+		}
+
+		int move = moves.draw(rng);
+		if (std::find(set.moves, set.moves + num_moves, move) == set.moves + num_moves) {
+			set.moves[num_moves++] = move;
+		}
+	}
+
+	// stats with max IVs and 84 EVs in every stat, as in random battles
+	double level = revealed.level;
+	for (size_t s = 0; s < 6; s++) {
+		double stat = std::floor((2 * tables.base_stats[s] + 31 + 21) * level / 100);
+		set.stats[s] = s == 0 ? stat + level + 10 : stat + 5;
+	}
+	set.types = tables.types;
+
+	return set;
+}
+
+/*
+ * overwrite the hidden fields of every Pokemon on one side of an MLVec with a
+ * sampled set; observable fields (hp, status, boosts, pp of seen moves) are
+ * left untouched
+ *
+ * party holds the species in each slot in getMLVec's order, as from
+ * BattleParser::getSpecies(). A slot with nothing revealed is sampled from its
+ * species alone, and one of a species without tables loses its ability, item
+ * and unseen moves, so no slot keeps the opponent's real set
+ */
+void
+Determinizer::determinize(MLVec &vec, size_t side, const std::vector<std::string> &party,
+                          const std::vector<Revealed> &revealed, std::mt19937 &rng) const
+{
+	auto state = features(vec);
+
+	for (size_t i = 0; i < party.size() && i < 6; i++) {
+		Revealed seen;
+		seen.species = party[i];
+		for (auto &r: revealed) {
+			if (r.species == party[i]) {
+				seen = r;
+			}
+		}
+
+		auto poke = state.sides()[side].pokemon()[i];
+		SampledSet set;
+		if (this->knows(seen.species)) {
+			set = this->sample(seen, rng);
+
+			for (size_t t = 0; t < NumTypes; t++) {
+				poke.types()[t] = (set.types >> t) & 1 ? 1 : -1;
+			}
+			for (size_t s = 0; s < 6; s++) {
+				poke.stats()[s] = FeatureStat.normalize(set.stats[s]);
+			}
+		} else {
+			set.ability = seen.ability;
+			set.item = seen.item;
+			for (size_t k = 0; k < seen.moves.size() && k < 4; k++) {
+				set.moves[k] = seen.moves[k];
+			}
+		}
+		poke.ability() = set.ability < 0 ? FeatureAbsent : set.ability;
+		poke.item() = set.item < 0 ? FeatureAbsent : set.item;
+
+		// getMLVec orders moves by id; keep what was observed of seen moves
+		// already in the vector
+		struct Observed {
+			double id, pp, disabled;
+		};
+		Observed previous[4];
+		for (size_t m = 0; m < 4; m++) {
+			auto observed = poke.moves()[m];
+			previous[m] = {observed.id(), observed.pp(), observed.disabled()};
+		}
+		std::sort(std::begin(set.moves), std::end(set.moves));
+		size_t k = 0;
+		for (int move: set.moves) {
+			if (move < 0) {
+				continue;
+			}
+
+			Observed value = {double(move), 1, -1};
+			if (std::find(seen.moves.begin(), seen.moves.end(), move) != seen.moves.end()) {
+				for (auto &p: previous) {
+					if (p.id == move) {
+						value = p;
+					}
+				}
+			}
+
+			auto slot = poke.moves()[k++];
+			slot.id() = value.id;
+			slot.pp() = value.pp;
+			slot.disabled() = value.disabled;
+		}
+		for (; k < 4; k++) {
+			auto slot = poke.moves()[k];
+			slot.id() = slot.pp() = slot.disabled() = FeatureAbsent;
+		}
+	}
+}
+
+/*
+ * Vose's alias method
+ */
+Determinizer::AliasTable::AliasTable(const std::vector<int> &values, const std::vector<double> &weights)
+{
+	if (values.empty() || values.size() != weights.size()) {
+		throw std::invalid_argument("AliasTable needs one weight per value");
+	}
+
+	size_t n = values.size();
+	double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+	this->values = values;
+	this->probability.assign(n, 1.0f);
+	this->alias.resize(n);
+	std::iota(this->alias.begin(), this->alias.end(), 0);
+
+	std::vector<double> scaled(n);
+	std::vector<uint32_t> small, large;
+	for (size_t i = 0; i < n; i++) {
+		scaled[i] = weights[i] * double(n) / total;
+		(scaled[i] < 1 ? small : large).push_back(i);
+	}
+
+	while (!small.empty() && !large.empty()) {
+		uint32_t s = small.back(), l = large.back();
+		small.pop_back();
+		large.pop_back();
+
+		this->probability[s] = float(scaled[s]);
+		this->alias[s] = l;
+		scaled[l] = scaled[l] + scaled[s] - 1;
+		(scaled[l] < 1 ? small : large).push_back(l);
+	}
+}
+
+int
+Determinizer::AliasTable::draw(std::mt19937 &rng) const
+{
+	std::uniform_int_distribution<size_t> column(0, this->values.size() - 1);
+	std::uniform_real_distribution<float> coin(0, 1);
+
+	size_t i = column(rng);
+	return this->values[coin(rng) < this->probability[i] ? i : this->alias[i]];
+}
+
+/*
+ * checks that determinize() puts each species' set in its own slot and hides
+ * every real set, then reports determinizations/sec of a full opposing party
+ * with two of its Pokemon partly revealed
+ */
+int
+benchDeterminizer(int argc, char **argv)
+{
+	size_t iterations = argc > 0 ? std::stoul(argv[0]) : 100000;
+	const Determinizer &determinizer = Determinizer::get();
+	int failures = 0;
+
+	MLVec base;
+	base.fill(FeatureAbsent);
+	for (auto poke: features(base).sides()[1].pokemon()) {
+		poke.ability() = BENCH_HIDDEN;
+		poke.item() = BENCH_HIDDEN;
+		poke.moves()[0].id() = BENCH_HIDDEN;
+		poke.moves()[0].pp() = 1;
+		poke.moves()[0].disabled() = -1;
+	}
+
+	std::vector<Revealed> revealed(2);
+	revealed[0].species = "toxapex";
+	revealed[0].ability = 1;
+	revealed[0].moves = {1, 2};
+	revealed[1].species = "dragonite";
+	revealed[1].item = 1;
+
+	std::mt19937 rng(0);
+	MLVec vec = base;
+	determinizer.determinize(vec, 1, bench_party, revealed, rng);
+
+	size_t misplaced = 0, leaked = 0;
+	for (size_t i = 0; i < bench_party.size(); i++) {
+		auto poke = features(vec).sides()[1].pokemon()[i];
+		Revealed species;
+		species.species = bench_party[i];
+		uint32_t types = determinizer.sample(species, rng).types;
+		for (size_t t = 0; t < NumTypes; t++) {
+			misplaced += (poke.types()[t] > 0) != bool((types >> t) & 1);
+		}
+		leaked += poke.ability() == BENCH_HIDDEN || poke.item() == BENCH_HIDDEN;
+		for (auto m: poke.moves()) {
+			leaked += m.id() == BENCH_HIDDEN;
+		}
+	}
+	auto toxapex = features(vec).sides()[1].pokemon()[5];
+	misplaced += toxapex.ability() != 1;
+	for (int move: revealed[0].moves) {
+		misplaced += std::none_of(toxapex.moves().begin(), toxapex.moves().end(),
+		                          [&](auto m) { return m.id() == move; });
+	}
+	misplaced += features(vec).sides()[1].pokemon()[1].item() != 1;
+
+	failures += misplaced > 0;
+	std::cout << (misplaced ? "FAIL " : "ok   ") << "slots by species: " << misplaced << " mismatches\n";
+	failures += leaked > 0;
+	std::cout << (leaked ? "FAIL " : "ok   ") << "hidden sets: " << leaked << " real fields kept\n";
+
+	double sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		vec = base;
+		determinizer.determinize(vec, 1, bench_party, revealed, rng);
+		sink += features(vec).sides()[1].pokemon()[i % 6].ability();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cout << double(iterations) / elapsed.count() << " determinizations/sec, "
+		  << elapsed.count() * 1e9 / double(iterations) << " ns each (checksum " << sink << ")\n";
+
+	return failures ? 1 : 0;
+}
+} // namespace pokezero
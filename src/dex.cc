@@ -0,0 +1,186 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "dex.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+namespace {
+struct Matchup {
+	const char *attack;
+	const char *defend;
+	float multiplier;
+};
+
+// every matchup that is not neutral (gen 6+ chart)
+const Matchup matchups[] = {
+	{"normal", "rock", 0.5},      {"normal", "ghost", 0},        {"normal", "steel", 0.5},
+	{"fire", "fire", 0.5},        {"fire", "water", 0.5},        {"fire", "grass", 2},
+	{"fire", "ice", 2},           {"fire", "bug", 2},            {"fire", "rock", 0.5},
+	{"fire", "dragon", 0.5},      {"fire", "steel", 2},          {"water", "fire", 2},
+	{"water", "water", 0.5},      {"water", "grass", 0.5},       {"water", "ground", 2},
+	{"water", "rock", 2},         {"water", "dragon", 0.5},      {"electric", "water", 2},
+	{"electric", "electric", 0.5}, {"electric", "grass", 0.5},   {"electric", "ground", 0},
+	{"electric", "flying", 2},    {"electric", "dragon", 0.5},   {"grass", "fire", 0.5},
+	{"grass", "water", 2},        {"grass", "grass", 0.5},       {"grass", "poison", 0.5},
+	{"grass", "ground", 2},       {"grass", "flying", 0.5},      {"grass", "bug", 0.5},
+	{"grass", "rock", 2},         {"grass", "dragon", 0.5},      {"grass", "steel", 0.5},
+	{"ice", "fire", 0.5},         {"ice", "water", 0.5},         {"ice", "grass", 2},
+	{"ice", "ice", 0.5},          {"ice", "ground", 2},          {"ice", "flying", 2},
+	{"ice", "dragon", 2},         {"ice", "steel", 0.5},         {"fighting", "normal", 2},
+	{"fighting", "ice", 2},       {"fighting", "poison", 0.5},   {"fighting", "flying", 0.5},
+	{"fighting", "psychic", 0.5}, {"fighting", "bug", 0.5},      {"fighting", "rock", 2},
+	{"fighting", "ghost", 0},     {"fighting", "dark", 2},       {"fighting", "steel", 2},
+	{"fighting", "fairy", 0.5},   {"poison", "grass", 2},        {"poison", "poison", 0.5},
+	{"poison", "ground", 0.5},    {"poison", "rock", 0.5},       {"poison", "ghost", 0.5},
+	{"poison", "steel", 0},       {"poison", "fairy", 2},        {"ground", "fire", 2},
+	{"ground", "electric", 2},    {"ground", "grass", 0.5},      {"ground", "poison", 2},
+	{"ground", "flying", 0},      {"ground", "bug", 0.5},        {"ground", "rock", 2},
+	{"ground", "steel", 2},       {"flying", "electric", 0.5},   {"flying", "grass", 2},
+	{"flying", "fighting", 2},    {"flying", "bug", 2},          {"flying", "rock", 0.5},
+	{"flying", "steel", 0.5},     {"psychic", "fighting", 2},    {"psychic", "poison", 2},
+	{"psychic", "psychic", 0.5},  {"psychic", "dark", 0},        {"psychic", "steel", 0.5},
+	{"bug", "fire", 0.5},         {"bug", "grass", 2},           {"bug", "fighting", 0.5},
+	{"bug", "poison", 0.5},       {"bug", "flying", 0.5},        {"bug", "psychic", 2},
+	{"bug", "ghost", 0.5},        {"bug", "dark", 2},            {"bug", "steel", 0.5},
+	{"bug", "fairy", 0.5},        {"rock", "fire", 2},           {"rock", "ice", 2},
+	{"rock", "fighting", 0.5},    {"rock", "ground", 0.5},       {"rock", "flying", 2},
+	{"rock", "bug", 2},           {"rock", "steel", 0.5},        {"ghost", "normal", 0},
+	{"ghost", "psychic", 2},      {"ghost", "ghost", 2},         {"ghost", "dark", 0.5},
+	{"dragon", "dragon", 2},      {"dragon", "steel", 0.5},      {"dragon", "fairy", 0},
+	{"dark", "fighting", 0.5},    {"dark", "psychic", 2},        {"dark", "ghost", 2},
+	{"dark", "dark", 0.5},        {"dark", "fairy", 0.5},        {"steel", "fire", 0.5},
+	{"steel", "water", 0.5},      {"steel", "electric", 0.5},    {"steel", "ice", 2},
+	{"steel", "rock", 2},         {"steel", "steel", 0.5},       {"steel", "fairy", 2},
+	{"fairy", "fire", 0.5},       {"fairy", "fighting", 2},      {"fairy", "poison", 0.5},
+	{"fairy", "dragon", 2},       {"fairy", "dark", 2},          {"fairy", "steel", 0.5},
+};
+
+std::string
+lower(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+	return s;
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * shared instance, loaded on first use
+ */
+const Dex &
+Dex::get()
+{
+	static const Dex dex;
+	return dex;
+}
+
+/*
+ * constructor
+ */
+Dex::Dex()
+{
+	std::ifstream iftypes("data/type_id.json");
+	std::ifstream ifmove_ids("data/move_id.json");
+	std::ifstream ifmoves("data/moves.json");
+
+	nlohmann::json types, move_ids, moves;
+	iftypes >> types;
+	ifmove_ids >> move_ids;
+	ifmoves >> moves;
+
+	this->type_names.resize(NumTypes);
+	for (auto &[name, id]: types.items()) {
+		this->type_ids[lower(name)] = id;
+		this->type_names.at(id) = lower(name);
+	}
+
+	for (auto &row: this->type_chart) {
+		std::fill(std::begin(row), std::end(row), 1.0f);
+	}
+	for (auto &m: matchups) {
+		this->type_chart[this->typeId(m.attack)][this->typeId(m.defend)] = m.multiplier;
+	}
+
+	this->moves.resize(move_ids.size());
+	this->move_names.resize(move_ids.size());
+	for (auto &[name, id_json]: move_ids.items()) {
+		size_t id = id_json;
+		if (id >= this->moves.size()) {
+			this->moves.resize(id + 1);
+			this->move_names.resize(id + 1);
+		}
+		this->move_names[id] = name;
+
+		if (!moves.contains(name)) {
+			continue;
+		}
+
+		auto &move = moves[name];
+		MoveInfo &info = this->moves[id];
+		info.base_power = move.value("basePower", 0);
+		info.accuracy = move["accuracy"].is_number() ? float(move["accuracy"]) / 100 : 1;
+		info.priority = move.value("priority", 0);
+		info.pp = move.value("pp", 0);
+		info.type = std::max(0, this->typeId(move.value("type", "normal")));
+
+		std::string category = move.value("category", "status");
+		if (category == "physical") {
+			info.category = PHYSICAL;
+		} else if (category == "special") {
+			info.category = SPECIAL;
+		} else {
+			info.category = STATUS;
+		}
+	}
+}
+
+/*
+ * damage multiplier of an attack type against a defender with a bit set of
+ * type ids
+ */
+float
+Dex::matchup(size_t attack, uint32_t types) const
+{
+	float multiplier = 1;
+	for (size_t t = 0; t < NumTypes; t++) {
+		if ((types >> t) & 1) {
+			multiplier *= this->type_chart[attack][t];
+		}
+	}
+
+	return multiplier;
+}
+
+/*
+ * type id for a type name in any case, or -1 if it is unknown
+ */
+int
+Dex::typeId(const std::string &name) const
+{
+	auto it = this->type_ids.find(lower(name));
+	if (it == this->type_ids.end()) {
+		return -1;
+	}
+
+	return it->second;
+}
+} // namespace pokezero
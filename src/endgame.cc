@@ -0,0 +1,588 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "endgame.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "dex.hh"
+
+namespace {
+// damage rolls standing in for all 16: lowest, median and highest
+constexpr size_t rolls[] = {0, pokezero::NumRolls / 2 - 1, pokezero::NumRolls - 1};
+
+// decision nodes between deadline checks
+constexpr uint64_t CHECK_INTERVAL = 1024;
+
+// pivots and reduced costs within this of zero count as zero
+constexpr double SIMPLEX_EPSILON = 1e-12;
+
+/*
+ * value of a zero-sum matrix game to the row player, who maximizes, and the
+ * row player's equilibrium mix
+ *
+ * the payoffs are shifted to be at least 1 and the column player's linear
+ * program, max sum(y) subject to payoff y <= 1 and y >= 0, is solved by
+ * simplex with Bland's rule; the game's value is 1 / sum(y) less the shift
+ * and the row mix is the program's duals scaled by that value
+ */
+double
+matrixGame(const std::vector<double> &payoff, size_t rows, size_t cols, std::vector<double> &strategy)
+{
+	double shift = 1 - *std::min_element(payoff.begin(), payoff.end());
+
+	// constraint rows then the objective row; columns y, slacks, right hand side
+	size_t width = cols + rows + 1;
+	std::vector<double> tableau((rows + 1) * width, 0);
+	auto at = [&](size_t r, size_t c) -> double & { return tableau[r * width + c]; };
+
+	std::vector<size_t> basis(rows);
+	for (size_t i = 0; i < rows; i++) {
+		for (size_t j = 0; j < cols; j++) {
+			at(i, j) = payoff[i * cols + j] + shift;
+		}
+		at(i, cols + i) = 1;
+		at(i, width - 1) = 1;
+		basis[i] = cols + i;
+	}
+	for (size_t j = 0; j < cols; j++) {
+		at(rows, j) = -1;
+	}
+
+	while (true) {
+		size_t enter = width - 1;
+		for (size_t c = 0; c + 1 < width; c++) {
+			if (at(rows, c) < -SIMPLEX_EPSILON) {
+				enter = c;
+				break;
+			}
+		}
+		if (enter == width - 1) {
+			break;
+		}
+
+		// every payoff is positive, so some row bounds the entering column
+		size_t leave = rows;
+		double ratio = std::numeric_limits<double>::infinity();
+		for (size_t i = 0; i < rows; i++) {
+			if (at(i, enter) <= SIMPLEX_EPSILON) {
+				continue;
+			}
+			double r = at(i, width - 1) / at(i, enter);
+			if (r < ratio || (r == ratio && basis[i] < basis[leave])) {
+				ratio = r;
+				leave = i;
+			}
+		}
+
+		double pivot = at(leave, enter);
+		for (size_t c = 0; c < width; c++) {
+			at(leave, c) /= pivot;
+		}
+		for (size_t r = 0; r <= rows; r++) {
+			double factor = at(r, enter);
+			if (r == leave || factor == 0) {
+				continue;
+			}
+			for (size_t c = 0; c < width; c++) {
+				at(r, c) -= factor * at(leave, c);
+			}
+		}
+		basis[leave] = enter;
+	}
+
+	double value = 1 / at(rows, width - 1);
+
+	strategy.assign(rows, 0);
+	double total = 0;
+	for (size_t i = 0; i < rows; i++) {
+		strategy[i] = std::max(0.0, at(rows, cols + i));
+		total += strategy[i];
+	}
+	for (double &p: strategy) {
+		p /= total;
+	}
+
+	return value - shift;
+}
+
+float
+denormStat(double stat)
+{
+	return std::round(float(pokezero::FeatureStat.denormalize(stat)));
+}
+
+float
+boostMultiplier(double boost)
+{
+	double stage = std::round(pokezero::FeatureBoost.denormalize(boost));
+	return float(stage >= 0 ? (2 + stage) / 2 : 2 / (2 - stage));
+}
+
+size_t
+alive(const auto &side)
+{
+	size_t count = 0;
+	for (auto &mon: side.mons) {
+		count += mon.hp > 0;
+	}
+
+	return count;
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * true if both sides are down to between one and threshold Pokemon
+ */
+bool
+EndgameSolver::applies(const MLVec &vec) const
+{
+	if (this->config.threshold == 0) {
+		return false;
+	}
+
+	auto state = features(vec);
+	for (auto side: state.sides()) {
+		size_t count = 0;
+		for (auto poke: side.pokemon()) {
+			count += poke.hp() > -1;
+		}
+
+		if (count == 0 || count > this->config.threshold) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * equilibrium strategy for the given side, found by iterative deepening until
+ * the position is solved exactly, the horizon reaches max_depth or the budget
+ * runs out, and an action drawn from it; the result of the deepest completed
+ * iteration is returned
+ */
+EndgameResult
+EndgameSolver::solve(const MLVec &vec, size_t side)
+{
+	State state = this->compact(vec, side);
+	Deadline deadline(this->config.budget);
+
+	this->deadline = &deadline;
+	this->cache.clear();
+	this->nodes = 0;
+	this->cache_hits = 0;
+
+	std::vector<Action> mine = this->actions(state, 0);
+	EndgameResult result;
+	result.action = mine.front();
+
+	for (size_t depth = 1; depth <= this->config.max_depth; depth++) {
+		try {
+			std::vector<double> mix;
+			this->hit_horizon = false;
+			double value = this->search(state, depth, &mix);
+
+			result.strategy.clear();
+			for (size_t a = 0; a < mine.size(); a++) {
+				result.strategy.emplace_back(mine[a], mix[a]);
+			}
+			result.value = value;
+			result.depth = depth;
+			result.exact = !this->hit_horizon;
+		} catch (Aborted &) {
+			break;
+		}
+
+		if (result.exact) {
+			break;
+		}
+	}
+
+	if (!result.strategy.empty()) {
+		std::vector<double> weights;
+		for (auto &[action, p]: result.strategy) {
+			weights.push_back(p);
+		}
+		std::discrete_distribution<size_t> draw(weights.begin(), weights.end());
+		result.action = result.strategy[draw(this->rng)].first;
+	}
+
+	result.nodes = this->nodes;
+	result.cache_hits = this->cache_hits;
+	this->deadline = nullptr;
+
+	return result;
+}
+
+/*
+ * pull the fields the solver models out of the MLVec, with the solved side
+ * first
+ */
+EndgameSolver::State
+EndgameSolver::compact(const MLVec &vec, size_t side) const
+{
+	auto battle_state = features(vec);
+	State state;
+
+	for (size_t s = 0; s < 2; s++) {
+		SideView<const double> src = battle_state.sides()[s == 0 ? side : 1 - side];
+		SideState &dst = state.sides[s];
+		dst.active = 0;
+
+		for (size_t i = 0; i < 6; i++) {
+			PokemonView<const double> poke = src.pokemon()[i];
+			Mon &mon = dst.mons[i];
+
+			mon.maxhp = denormStat(poke.stats()[0]);
+			mon.hp = std::round(float(FeatureRatio.denormalize(poke.hp())) * mon.maxhp);
+			for (size_t k = 0; k < 5; k++) {
+				mon.stats[k] = std::floor(denormStat(poke.stats()[k + 1]) * boostMultiplier(poke.boosts()[k]));
+			}
+
+			mon.types = 0;
+			for (size_t t = 0; t < NumTypes; t++) {
+				if (poke.types()[t] > 0) {
+					mon.types |= 1u << t;
+				}
+			}
+
+			// missing moves have id -1, and moves out of pp or disabled
+			// cannot be chosen
+			for (size_t k = 0; k < 4; k++) {
+				MoveView<const double> move = poke.moves()[k];
+				bool usable = move.id() >= 0 && move.pp() > -1 && move.disabled() < 0;
+				mon.moves[k] = usable ? int16_t(move.id()) : -1;
+			}
+
+			if (poke.active() > 0) {
+				dst.active = i;
+			}
+		}
+	}
+
+	return state;
+}
+
+/*
+ * choices available to a side
+ *
+ * a side whose active Pokemon fainted may only switch, and its opponent waits
+ * for the switch; status moves do nothing in this model so they are left out
+ */
+std::vector<Action>
+EndgameSolver::actions(const State &state, size_t s) const
+{
+	std::vector<Action> result;
+	const SideState &self = state.sides[s];
+	const SideState &other = state.sides[1 - s];
+	bool self_fainted = self.mons[self.active].hp <= 0;
+	bool other_fainted = other.mons[other.active].hp <= 0;
+
+	if (!self_fainted && !other_fainted) {
+		const Mon &active = self.mons[self.active];
+		for (size_t k = 0; k < 4; k++) {
+			if (active.moves[k] >= 0 && Dex::get().move(active.moves[k]).category != STATUS) {
+				result.push_back({Action::MOVE, uint8_t(k)});
+			}
+		}
+	}
+
+	if (self_fainted || !other_fainted) {
+		for (size_t i = 0; i < 6; i++) {
+			if (i != self.active && self.mons[i].hp > 0) {
+				result.push_back({Action::SWITCH, uint8_t(i)});
+			}
+		}
+	}
+
+	if (result.empty()) {
+		result.push_back({Action::PASS, 0});
+	}
+
+	return result;
+}
+
+/*
+ * expand one turn into its chance outcomes: switches happen first, then moves
+ * in priority and speed order, with a coin flip on speed ties
+ */
+void
+EndgameSolver::resolve(const State &state, const Action (&choices)[2], std::vector<Outcome> &outcomes) const
+{
+	Outcome start{1.0, state};
+	for (size_t s = 0; s < 2; s++) {
+		if (choices[s].kind == Action::SWITCH) {
+			start.state.sides[s].active = choices[s].index;
+		}
+	}
+
+	std::vector<std::pair<double, std::vector<size_t>>> orders;
+	bool move0 = choices[0].kind == Action::MOVE;
+	bool move1 = choices[1].kind == Action::MOVE;
+
+	if (move0 && move1) {
+		const Mon &mon0 = start.state.sides[0].mons[start.state.sides[0].active];
+		const Mon &mon1 = start.state.sides[1].mons[start.state.sides[1].active];
+		int priority0 = Dex::get().move(mon0.moves[choices[0].index]).priority;
+		int priority1 = Dex::get().move(mon1.moves[choices[1].index]).priority;
+
+		if (priority0 != priority1) {
+			orders.push_back({1.0, priority0 > priority1 ? std::vector<size_t>{0, 1} : std::vector<size_t>{1, 0}});
+		} else if (mon0.stats[4] != mon1.stats[4]) {
+			orders.push_back({1.0, mon0.stats[4] > mon1.stats[4] ? std::vector<size_t>{0, 1}
+			                                                     : std::vector<size_t>{1, 0}});
+		} else {
+			orders.push_back({0.5, {0, 1}});
+			orders.push_back({0.5, {1, 0}});
+		}
+	} else if (move0) {
+		orders.push_back({1.0, {0}});
+	} else if (move1) {
+		orders.push_back({1.0, {1}});
+	} else {
+		orders.push_back({1.0, {}});
+	}
+
+	std::vector<Outcome> partial, next;
+	for (auto &[probability, order]: orders) {
+		partial.assign(1, start);
+		partial[0].probability = probability;
+
+		for (size_t s: order) {
+			next.clear();
+			for (auto &o: partial) {
+				this->attack(o, s, choices[s], next);
+			}
+			std::swap(partial, next);
+		}
+
+		outcomes.insert(outcomes.end(), partial.begin(), partial.end());
+	}
+}
+
+/*
+ * side s uses its chosen move; expands into a miss (if the move can miss) and
+ * one outcome per distinct damage roll
+ */
+void
+EndgameSolver::attack(const Outcome &outcome, size_t s, const Action &action, std::vector<Outcome> &out) const
+{
+	const SideState &self = outcome.state.sides[s];
+	const SideState &other = outcome.state.sides[1 - s];
+	const Mon &attacker = self.mons[self.active];
+	const Mon &defender = other.mons[other.active];
+
+	// the attacker fainted before it could move
+	if (attacker.hp <= 0 || defender.hp <= 0) {
+		out.push_back(outcome);
+		return;
+	}
+
+	uint16_t move = attacker.moves[action.index];
+	DamageRolls damage = this->damage(attacker, defender, move);
+	float accuracy = Dex::get().move(move).accuracy;
+
+	if (damage.back() <= 0) {
+		out.push_back(outcome);
+		return;
+	}
+
+	if (accuracy < 1) {
+		out.push_back({outcome.probability * (1 - accuracy), outcome.state});
+	}
+
+	// every roll knocks out the defender, so they are one outcome
+	if (damage.front() >= defender.hp) {
+		Outcome ko{outcome.probability * accuracy, outcome.state};
+		ko.state.sides[1 - s].mons[other.active].hp = 0;
+		out.push_back(ko);
+		return;
+	}
+
+	for (size_t roll: rolls) {
+		Outcome hit{outcome.probability * accuracy / std::size(rolls), outcome.state};
+		float &hp = hit.state.sides[1 - s].mons[other.active].hp;
+		hp = std::max(0.0f, hp - damage[roll]);
+		out.push_back(hit);
+	}
+}
+
+/*
+ * damage rolls of a move between two Pokemon; all 0 for status moves
+ */
+DamageRolls
+EndgameSolver::damage(const Mon &attacker, const Mon &defender, uint16_t move) const
+{
+	const Dex &dex = Dex::get();
+	const MoveInfo &info = dex.move(move);
+
+	if (info.category == STATUS || info.base_power <= 0) {
+		return DamageRolls{};
+	}
+
+	bool physical = info.category == PHYSICAL;
+	return DamageCalc::rolls(this->config.level, physical ? attacker.stats[0] : attacker.stats[2],
+	                         physical ? defender.stats[1] : defender.stats[3], info.base_power,
+	                         (attacker.types >> info.type) & 1, dex.matchup(info.type, defender.types));
+}
+
+/*
+ * value of a position for side 0 searched depth turns ahead
+ *
+ * the turn's joint choices form a matrix game, side 0 choosing the row and
+ * side 1 the column, whose equilibrium value is the position's; a row that
+ * wins whatever side 1 does settles it without the rest. If strategy is
+ * given (at the root) side 0's mix over its actions is written to it.
+ */
+double
+EndgameSolver::search(const State &state, size_t depth, std::vector<double> *strategy)
+{
+	if (++this->nodes % CHECK_INTERVAL == 0 && this->deadline->expired()) {
+		throw Aborted();
+	}
+
+	size_t alive0 = alive(state.sides[0]);
+	size_t alive1 = alive(state.sides[1]);
+	if (alive0 == 0 || alive1 == 0) {
+		return alive0 > 0 ? 1 : (alive1 > 0 ? -1 : 0);
+	}
+
+	if (depth == 0) {
+		this->hit_horizon = true;
+		return this->heuristic(state);
+	}
+
+	uint64_t key = this->hash(state, depth);
+	if (strategy == nullptr) {
+		auto it = this->cache.find(key);
+		if (it != this->cache.end()) {
+			this->cache_hits++;
+			this->hit_horizon |= !it->second.exact;
+			return it->second.value;
+		}
+	}
+
+	bool outer_hit_horizon = this->hit_horizon;
+	this->hit_horizon = false;
+
+	std::vector<Action> mine = this->actions(state, 0);
+	std::vector<Action> theirs = this->actions(state, 1);
+
+	std::vector<double> payoff(mine.size() * theirs.size());
+	std::vector<double> mix;
+	double value = 0;
+	size_t forced = mine.size();
+	for (size_t a = 0; a < mine.size() && forced == mine.size(); a++) {
+		double worst = std::numeric_limits<double>::infinity();
+		for (size_t b = 0; b < theirs.size(); b++) {
+			payoff[a * theirs.size() + b] = this->turnValue(state, mine[a], theirs[b], depth);
+			worst = std::min(worst, payoff[a * theirs.size() + b]);
+		}
+
+		// a forced win cannot be improved on
+		if (worst >= 1) {
+			forced = a;
+		}
+	}
+
+	if (forced < mine.size()) {
+		value = 1;
+		mix.assign(mine.size(), 0);
+		mix[forced] = 1;
+	} else {
+		value = matrixGame(payoff, mine.size(), theirs.size(), mix);
+	}
+	if (strategy != nullptr) {
+		*strategy = std::move(mix);
+	}
+
+	this->cache[key] = {value, !this->hit_horizon};
+	this->hit_horizon |= outer_hit_horizon;
+
+	return value;
+}
+
+/*
+ * expected value over the chance outcomes of one joint choice
+ */
+double
+EndgameSolver::turnValue(const State &state, const Action &mine, const Action &theirs, size_t depth)
+{
+	std::vector<Outcome> outcomes;
+	const Action choices[2] = {mine, theirs};
+	this->resolve(state, choices, outcomes);
+
+	double value = 0;
+	for (auto &o: outcomes) {
+		value += o.probability * this->search(o.state, depth - 1);
+	}
+
+	return value;
+}
+
+/*
+ * estimate at the horizon: share of the remaining hp fraction held by side 0,
+ * scaled so it never looks like a forced result
+ */
+double
+EndgameSolver::heuristic(const State &state) const
+{
+	double fraction[2] = {0, 0};
+	for (size_t s = 0; s < 2; s++) {
+		for (auto &mon: state.sides[s].mons) {
+			if (mon.maxhp > 0) {
+				fraction[s] += mon.hp / mon.maxhp;
+			}
+		}
+	}
+
+	double total = fraction[0] + fraction[1];
+	if (total <= 0) {
+		return 0;
+	}
+
+	return 0.9 * (fraction[0] - fraction[1]) / total;
+}
+
+/*
+ * FNV-1a over the parts of the state that change during the search
+ */
+uint64_t
+EndgameSolver::hash(const State &state, size_t depth) const
+{
+	uint64_t h = 0xcbf29ce484222325;
+	auto mix = [&h](uint64_t v) {
+		h ^= v;
+		h *= 0x100000001b3;
+	};
+
+	mix(depth);
+	for (auto &side: state.sides) {
+		mix(side.active);
+		for (auto &mon: side.mons) {
+			mix(uint64_t(mon.hp));
+		}
+	}
+
+	return h;
+}
+} // namespace pokezero
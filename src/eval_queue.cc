@@ -0,0 +1,193 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "eval_queue.hh"
+
+#include <stdexcept>
+
+namespace pokezero {
+/*
+ * constructor
+ *
+ * a single batching thread gathers submitted states until either max_batch
+ * states are waiting or the oldest one has waited max_delay, then runs the
+ * evaluator once on the whole batch
+ */
+EvalQueue::EvalQueue(BatchEvaluator evaluator, size_t max_batch, std::chrono::microseconds max_delay)
+{
+	if (max_batch == 0) {
+		throw std::invalid_argument("EvalQueue max_batch must be positive");
+	}
+
+	this->evaluator = evaluator;
+	this->max_batch = max_batch;
+	this->max_delay = max_delay;
+
+	this->threads.push_back(std::thread([this]() { this->loop(); }));
+}
+
+/*
+ * destructor
+ *
+ * states that are still queued are evaluated before the thread exits so no
+ * caller is left waiting on a broken promise
+ */
+EvalQueue::~EvalQueue()
+{
+	std::unique_lock<std::mutex> lk(this->queue_lock);
+	this->stopping = true;
+	lk.unlock();
+	this->queue_cv.notify_all();
+
+	for (auto &t: this->threads) {
+		t.join();
+	}
+
+	this->threads.clear();
+}
+
+/*
+ * queue a leaf state for evaluation; the future is fulfilled once the batch
+ * containing it has been evaluated
+ */
+std::future<Evaluation>
+EvalQueue::submit(const MLVec &state)
+{
+	Pending p;
+	p.state = state;
+	p.enqueued = clock::now();
+	std::future<Evaluation> result = p.result.get_future();
+
+	std::unique_lock<std::mutex> lk(this->queue_lock);
+	if (this->stopping) {
+		throw std::runtime_error("EvalQueue is shutting down");
+	}
+	this->pending.push_back(std::move(p));
+	bool wake = this->pending.size() == 1 || this->pending.size() >= this->max_batch;
+	lk.unlock();
+
+	// only wake the batching thread for the first state or a full batch,
+	// otherwise it is already sleeping until the oldest state's deadline
+	if (wake) {
+		this->queue_cv.notify_one();
+	}
+
+	return result;
+}
+
+/*
+ * snapshot of batch fill and queue latency since construction
+ */
+EvalQueueStats
+EvalQueue::stats()
+{
+	EvalQueueStats s;
+	s.batches = this->batches;
+	s.evaluations = this->evaluations;
+
+	if (s.batches > 0) {
+		s.mean_fill = double(s.evaluations) / double(s.batches * this->max_batch);
+	}
+	if (s.evaluations > 0) {
+		s.mean_latency_us = double(this->latency_ns_sum) / double(s.evaluations) / 1e3;
+	}
+	s.max_latency_us = double(this->latency_ns_max) / 1e3;
+
+	return s;
+}
+
+void
+EvalQueue::loop()
+{
+	std::vector<Pending> batch;
+	std::vector<MLVec> states;
+	std::vector<Evaluation> results;
+	batch.reserve(this->max_batch);
+	states.reserve(this->max_batch);
+	results.reserve(this->max_batch);
+
+	std::unique_lock<std::mutex> lk(this->queue_lock);
+	while (true) {
+		while (this->pending.empty() && !this->stopping) {
+			this->queue_cv.wait(lk);
+		}
+
+		if (this->pending.empty()) {
+			return;
+		}
+
+		// wait for the batch to fill, but never past the oldest state's deadline
+		auto deadline = this->pending.front().enqueued + this->max_delay;
+		while (this->pending.size() < this->max_batch && !this->stopping) {
+			if (this->queue_cv.wait_until(lk, deadline) == std::cv_status::timeout) {
+				break;
+			}
+		}
+
+		size_t n = std::min(this->pending.size(), this->max_batch);
+		for (size_t i = 0; i < n; i++) {
+			batch.push_back(std::move(this->pending.front()));
+			this->pending.pop_front();
+		}
+
+		lk.unlock();
+		this->runBatch(batch, states, results);
+		lk.lock();
+	}
+}
+
+/*
+ * evaluate one gathered batch and route the results back to the submitters
+ */
+void
+EvalQueue::runBatch(std::vector<Pending> &batch, std::vector<MLVec> &states, std::vector<Evaluation> &results)
+{
+	states.clear();
+	for (auto &p: batch) {
+		states.push_back(p.state);
+	}
+	results.resize(batch.size());
+
+	try {
+		this->evaluator(states.data(), states.size(), results.data());
+	} catch (...) {
+		for (auto &p: batch) {
+			p.result.set_exception(std::current_exception());
+		}
+		batch.clear();
+		return;
+	}
+
+	auto now = clock::now();
+	uint64_t latency_sum = 0;
+	uint64_t latency_max = this->latency_ns_max;
+	for (size_t i = 0; i < batch.size(); i++) {
+		uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - batch[i].enqueued).count();
+		latency_sum += latency;
+		latency_max = std::max(latency_max, latency);
+		batch[i].result.set_value(results[i]);
+	}
+
+	this->batches++;
+	this->evaluations += batch.size();
+	this->latency_ns_sum += latency_sum;
+	this->latency_ns_max = latency_max;
+
+	batch.clear();
+}
+} // namespace pokezero
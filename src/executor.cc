@@ -0,0 +1,235 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "executor.hh"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include "log.hh"
+#include "placement.hh"
+
+namespace {
+// events taken from epoll per wakeup
+constexpr int MAX_EVENTS = 64;
+} // namespace
+
+namespace showdown {
+/*
+ * constructor
+ *
+ * threads is the number of workers; 0 uses one per cpu the threads are pinned
+ * to, or one per hardware thread when they are not pinned
+ */
+Executor::Executor(size_t threads, std::vector<int> cpus) : cpus(std::move(cpus))
+{
+	if (threads == 0 && !this->cpus.empty()) {
+		threads = this->cpus.size();
+	} else if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	this->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (this->epoll_fd < 0 || this->wake_fd < 0) {
+		throw std::system_error(errno, std::generic_category(), "executor epoll setup");
+	}
+
+	// the wake descriptor is the only one registered with a null pointer
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.ptr = nullptr;
+	epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->wake_fd, &event);
+
+	for (size_t i = 0; i < threads; i++) {
+		this->threads.push_back(std::thread([this]() { this->work(); }));
+	}
+	this->threads.push_back(std::thread([this]() { this->react(); }));
+}
+
+/*
+ * destructor
+ *
+ * coroutines still suspended at this point are never resumed
+ */
+Executor::~Executor()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	this->stopping = true;
+	lk.unlock();
+	this->ready_cv.notify_all();
+
+	uint64_t one = 1;
+	if (write(this->wake_fd, &one, sizeof(one)) < 0) {
+		LOG_ERROR("executor", "wake failed", "error", std::strerror(errno));
+	}
+
+	for (auto &t: this->threads) {
+		t.join();
+	}
+	this->threads.clear();
+
+	close(this->wake_fd);
+	close(this->epoll_fd);
+}
+
+/*
+ * process wide executor, started on first use
+ */
+Executor &
+Executor::shared()
+{
+	static Executor executor;
+	return executor;
+}
+
+/*
+ * queue a coroutine to be resumed on a worker thread
+ */
+void
+Executor::post(std::coroutine_handle<> handle)
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	this->ready.push_back(handle);
+	lk.unlock();
+
+	this->ready_cv.notify_one();
+}
+
+/*
+ * have the reactor post the coroutine once the descriptor is readable
+ *
+ * the registration is one shot, so a descriptor can be watched again by the
+ * next read without removing it first
+ */
+void
+Executor::watch(int fd, std::coroutine_handle<> handle)
+{
+	struct epoll_event event = {};
+	event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+	event.data.ptr = handle.address();
+
+	if (epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+		if (errno != ENOENT || epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			throw std::system_error(errno, std::generic_category(), "executor watch");
+		}
+	}
+}
+
+void
+Executor::work()
+{
+	pinThread(this->cpus);
+
+	while (true) {
+		std::unique_lock<std::mutex> lk(this->lock);
+		while (this->ready.empty() && !this->stopping) {
+			this->ready_cv.wait(lk);
+		}
+
+		if (this->ready.empty()) {
+			return;
+		}
+
+		std::coroutine_handle<> handle = this->ready.front();
+		this->ready.pop_front();
+		lk.unlock();
+
+		handle.resume();
+	}
+}
+
+void
+Executor::react()
+{
+	struct epoll_event events[MAX_EVENTS];
+	pinThread(this->cpus);
+
+	while (true) {
+		int count = epoll_wait(this->epoll_fd, events, MAX_EVENTS, -1);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			LOG_ERROR("executor", "epoll_wait failed", "error", std::strerror(errno));
+			return;
+		}
+
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.ptr == nullptr) {
+				return;
+			}
+
+			this->post(std::coroutine_handle<>::from_address(events[i].data.ptr));
+		}
+	}
+}
+
+/*
+ * start a task on the executor; wait() returns once it and every other
+ * spawned task have finished
+ */
+void
+TaskGroup::spawn(Task<void> task)
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	this->running++;
+	lk.unlock();
+
+	run(this, std::move(task));
+}
+
+void
+TaskGroup::wait()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	while (this->running > 0) {
+		this->done.wait(lk);
+	}
+}
+
+/*
+ * exceptions ending a task are reported rather than lost, since nothing
+ * awaits it
+ */
+TaskGroup::Detached
+TaskGroup::run(TaskGroup *group, Task<void> task)
+{
+	co_await group->executor.schedule();
+
+	{
+		Task<void> owned = std::move(task);
+		try {
+			co_await owned;
+		} catch (std::exception &e) {
+			LOG_ERROR("executor", "task failed", "error", e.what());
+		}
+	}
+
+	std::lock_guard<std::mutex> lk(group->lock);
+	if (--group->running == 0) {
+		group->done.notify_all();
+	}
+}
+} // namespace showdown
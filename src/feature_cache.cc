@@ -0,0 +1,113 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "feature_cache.hh"
+
+namespace pokezero {
+/*
+ * constructor
+ *
+ * capacity is the number of entries held over all shards; 0 disables the
+ * cache
+ */
+FeatureCache::FeatureCache(size_t capacity)
+{
+	this->shard_capacity = (capacity + Shards - 1) / Shards;
+}
+
+/*
+ * process wide cache shared by every battle
+ */
+FeatureCache &
+FeatureCache::shared()
+{
+	static FeatureCache cache;
+	return cache;
+}
+
+/*
+ * copy out the Features cached under a hash, marking them recently used
+ */
+bool
+FeatureCache::lookup(uint64_t hash, Features &features)
+{
+	Shard &shard = this->shard(hash);
+
+	std::unique_lock<std::mutex> lk(shard.lock);
+	auto it = shard.index.find(hash);
+	if (it == shard.index.end()) {
+		lk.unlock();
+		this->misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+	features = it->second->second;
+	lk.unlock();
+
+	this->hits.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+/*
+ * cache Features under a hash, evicting the shard's least recently used
+ * entry when it is full
+ */
+void
+FeatureCache::insert(uint64_t hash, const Features &features)
+{
+	if (this->shard_capacity == 0) {
+		return;
+	}
+
+	Shard &shard = this->shard(hash);
+
+	std::lock_guard<std::mutex> lk(shard.lock);
+	auto it = shard.index.find(hash);
+	if (it != shard.index.end()) {
+		shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+		return;
+	}
+
+	if (shard.index.size() >= this->shard_capacity) {
+		shard.index.erase(shard.entries.back().first);
+		shard.entries.pop_back();
+	}
+
+	shard.entries.emplace_front(hash, features);
+	shard.index.emplace(hash, shard.entries.begin());
+}
+
+FeatureCacheStats
+FeatureCache::stats()
+{
+	FeatureCacheStats stats;
+	stats.hits = this->hits.load(std::memory_order_relaxed);
+	stats.misses = this->misses.load(std::memory_order_relaxed);
+
+	for (Shard &shard: this->shards) {
+		std::lock_guard<std::mutex> lk(shard.lock);
+		stats.entries += shard.index.size();
+	}
+
+	uint64_t lookups = stats.hits + stats.misses;
+	stats.hit_rate = lookups > 0 ? double(stats.hits) / lookups : 0;
+
+	return stats;
+}
+} // namespace pokezero
@@ -0,0 +1,121 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "feature_schema.hh"
+
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+static_assert(pokezero::featureIndex("sides[1].pokemon[2].stats[3]") ==
+                      pokezero::featureOffset<BattleState>("sides") + pokezero::FeatureRecord<Side>::width +
+                              pokezero::featureOffset<Side>("pokemon") + 2 * pokezero::FeatureRecord<Pokemon>::width +
+                              pokezero::featureOffset<Pokemon>("stats") + 3,
+              "featureIndex must agree with the views' offsets");
+static_assert(pokezero::featureIndex("tr_ctr") == BattleStateSize - 1, "tr_ctr is the last feature");
+
+/*
+ * the value field holding a vector index, with the index moved to within the
+ * field's element; appends the field's path to name when given one
+ */
+const pokezero::FeatureField *
+findFeature(size_t &index, std::string *name)
+{
+	const pokezero::FeatureField *fields = pokezero::FeatureRecord<BattleState>::fields.data();
+	size_t count = pokezero::FeatureRecord<BattleState>::fields.size();
+
+	if (index >= BattleStateSize) {
+		throw std::out_of_range("No feature at index " + std::to_string(index));
+	}
+
+	while (true) {
+		const pokezero::FeatureField *field = fields;
+		while (field + 1 < fields + count && field[1].offset <= index) {
+			field++;
+		}
+
+		index -= field->offset;
+		size_t element = index / field->stride;
+		index %= field->stride;
+
+		if (name) {
+			*name += field->name;
+			if (field->count > 0) {
+				*name += '[' + std::to_string(element) + ']';
+			}
+		}
+
+		if (field->nested == nullptr) {
+			return field;
+		}
+		if (name) {
+			*name += '.';
+		}
+		fields = field->nested;
+		count = field->nested_count;
+	}
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * name of the feature at a vector index, such as
+ * "sides[1].pokemon[0].stats[3]"; throws std::out_of_range past the end
+ */
+std::string
+featureName(size_t index)
+{
+	std::string name;
+	findFeature(index, &name);
+	return name;
+}
+
+/*
+ * range of the feature at a vector index
+ */
+FeatureRange
+featureRange(size_t index)
+{
+	return findFeature(index, nullptr)->range;
+}
+
+/*
+ * the schema hash, then the index, name and raw range of every feature, for
+ * tools reading vectors outside this program; identity ranges print as "id"
+ */
+int
+featureSchema(int, char **)
+{
+	std::cout << "schema " << std::hex << std::setw(16) << std::setfill('0') << FeatureSchemaHash << std::dec
+		  << std::setfill(' ') << "\n";
+
+	for (size_t i = 0; i < BattleStateSize; i++) {
+		FeatureRange range = featureRange(i);
+		std::cout << i << ' ' << featureName(i);
+		if (range.identity()) {
+			std::cout << " id\n";
+		} else {
+			std::cout << ' ' << range.lo << ' ' << range.hi << '\n';
+		}
+	}
+
+	return 0;
+}
+} // namespace pokezero
@@ -0,0 +1,265 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "featurize.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <thread>
+
+#include "alloc_stats.hh"
+#include "battle_parser.hh"
+#include "bounded_queue.hh"
+#include "log.hh"
+#include "metrics.hh"
+#include "trajectory.hh"
+
+namespace {
+typedef std::vector<pokezero::TrajectoryRecord> Records;
+
+/*
+ * start `workers` threads running the stage; the last one to finish closes
+ * the stage's output so the next stage can drain it and stop
+ */
+template <class Out>
+void
+startStage(std::vector<std::thread> &threads, size_t workers, std::function<void()> stage,
+           pokezero::BoundedQueue<Out> &out)
+{
+	auto remaining = std::make_shared<std::atomic<size_t>>(workers);
+	for (size_t i = 0; i < workers; i++) {
+		threads.push_back(std::thread([stage, remaining, &out]() {
+			stage();
+			if (remaining->fetch_sub(1) == 1) {
+				out.close();
+			}
+		}));
+	}
+}
+
+bool
+endsWith(const std::string &s, const char *suffix)
+{
+	size_t n = std::strlen(suffix);
+	return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+/*
+ * read stage: a file ending in .json holds a single battle, any other input
+ * holds one battle per line
+ */
+void
+readBattles(const std::vector<std::string> &inputs, pokezero::BoundedQueue<std::string> &out,
+            std::atomic<uint64_t> &errors)
+{
+	for (const std::string &path: inputs) {
+		std::ifstream file;
+		if (path != "-") {
+			file.open(path);
+			if (!file) {
+				LOG_ERROR("featurize", "cannot open replay file", "path", path);
+				errors++;
+				continue;
+			}
+		}
+		std::istream &in = path == "-" ? std::cin : file;
+
+		if (endsWith(path, ".json")) {
+			std::string battle((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			out.push(std::move(battle));
+			continue;
+		}
+
+		std::string line;
+		while (std::getline(in, line)) {
+			if (line.find_first_not_of(" \t\r") != std::string::npos) {
+				out.push(std::move(line));
+			}
+		}
+	}
+}
+
+/*
+ * parse stage: each battle is a json array of the node process's responses,
+ * in the order the Manager would have received them
+ */
+void
+parseBattles(pokezero::BoundedQueue<std::string> &in, pokezero::BoundedQueue<nlohmann::json> &out,
+             std::atomic<uint64_t> &errors)
+{
+	pokezero::Histogram &parse_time = pokezero::MetricsRegistry::shared().histogram(
+	        "pokezero_replay_parse_seconds", "Time to parse a recorded battle");
+
+	std::string text;
+	while (in.pop(text)) {
+		nlohmann::json battle;
+		{
+			pokezero::ScopedTimer timer(parse_time);
+			ALLOC_SCOPE(ALLOC_PARSE);
+			battle = nlohmann::json::parse(text, nullptr, false);
+		}
+		if (battle.is_discarded() || !battle.is_array()) {
+			errors++;
+			continue;
+		}
+		out.push(std::move(battle));
+	}
+}
+
+/*
+ * featurize stage: a sample of every battle state for each side, with the
+ * outcome filled in from the battle's winner
+ *
+ * each worker keeps one parser, so the pokedex data is loaded once per thread
+ * rather than once per battle
+ */
+void
+featurizeBattles(pokezero::BoundedQueue<nlohmann::json> &in, pokezero::BoundedQueue<Records> &out,
+                 std::atomic<uint64_t> &errors)
+{
+	pokezero::BattleParser parser;
+	nlohmann::json battle;
+
+	pokezero::Histogram &featurize_time = pokezero::MetricsRegistry::shared().histogram(
+	        "pokezero_featurize_seconds", "Time to featurize a battle state for both sides");
+
+	while (in.pop(battle)) {
+		Records records;
+		parser.reset();
+
+		try {
+			for (nlohmann::json &response: battle) {
+				if (parser.handleParsedResponse(std::move(response)) != pokezero::BattleParser::BATTLESTATE) {
+					continue;
+				}
+
+				pokezero::ScopedTimer timer(featurize_time);
+				int turn = parser.lastTurn();
+				MLVec vec = parser.getMLVec(turn);
+				for (size_t side = 0; side < 2; side++) {
+					records.push_back(pokezero::sampleState(vec, parser.getChoices(turn, side), turn, side));
+				}
+			}
+		} catch (std::exception &e) {
+			errors++;
+			continue;
+		}
+
+		// the Manager names its players p1 and p2
+		for (pokezero::TrajectoryRecord &record: records) {
+			if (!parser.winner.empty()) {
+				record.outcome = parser.winner == "p" + std::to_string(record.side + 1) ? 1 : -1;
+			}
+		}
+
+		out.push(std::move(records));
+	}
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * featurize recorded battles into trajectory shards
+ *
+ * reading, parsing, featurizing and writing are separate stages joined by
+ * bounded queues; parsing and featurizing each get half the workers, which
+ * are the expensive stages, while a single thread reads and one writes
+ */
+FeaturizeStats
+featurizeReplays(const FeaturizeConfig &config)
+{
+	size_t threads = config.threads > 0 ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+	size_t parsers = std::max<size_t>(1, threads / 2);
+	size_t featurizers = std::max<size_t>(1, threads - parsers);
+
+	BoundedQueue<std::string> texts(config.queue_depth);
+	BoundedQueue<nlohmann::json> battles(config.queue_depth);
+	BoundedQueue<Records> samples(config.queue_depth);
+	std::atomic<uint64_t> errors{0};
+
+	FeaturizeStats stats;
+	TrajectoryWriter writer(config.prefix);
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	startStage(workers, 1, [&]() { readBattles(config.inputs, texts, errors); }, texts);
+	startStage(workers, parsers, [&]() { parseBattles(texts, battles, errors); }, battles);
+	startStage(workers, featurizers, [&]() { featurizeBattles(battles, samples, errors); }, samples);
+
+	Records records;
+	while (samples.pop(records)) {
+		writer.append(records.data(), records.size());
+		stats.battles++;
+		stats.records += records.size();
+	}
+
+	for (auto &t: workers) {
+		t.join();
+	}
+	writer.flush();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	stats.seconds = elapsed.count();
+	stats.errors = errors;
+
+	return stats;
+}
+
+/*
+ * usage: featurize [-j threads] <shard prefix> <replay files...>
+ */
+int
+featurize(int argc, char **argv)
+{
+	FeaturizeConfig config;
+
+	int i = 0;
+	if (i + 1 < argc && std::strcmp(argv[i], "-j") == 0) {
+		config.threads = std::stoul(argv[i + 1]);
+		i += 2;
+	}
+
+	if (argc - i < 2) {
+		std::cerr << "usage: featurize [-j threads] <shard prefix> <replay files...>" << std::endl;
+		return 1;
+	}
+
+	config.prefix = argv[i++];
+	config.inputs.assign(argv + i, argv + argc);
+
+	AllocStats allocs_before = allocStats();
+	FeaturizeStats stats = featurizeReplays(config);
+	std::cout << stats.battles << " battles, " << stats.records << " records, " << stats.errors << " skipped in "
+		  << stats.seconds << "s: " << double(stats.records) / stats.seconds << " records/sec" << std::endl;
+
+	// a record per side of each state, so half as many turns
+	if (AllocStatsEnabled) {
+		writeAllocReport(std::cout, allocStats() - allocs_before, stats.records / 2);
+	}
+
+	return stats.errors > 0 ? 1 : 0;
+}
+} // namespace pokezero
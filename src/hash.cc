@@ -0,0 +1,133 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "hash.hh"
+
+#include <cstring>
+
+namespace {
+constexpr uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+constexpr uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+constexpr uint64_t PRIME3 = 0x165667b19e3779f9ULL;
+constexpr uint64_t PRIME4 = 0x85ebca77c2b2ae63ULL;
+constexpr uint64_t PRIME5 = 0x27d4eb2f165667c5ULL;
+
+uint64_t
+rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// unaligned little endian loads; every target we build for is little endian
+uint64_t
+read64(const unsigned char *p)
+{
+	uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint32_t
+read32(const unsigned char *p)
+{
+	uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t
+round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+uint64_t
+merge(uint64_t acc, uint64_t val)
+{
+	acc ^= round(0, val);
+	return acc * PRIME1 + PRIME4;
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * XXH64 of the given bytes
+ *
+ * several GB/s on long inputs, so hashing a message costs far less than
+ * parsing it
+ */
+uint64_t
+xxh64(const void *data, size_t len, uint64_t seed)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		uint64_t v1 = seed + PRIME1 + PRIME2;
+		uint64_t v2 = seed + PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME1;
+
+		const unsigned char *limit = end - 32;
+		do {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge(h, v1);
+		h = merge(h, v2);
+		h = merge(h, v3);
+		h = merge(h, v4);
+	} else {
+		h = seed + PRIME5;
+	}
+
+	h += uint64_t(len);
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= round(0, read64(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= uint64_t(read32(p)) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+
+	for (; p < end; p++) {
+		h ^= (*p) * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+} // namespace pokezero
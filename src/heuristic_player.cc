@@ -0,0 +1,316 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "heuristic_player.hh"
+
+#include <algorithm>
+
+#include "dex.hh"
+
+namespace {
+// bonus per unit of KO chance on top of the share of hp a move takes
+constexpr double KO_WEIGHT = 1.0;
+
+// flat score of a status move, which the damage calculator does not value
+constexpr double STATUS_MOVE_SCORE = 0.15;
+
+// a switch only attacks on the next turn, so its offense counts for less
+constexpr double SWITCH_DISCOUNT = 0.5;
+
+int
+activeIndex(SideView<const double> side)
+{
+	for (size_t i = 0; i < 6; i++) {
+		if (side.pokemon()[i].active() > 0) {
+			return int(i);
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * share of the target's current hp a move is expected to take, plus a bonus
+ * for knocking it out
+ */
+double
+offense(const pokezero::DamageTable &table, size_t move, size_t target)
+{
+	if (table.hp[target] <= 0) {
+		return 0;
+	}
+
+	return table.expected[move][target] / table.hp[target] + KO_WEIGHT * table.ko[move][target];
+}
+} // namespace
+
+namespace showdown {
+/*
+ * both active Pokemon, then the tables for the opposing active's moves and
+ * for the moves of each of this side's living Pokemon; nothing when either
+ * side has no active Pokemon
+ */
+void
+StateTables::compute(const pokezero::DamageCalc &calc, const MLVec &vec, size_t side)
+{
+	auto state = features(vec);
+
+	this->own = activeIndex(state.sides()[side]);
+	this->foe = activeIndex(state.sides()[1 - side]);
+	if (this->own < 0 || this->foe < 0) {
+		return;
+	}
+
+	this->incoming = calc.compute(vec, 1 - side, this->foe);
+	for (size_t j = 0; j < 6; j++) {
+		if (state.sides()[side].pokemon()[j].hp() <= -1) {
+			this->outgoing[j] = pokezero::DamageTable();
+			continue;
+		}
+		this->outgoing[j] = calc.compute(vec, side, int(j));
+	}
+}
+
+/*
+ * score every choice of a state
+ *
+ * a move scores the damage it does to the opposing active Pokemon less the
+ * damage the opponent's best move does back; a switch scores the incoming
+ * Pokemon's best move, discounted, less the damage it takes coming in
+ */
+const std::vector<std::pair<size_t, double>> &
+ChoiceRanker::rank(const MLVec &vec, const StateTables &tables, size_t side, const std::vector<std::string> &choices)
+{
+	auto state = features(vec);
+	const pokezero::Dex &dex = pokezero::Dex::get();
+
+	this->scores.clear();
+
+	int own = tables.own;
+	int foe = tables.foe;
+	if (own < 0 || foe < 0) {
+		return this->scores;
+	}
+
+	// share of each of our Pokemon's hp the opposing active's best move takes
+	const pokezero::DamageTable &incoming = tables.incoming;
+	double threat[6] = {};
+	for (size_t j = 0; j < 6; j++) {
+		for (size_t m = 0; m < 4; m++) {
+			threat[j] = std::max(threat[j], offense(incoming, m, j));
+		}
+	}
+
+	PokemonView<const double> active = state.sides()[side].pokemon()[own];
+	const pokezero::DamageTable &outgoing = tables.outgoing[own];
+	for (size_t m = 0; m < 4 && m < choices.size(); m++) {
+		if (choices[m].empty() || active.moves()[m].id() < 0) {
+			continue;
+		}
+
+		bool status = dex.move(size_t(active.moves()[m].id())).category == pokezero::STATUS;
+		double score = status ? STATUS_MOVE_SCORE : offense(outgoing, m, foe);
+		this->scores.emplace_back(pokezero::parseChoice(choices[m]), score - threat[own]);
+	}
+
+	for (size_t j = 0; j < 6 && 4 + j < choices.size(); j++) {
+		if (choices[4 + j].empty() || int(j) == own || state.sides()[side].pokemon()[j].hp() <= -1) {
+			continue;
+		}
+
+		double best = 0;
+		for (size_t m = 0; m < 4; m++) {
+			best = std::max(best, offense(tables.outgoing[j], m, foe));
+		}
+		this->scores.emplace_back(pokezero::parseChoice(choices[4 + j]), SWITCH_DISCOUNT * best - threat[j]);
+	}
+
+	std::stable_sort(this->scores.begin(), this->scores.end(),
+	                 [](auto &a, auto &b) { return a.second > b.second; });
+
+	return this->scores;
+}
+
+/*
+ * work out every choice's outcome and the opposing replies for a state
+ */
+void
+TurnPlayout::prepare(const MLVec &vec, const StateTables &tables, size_t side, const std::vector<std::string> &choices)
+{
+	auto state = features(vec);
+	const pokezero::Dex &dex = pokezero::Dex::get();
+
+	this->outcomes.fill(Outcome());
+	this->prepared = false;
+
+	int own = tables.own;
+	int foe = tables.foe;
+	if (own < 0 || foe < 0) {
+		return;
+	}
+
+	const pokezero::DamageTable &incoming = tables.incoming;
+	for (size_t j = 0; j < 6; j++) {
+		this->reply_best[j] = 0;
+		for (size_t m = 0; m < 4; m++) {
+			this->reply_share[j][m] = incoming.hp[j] > 0 ? incoming.expected[m][j] / incoming.hp[j] : 0;
+			this->reply_ko[j][m] = incoming.ko[m][j];
+			if (offense(incoming, m, j) > offense(incoming, this->reply_best[j], j)) {
+				this->reply_best[j] = m;
+			}
+		}
+	}
+
+	PokemonView<const double> active = state.sides()[side].pokemon()[own];
+	const pokezero::DamageTable &outgoing = tables.outgoing[own];
+	for (size_t m = 0; m < 4 && m < choices.size(); m++) {
+		size_t action = choices[m].empty() ? pokezero::NoAction : pokezero::parseChoice(choices[m]);
+		if (action >= pokezero::ActionCount || active.moves()[m].id() < 0) {
+			continue;
+		}
+
+		Outcome &outcome = this->outcomes[action];
+		outcome = {true, 0, 0, own};
+		if (dex.move(size_t(active.moves()[m].id())).category == pokezero::STATUS) {
+			outcome.share = STATUS_MOVE_SCORE;
+		} else if (outgoing.hp[foe] > 0) {
+			outcome.share = outgoing.expected[m][foe] / outgoing.hp[foe];
+			outcome.ko = outgoing.ko[m][foe];
+		}
+	}
+
+	for (size_t j = 0; j < 6 && 4 + j < choices.size(); j++) {
+		size_t action = choices[4 + j].empty() ? pokezero::NoAction : pokezero::parseChoice(choices[4 + j]);
+		if (action >= pokezero::ActionCount || int(j) == own || state.sides()[side].pokemon()[j].hp() <= -1) {
+			continue;
+		}
+
+		const pokezero::DamageTable &table = tables.outgoing[j];
+		double best = 0;
+		for (size_t m = 0; m < 4; m++) {
+			if (table.hp[foe] > 0) {
+				best = std::max<double>(best, table.expected[m][foe] / table.hp[foe]);
+			}
+		}
+		this->outcomes[action] = {true, SWITCH_DISCOUNT * best, 0, int(j)};
+	}
+
+	this->prepared = true;
+}
+
+/*
+ * outcome in [-1, 1] of one playout of an action: the share of the foe's hp
+ * taken less the share of our own lost to its reply, a knockout counting as
+ * all of it; the foe plays a random move with probability epsilon
+ */
+double
+TurnPlayout::play(size_t action, double epsilon, std::mt19937 &rng) const
+{
+	if (!this->prepared || action >= pokezero::ActionCount || !this->outcomes[action].valid) {
+		return 0;
+	}
+
+	const Outcome &outcome = this->outcomes[action];
+	std::uniform_real_distribution<double> coin(0, 1);
+
+	double dealt = coin(rng) < outcome.ko ? 1 : std::min(outcome.share, 1.0);
+
+	size_t target = size_t(outcome.target);
+	size_t reply = this->reply_best[target];
+	if (coin(rng) < epsilon) {
+		reply = std::uniform_int_distribution<size_t>(0, 3)(rng);
+	}
+	double taken = coin(rng) < this->reply_ko[target][reply] ? 1 : std::min(this->reply_share[target][reply], 1.0);
+
+	return std::clamp(dealt - taken, -1.0, 1.0);
+}
+
+/*
+ * keep a state with its damage tables; only the player's coroutine reads
+ * them, after take() copies them out under the lock
+ */
+void
+ObservedState::put(const MLVec &vec, size_t side, const std::vector<std::string> &choices, uint32_t turn)
+{
+	StateTables tables;
+	tables.compute(this->calc, vec, side);
+
+	std::lock_guard<std::mutex> lk(this->lock);
+	this->tables = tables;
+	this->vec = vec;
+	this->side = side;
+	this->choices = choices;
+	this->turn = turn;
+	this->valid = true;
+}
+
+/*
+ * copy out the state observed for the given turn; false if the last one
+ * observed is for another turn
+ */
+bool
+ObservedState::take(uint32_t turn, MLVec &vec, size_t &side, std::vector<std::string> &choices, StateTables &tables)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	if (!this->valid || this->turn != turn) {
+		return false;
+	}
+
+	vec = this->vec;
+	side = this->side;
+	choices = this->choices;
+	tables = this->tables;
+	return true;
+}
+
+void
+HeuristicPlayer::observe(const MLVec &vec, size_t side, const std::vector<std::string> &choices, uint32_t turn)
+{
+	this->observed.put(vec, side, choices, turn);
+}
+
+/*
+ * play the best ranked action the request offers, or a random choice with
+ * probability epsilon or when the state was not observed
+ */
+std::string_view
+HeuristicPlayer::decideOwnMove()
+{
+	using pokezero::RequestActions;
+
+	size_t choices = this->actions.choice_count;
+	if ((this->actions.command != RequestActions::ACTIVE && this->actions.command != RequestActions::FORCE_SWITCH) ||
+	    choices < 2) {
+		return this->reply(0);
+	}
+
+	size_t pick = this->randomInt(0, choices - 1);
+	std::uniform_real_distribution<double> coin(0, 1);
+	if (coin(this->rng) >= this->epsilon &&
+	    this->observed.take(this->answering, this->vec, this->side, this->choices, this->tables)) {
+		for (auto &[action, score]: this->ranker.rank(this->vec, this->tables, this->side, this->choices)) {
+			if (this->actions.legal(action)) {
+				pick = this->actions.choice[action];
+				break;
+			}
+		}
+	}
+
+	return this->reply(pick);
+}
+} // namespace showdown
@@ -0,0 +1,665 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "inference.hh"
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+namespace {
+// rows of the batch handled by one microkernel call
+constexpr size_t MR = 4;
+
+// output columns handled by one microkernel call; the packed weights are
+// padded to a multiple of this
+#if defined(__AVX512F__)
+constexpr size_t NR = 32;
+#elif defined(__AVX2__)
+constexpr size_t NR = 16;
+#else
+constexpr size_t NR = 8;
+#endif
+
+// depth of the k block kept hot in cache while sweeping the outputs
+constexpr size_t KC = 256;
+
+size_t
+roundUp(size_t n, size_t multiple)
+{
+	return (n + multiple - 1) / multiple * multiple;
+}
+
+#if defined(__AVX2__) && !defined(__AVX512F__)
+/*
+ * acc + x * b; AVX2 does not imply FMA (-mavx2 without -mfma), so without it
+ * this is a multiply then an add
+ */
+__m256
+multiplyAdd(__m256 x, __m256 b, __m256 acc)
+{
+#if defined(__FMA__)
+	return _mm256_fmadd_ps(x, b, acc);
+#else
+	return _mm256_add_ps(_mm256_mul_ps(x, b), acc);
+#endif
+}
+#endif
+
+/*
+ * C[rows x NR] += A[rows x kc] * B[kc x NR]
+ *
+ * A has row stride lda, B and C have row stride ldb/ldc; rows <= MR. Int8
+ * weights are widened to float in registers and scaled after accumulation.
+ */
+template <typename W>
+void
+microKernel(const float *a, size_t lda, const W *b, size_t ldb, float *c, size_t ldc, size_t rows, size_t kc)
+{
+#if defined(__AVX512F__)
+	__m512 acc[MR][2];
+	for (size_t r = 0; r < MR; r++) {
+		acc[r][0] = r < rows ? _mm512_loadu_ps(c + r * ldc) : _mm512_setzero_ps();
+		acc[r][1] = r < rows ? _mm512_loadu_ps(c + r * ldc + 16) : _mm512_setzero_ps();
+	}
+
+	for (size_t k = 0; k < kc; k++) {
+		__m512 b0, b1;
+		if constexpr (std::is_same_v<W, float>) {
+			b0 = _mm512_loadu_ps(b + k * ldb);
+			b1 = _mm512_loadu_ps(b + k * ldb + 16);
+		} else {
+			__m256i q = _mm256_loadu_si256((const __m256i *) (b + k * ldb));
+			b0 = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm256_castsi256_si128(q)));
+			b1 = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm256_extracti128_si256(q, 1)));
+		}
+		for (size_t r = 0; r < MR; r++) {
+			if (r < rows) {
+				__m512 x = _mm512_set1_ps(a[r * lda + k]);
+				acc[r][0] = _mm512_fmadd_ps(x, b0, acc[r][0]);
+				acc[r][1] = _mm512_fmadd_ps(x, b1, acc[r][1]);
+			}
+		}
+	}
+
+	for (size_t r = 0; r < rows; r++) {
+		_mm512_storeu_ps(c + r * ldc, acc[r][0]);
+		_mm512_storeu_ps(c + r * ldc + 16, acc[r][1]);
+	}
+#elif defined(__AVX2__)
+	__m256 acc[MR][2];
+	for (size_t r = 0; r < MR; r++) {
+		acc[r][0] = r < rows ? _mm256_loadu_ps(c + r * ldc) : _mm256_setzero_ps();
+		acc[r][1] = r < rows ? _mm256_loadu_ps(c + r * ldc + 8) : _mm256_setzero_ps();
+	}
+
+	for (size_t k = 0; k < kc; k++) {
+		__m256 b0, b1;
+		if constexpr (std::is_same_v<W, float>) {
+			b0 = _mm256_loadu_ps(b + k * ldb);
+			b1 = _mm256_loadu_ps(b + k * ldb + 8);
+		} else {
+			__m128i q = _mm_loadu_si128((const __m128i *) (b + k * ldb));
+			b0 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q));
+			b1 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q, 8)));
+		}
+		for (size_t r = 0; r < MR; r++) {
+			if (r < rows) {
+				__m256 x = _mm256_set1_ps(a[r * lda + k]);
+				acc[r][0] = multiplyAdd(x, b0, acc[r][0]);
+				acc[r][1] = multiplyAdd(x, b1, acc[r][1]);
+			}
+		}
+	}
+
+	for (size_t r = 0; r < rows; r++) {
+		_mm256_storeu_ps(c + r * ldc, acc[r][0]);
+		_mm256_storeu_ps(c + r * ldc + 8, acc[r][1]);
+	}
+#else
+	// portable fallback; written so the compiler can still vectorize the
+	// inner loop over NR when it is allowed to
+	for (size_t r = 0; r < rows; r++) {
+		float acc[NR];
+		std::memcpy(acc, c + r * ldc, sizeof(acc));
+		for (size_t k = 0; k < kc; k++) {
+			float x = a[r * lda + k];
+			for (size_t j = 0; j < NR; j++) {
+				acc[j] += x * float(b[k * ldb + j]);
+			}
+		}
+		std::memcpy(c + r * ldc, acc, sizeof(acc));
+	}
+#endif
+}
+
+/*
+ * C[n x ldb] = A[n x k] * B[k x ldb], blocked over k so each KC x NR panel of
+ * B is reused across the whole batch while it is still in cache
+ */
+template <typename W>
+void
+gemm(const float *a, size_t n, size_t k, const W *b, size_t ldb, float *c)
+{
+	std::fill(c, c + n * ldb, 0.0f);
+
+	for (size_t k0 = 0; k0 < k; k0 += KC) {
+		size_t kc = std::min(KC, k - k0);
+		for (size_t j0 = 0; j0 < ldb; j0 += NR) {
+			for (size_t i0 = 0; i0 < n; i0 += MR) {
+				size_t rows = std::min(MR, n - i0);
+				microKernel<W>(a + i0 * k + k0, k, b + k0 * ldb + j0, ldb, c + i0 * ldb + j0, ldb, rows,
+				               kc);
+			}
+		}
+	}
+}
+
+template <typename T>
+void
+writeRaw(std::ofstream &out, const T *data, size_t n)
+{
+	out.write(reinterpret_cast<const char *>(data), sizeof(T) * n);
+}
+
+template <typename T>
+void
+readRaw(std::ifstream &in, T *data, size_t n)
+{
+	in.read(reinterpret_cast<char *>(data), sizeof(T) * n);
+	if (!in) {
+		throw std::runtime_error("Truncated weights file");
+	}
+}
+
+/*
+ * layer file format: in, out, type, [scales (INT8)], weights (out x in, row
+ * major), bias
+ */
+pokezero::Layer
+readLayer(std::ifstream &in)
+{
+	pokezero::Layer layer;
+	uint32_t header[3];
+	readRaw(in, header, 3);
+
+	layer.in = header[0];
+	layer.out = header[1];
+	layer.type = pokezero::WeightType(header[2]);
+	layer.out_padded = roundUp(layer.out, NR);
+
+	if (layer.type != pokezero::FLOAT32 && layer.type != pokezero::INT8) {
+		throw std::runtime_error("Unknown weight type " + std::to_string(header[2]));
+	}
+
+	if (layer.type == pokezero::INT8) {
+		layer.scales.assign(layer.out_padded, 0.0f);
+		readRaw(in, layer.scales.data(), layer.out);
+	}
+
+	// pack row-major out x in into in x out_padded
+	if (layer.type == pokezero::FLOAT32) {
+		std::vector<float> rows(layer.out * layer.in);
+		readRaw(in, rows.data(), rows.size());
+		layer.weights.assign(layer.in * layer.out_padded, 0.0f);
+		for (size_t o = 0; o < layer.out; o++) {
+			for (size_t i = 0; i < layer.in; i++) {
+				layer.weights[i * layer.out_padded + o] = rows[o * layer.in + i];
+			}
+		}
+	} else {
+		std::vector<int8_t> rows(layer.out * layer.in);
+		readRaw(in, rows.data(), rows.size());
+		layer.qweights.assign(layer.in * layer.out_padded, 0);
+		for (size_t o = 0; o < layer.out; o++) {
+			for (size_t i = 0; i < layer.in; i++) {
+				layer.qweights[i * layer.out_padded + o] = rows[o * layer.in + i];
+			}
+		}
+	}
+
+	layer.bias.assign(layer.out_padded, 0.0f);
+	readRaw(in, layer.bias.data(), layer.out);
+
+	return layer;
+}
+
+void
+writeLayer(std::ofstream &out, const pokezero::Layer &layer)
+{
+	uint32_t header[3] = {uint32_t(layer.in), uint32_t(layer.out), uint32_t(layer.type)};
+	writeRaw(out, header, 3);
+
+	if (layer.type == pokezero::INT8) {
+		writeRaw(out, layer.scales.data(), layer.out);
+	}
+
+	for (size_t o = 0; o < layer.out; o++) {
+		for (size_t i = 0; i < layer.in; i++) {
+			if (layer.type == pokezero::FLOAT32) {
+				writeRaw(out, &layer.weights[i * layer.out_padded + o], 1);
+			} else {
+				writeRaw(out, &layer.qweights[i * layer.out_padded + o], 1);
+			}
+		}
+	}
+
+	writeRaw(out, layer.bias.data(), layer.out);
+}
+
+/*
+ * symmetric per-output quantization: scale = max |w| / 127
+ */
+pokezero::Layer
+quantizeLayer(const pokezero::Layer &layer)
+{
+	pokezero::Layer q = layer;
+	q.type = pokezero::INT8;
+	q.weights.clear();
+	q.qweights.assign(layer.in * layer.out_padded, 0);
+	q.scales.assign(layer.out_padded, 0.0f);
+
+	for (size_t o = 0; o < layer.out; o++) {
+		float max_abs = 0;
+		for (size_t i = 0; i < layer.in; i++) {
+			max_abs = std::max(max_abs, std::abs(layer.weights[i * layer.out_padded + o]));
+		}
+
+		float scale = max_abs > 0 ? max_abs / 127 : 1;
+		q.scales[o] = scale;
+		for (size_t i = 0; i < layer.in; i++) {
+			float w = std::round(layer.weights[i * layer.out_padded + o] / scale);
+			q.qweights[i * layer.out_padded + o] = int8_t(std::clamp(w, -127.0f, 127.0f));
+		}
+	}
+
+	return q;
+}
+
+pokezero::Layer
+randomLayer(size_t in, size_t out, std::mt19937 &rng)
+{
+	pokezero::Layer layer;
+	layer.in = in;
+	layer.out = out;
+	layer.out_padded = roundUp(out, NR);
+	layer.type = pokezero::FLOAT32;
+	layer.weights.assign(in * layer.out_padded, 0.0f);
+	layer.bias.assign(layer.out_padded, 0.0f);
+
+	// He initialization
+	std::normal_distribution<float> dist(0.0f, std::sqrt(2.0f / float(in)));
+	for (size_t i = 0; i < in; i++) {
+		for (size_t o = 0; o < out; o++) {
+			layer.weights[i * layer.out_padded + o] = dist(rng);
+		}
+	}
+
+	return layer;
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * out[n x out_padded] = in[n x this->in] * W + bias
+ */
+void
+Layer::forward(const float *input, size_t n, float *output) const
+{
+	if (this->type == FLOAT32) {
+		gemm<float>(input, n, this->in, this->weights.data(), this->out_padded, output);
+	} else {
+		gemm<int8_t>(input, n, this->in, this->qweights.data(), this->out_padded, output);
+	}
+
+	for (size_t r = 0; r < n; r++) {
+		float *row = output + r * this->out_padded;
+		if (this->type == INT8) {
+			for (size_t o = 0; o < this->out_padded; o++) {
+				row[o] = row[o] * this->scales[o] + this->bias[o];
+			}
+		} else {
+			for (size_t o = 0; o < this->out_padded; o++) {
+				row[o] += this->bias[o];
+			}
+		}
+	}
+}
+
+/*
+ * load a network from a weights file
+ *
+ * file format (native endianness): magic, version, the FeatureSchemaHash of
+ * the inputs, number of trunk layers, then each trunk layer followed by the
+ * policy and value heads
+ */
+Network::Network(const std::string &path)
+{
+	std::ifstream in(path, std::ios_base::binary | std::ios_base::in);
+	if (!in) {
+		throw std::runtime_error("Could not open weights file " + path);
+	}
+
+	uint32_t header[2];
+	readRaw(in, header, 2);
+	if (header[0] != WEIGHTS_MAGIC) {
+		throw std::runtime_error(path + " is not a weights file");
+	}
+	if (header[1] != WEIGHTS_VERSION) {
+		throw std::runtime_error(path + " has unsupported version " + std::to_string(header[1]));
+	}
+
+	uint64_t schema;
+	readRaw(in, &schema, 1);
+	if (schema != FeatureSchemaHash) {
+		throw std::runtime_error(path + " was trained on a different feature schema");
+	}
+
+	uint32_t trunk;
+	readRaw(in, &trunk, 1);
+	for (uint32_t i = 0; i < trunk; i++) {
+		this->trunk.push_back(readLayer(in));
+	}
+	this->policy = readLayer(in);
+	this->value = readLayer(in);
+
+	// check the layer widths chain together
+	size_t width = BattleStateSize;
+	for (auto &layer: this->trunk) {
+		if (layer.in != width) {
+			throw std::runtime_error(path + ": trunk layer width mismatch");
+		}
+		width = layer.out;
+	}
+	if (this->policy.in != width || this->policy.out != PolicySize) {
+		throw std::runtime_error(path + ": policy head shape mismatch");
+	}
+	if (this->value.in != width || this->value.out != 1) {
+		throw std::runtime_error(path + ": value head shape mismatch");
+	}
+}
+
+/*
+ * randomly initialized float32 network with the given hidden layer widths
+ */
+Network
+Network::random(const std::vector<size_t> &hidden, uint32_t seed)
+{
+	Network net;
+	std::mt19937 rng(seed);
+
+	size_t width = BattleStateSize;
+	for (size_t h: hidden) {
+		net.trunk.push_back(randomLayer(width, h, rng));
+		width = h;
+	}
+	net.policy = randomLayer(width, PolicySize, rng);
+	net.value = randomLayer(width, 1, rng);
+
+	return net;
+}
+
+void
+Network::save(const std::string &path) const
+{
+	std::ofstream out(path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	if (!out) {
+		throw std::runtime_error("Could not open weights file " + path);
+	}
+
+	uint32_t header[2] = {WEIGHTS_MAGIC, WEIGHTS_VERSION};
+	writeRaw(out, header, 2);
+	writeRaw(out, &FeatureSchemaHash, 1);
+	uint32_t trunk = uint32_t(this->trunk.size());
+	writeRaw(out, &trunk, 1);
+
+	for (auto &layer: this->trunk) {
+		writeLayer(out, layer);
+	}
+	writeLayer(out, this->policy);
+	writeLayer(out, this->value);
+}
+
+/*
+ * copy of this network with every layer quantized to int8
+ */
+Network
+Network::quantize() const
+{
+	if (this->weightType() == INT8) {
+		return *this;
+	}
+
+	Network q;
+	for (auto &layer: this->trunk) {
+		q.trunk.push_back(quantizeLayer(layer));
+	}
+	q.policy = quantizeLayer(this->policy);
+	q.value = quantizeLayer(this->value);
+
+	return q;
+}
+
+size_t
+Network::parameters() const
+{
+	size_t total = (this->policy.in + 1) * this->policy.out + (this->value.in + 1) * this->value.out;
+	for (auto &layer: this->trunk) {
+		total += (layer.in + 1) * layer.out;
+	}
+
+	return total;
+}
+
+/*
+ * evaluate n states at once
+ *
+ * activations live in thread local scratch buffers so repeated calls from a
+ * batching thread do not allocate
+ */
+void
+Network::forward(const MLVec *states, size_t n, Evaluation *results) const
+{
+	thread_local std::vector<float> act_in, act_out, heads;
+
+	size_t width = BattleStateSize;
+	act_in.resize(n * width);
+	for (size_t r = 0; r < n; r++) {
+		for (size_t i = 0; i < width; i++) {
+			act_in[r * width + i] = float(states[r][i]);
+		}
+	}
+
+	for (auto &layer: this->trunk) {
+		act_out.resize(n * layer.out_padded);
+		layer.forward(act_in.data(), n, act_out.data());
+
+		// ReLU, and compact out_padded back down to the next layer's input width
+		act_in.resize(n * layer.out);
+		for (size_t r = 0; r < n; r++) {
+			for (size_t o = 0; o < layer.out; o++) {
+				act_in[r * layer.out + o] = std::max(0.0f, act_out[r * layer.out_padded + o]);
+			}
+		}
+		width = layer.out;
+	}
+
+	heads.resize(n * this->policy.out_padded);
+	this->policy.forward(act_in.data(), n, heads.data());
+	for (size_t r = 0; r < n; r++) {
+		const float *logits = heads.data() + r * this->policy.out_padded;
+		float max_logit = *std::max_element(logits, logits + PolicySize);
+		float sum = 0;
+		for (size_t a = 0; a < PolicySize; a++) {
+			results[r].policy[a] = std::exp(logits[a] - max_logit);
+			sum += results[r].policy[a];
+		}
+		for (size_t a = 0; a < PolicySize; a++) {
+			results[r].policy[a] /= sum;
+		}
+	}
+
+	heads.resize(n * this->value.out_padded);
+	this->value.forward(act_in.data(), n, heads.data());
+	for (size_t r = 0; r < n; r++) {
+		results[r].value = std::tanh(heads[r * this->value.out_padded]);
+	}
+}
+
+/*
+ * adapter for EvalQueue; the network must outlive the queue
+ */
+BatchEvaluator
+Network::evaluator() const
+{
+	return [this](const MLVec *states, size_t n, Evaluation *results) { this->forward(states, n, results); };
+}
+
+/*
+ * benchmark single threaded forward passes and report evaluations/sec/core
+ *
+ * usage: bench-inference [weights file] [batch size] [iterations]
+ *
+ * without a weights file a random 512-256 network is used; both the float32
+ * and int8 quantized versions are timed
+ */
+int
+benchInference(int argc, char **argv)
+{
+	Network net;
+	if (argc > 0 && std::string(argv[0]) != "-") {
+		net = Network(argv[0]);
+	} else {
+		net = Network::random({512, 256});
+	}
+	size_t batch = argc > 1 ? std::stoul(argv[1]) : 64;
+	size_t iterations = argc > 2 ? std::stoul(argv[2]) : 200;
+
+	std::vector<MLVec> states(batch);
+	std::vector<Evaluation> results(batch);
+	std::mt19937 rng(0);
+	std::uniform_real_distribution<double> dist(-1.0, 1.0);
+	for (auto &s: states) {
+		for (auto &x: s) {
+			x = dist(rng);
+		}
+	}
+
+	std::cout << "kernel columns: " << NR << ", parameters: " << net.parameters() << ", batch: " << batch
+		  << '\n';
+
+	std::vector<std::pair<std::string, Network>> variants;
+	if (net.weightType() == FLOAT32) {
+		variants.emplace_back("float32", net);
+	}
+	variants.emplace_back("int8", net.quantize());
+
+	for (auto &[name, variant]: variants) {
+		// warm up caches and scratch buffers
+		variant.forward(states.data(), batch, results.data());
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; i++) {
+			variant.forward(states.data(), batch, results.data());
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		double evals = double(batch * iterations) / elapsed.count();
+		std::cout << name << ": " << evals << " evaluations/sec/core (value[0] = " << results[0].value
+			  << ")\n";
+	}
+
+	return 0;
+}
+
+/*
+ * benchmark leaf evaluations through an EvalQueue: each client thread
+ * submits one state and waits for it before submitting the next, the way a
+ * search waits on a leaf, and the queue batches whatever is waiting
+ *
+ * usage: bench-eval-queue [weights file|-] [clients] [evaluations per client] [max batch] [max delay us]
+ *
+ * reports throughput, how full the batches ran and the submit to result
+ * latency
+ */
+int
+benchEvalQueue(int argc, char **argv)
+{
+	Network net;
+	if (argc > 0 && std::string(argv[0]) != "-") {
+		net = Network(argv[0]);
+	} else {
+		net = Network::random({512, 256});
+	}
+	size_t clients = argc > 1 ? std::stoul(argv[1]) : 64;
+	size_t evaluations = argc > 2 ? std::stoul(argv[2]) : 200;
+	size_t max_batch = argc > 3 ? std::stoul(argv[3]) : 64;
+	std::chrono::microseconds max_delay(argc > 4 ? std::stoul(argv[4]) : 200);
+
+	std::vector<MLVec> states(clients);
+	std::mt19937 rng(0);
+	std::uniform_real_distribution<double> dist(-1.0, 1.0);
+	for (auto &s: states) {
+		for (auto &x: s) {
+			x = dist(rng);
+		}
+	}
+
+	EvalQueue queue(net.evaluator(), max_batch, max_delay);
+	std::vector<std::thread> threads;
+	std::vector<double> checksums(clients);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t c = 0; c < clients; c++) {
+		threads.emplace_back([&, c]() {
+			for (size_t i = 0; i < evaluations; i++) {
+				checksums[c] += queue.submit(states[c]).get().value;
+			}
+		});
+	}
+	for (auto &t: threads) {
+		t.join();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	EvalQueueStats stats = queue.stats();
+	double sink = 0;
+	for (double c: checksums) {
+		sink += c;
+	}
+
+	std::cout << clients << " clients, max batch " << max_batch << ", max delay " << max_delay.count() << "us\n"
+		  << double(stats.evaluations) / elapsed.count() << " evaluations/sec in " << stats.batches
+		  << " batches, " << stats.mean_fill * 100 << "% mean occupancy\n"
+		  << "latency " << stats.mean_latency_us << "us mean, " << stats.max_latency_us
+		  << "us max (checksum " << sink << ")\n";
+
+	return 0;
+}
+} // namespace pokezero
@@ -0,0 +1,371 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "log.hh"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+// how long the writer sleeps between drains
+constexpr auto WRITE_INTERVAL = std::chrono::milliseconds(10);
+
+const char *const LEVEL_NAMES[] = {"trace", "debug", "info", "warn", "error"};
+
+/*
+ * rings of every thread that has logged, and the thread that formats them
+ *
+ * never destroyed, so threads can log during static destruction and the last
+ * records are still written by the flush at exit
+ */
+class Logger {
+public:
+	// constructors
+	Logger()
+	{
+		this->writer = std::thread([this]() { this->run(); });
+		this->writer.detach();
+		std::atexit(pokezero::logFlush);
+	}
+
+	pokezero::LogRing *add()
+	{
+		std::lock_guard<std::mutex> lk(this->rings_lock);
+		this->rings.push_back(std::make_unique<pokezero::LogRing>(gettid()));
+		return this->rings.back().get();
+	}
+
+	/*
+	 * write out every record logged so far; rings of threads that have
+	 * exited are freed once empty
+	 */
+	void drain()
+	{
+		std::lock_guard<std::mutex> drain_lk(this->drain_lock);
+
+		std::unique_lock<std::mutex> lk(this->rings_lock);
+		std::vector<pokezero::LogRing *> current;
+		for (auto &ring: this->rings) {
+			current.push_back(ring.get());
+		}
+		lk.unlock();
+
+		for (pokezero::LogRing *ring: current) {
+			ring->drain(&Logger::format, this);
+
+			uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+			if (dropped > 0) {
+				int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				                      std::chrono::system_clock::now().time_since_epoch())
+				                      .count();
+				const char *message = "records dropped";
+				pokezero::LogRecord record{0, pokezero::LOG_WARN_LEVEL, 1, "log", message, now};
+
+				char fields[sizeof(const char *) + 9];
+				pokezero::logEncodeFields(fields, "count", dropped);
+				format(*ring, record, fields, this);
+			}
+		}
+		std::fflush(this->out);
+
+		lk.lock();
+		std::erase_if(this->rings, [](auto &ring) {
+			return ring->abandoned.load(std::memory_order_acquire) && ring->empty();
+		});
+	}
+
+	void setOutput(FILE *out)
+	{
+		std::lock_guard<std::mutex> lk(this->drain_lock);
+		this->out = out;
+	}
+
+private:
+	std::mutex rings_lock;
+	std::vector<std::unique_ptr<pokezero::LogRing>> rings;
+
+	std::mutex drain_lock; // held while formatting, so records leave in order
+	FILE *out = stderr;
+	std::string line;
+
+	std::thread writer;
+
+	void run()
+	{
+		while (true) {
+			std::this_thread::sleep_for(WRITE_INTERVAL);
+			this->drain();
+		}
+	}
+
+	static void format(const pokezero::LogRing &, const pokezero::LogRecord &, const char *, void *);
+};
+
+Logger &
+logger()
+{
+	static Logger *logger = new Logger();
+	return *logger;
+}
+
+/*
+ * append a string value, quoted when logfmt needs it to be
+ */
+void
+appendString(std::string &line, std::string_view value)
+{
+	bool quote = value.empty() || value.find_first_of(" =\"\n\t") != std::string_view::npos;
+	if (!quote) {
+		line += value;
+		return;
+	}
+
+	line += '"';
+	for (char c: value) {
+		if (c == '"' || c == '\\') {
+			line += '\\';
+			line += c;
+		} else if (c == '\n') {
+			line += "\\n";
+		} else {
+			line += c;
+		}
+	}
+	line += '"';
+}
+
+/*
+ * one logfmt line for a record:
+ * time=... level=... component=... tid=... msg="..." key=value ...
+ */
+void
+Logger::format(const pokezero::LogRing &ring, const pokezero::LogRecord &record, const char *fields, void *self)
+{
+	Logger *logger = static_cast<Logger *>(self);
+	std::string &line = logger->line;
+
+	char prefix[128];
+	time_t seconds = time_t(record.time / 1000000000);
+	struct tm utc;
+	gmtime_r(&seconds, &utc);
+	size_t n = std::strftime(prefix, sizeof(prefix), "time=%Y-%m-%dT%H:%M:%S", &utc);
+	std::snprintf(prefix + n, sizeof(prefix) - n, ".%06lldZ level=%s component=%s tid=%d msg=",
+	              (long long) (record.time % 1000000000 / 1000), LEVEL_NAMES[record.level], record.component,
+	              ring.tid);
+
+	line.assign(prefix);
+	appendString(line, record.message);
+
+	for (size_t i = 0; i < record.fields; i++) {
+		const char *key;
+		std::memcpy(&key, fields, sizeof(key));
+		fields += sizeof(key);
+
+		line += ' ';
+		line += key;
+		line += '=';
+
+		char number[32];
+		pokezero::LogType type = pokezero::LogType(*fields++);
+		switch (type) {
+		case pokezero::LOG_INT: {
+			int64_t v;
+			std::memcpy(&v, fields, 8);
+			std::snprintf(number, sizeof(number), "%lld", (long long) v);
+			line += number;
+			fields += 8;
+			break;
+		}
+		case pokezero::LOG_UINT: {
+			uint64_t v;
+			std::memcpy(&v, fields, 8);
+			std::snprintf(number, sizeof(number), "%llu", (unsigned long long) v);
+			line += number;
+			fields += 8;
+			break;
+		}
+		case pokezero::LOG_DOUBLE: {
+			double v;
+			std::memcpy(&v, fields, 8);
+			std::snprintf(number, sizeof(number), "%g", v);
+			line += number;
+			fields += 8;
+			break;
+		}
+		case pokezero::LOG_BOOL:
+			line += *fields ? "true" : "false";
+			fields += 8;
+			break;
+		case pokezero::LOG_STRING: {
+			uint32_t size;
+			std::memcpy(&size, fields, 4);
+			appendString(line, std::string_view(fields + 4, size));
+			fields += 4 + size;
+			break;
+		}
+		}
+	}
+
+	line += '\n';
+	std::fwrite(line.data(), 1, line.size(), logger->out);
+}
+
+/*
+ * marks the thread's ring abandoned when the thread exits
+ */
+struct RingOwner {
+	pokezero::LogRing *ring = nullptr;
+
+	// destructor
+	~RingOwner()
+	{
+		if (this->ring != nullptr) {
+			this->ring->abandoned.store(true, std::memory_order_release);
+		}
+	}
+};
+
+thread_local RingOwner ring_owner;
+} // namespace
+
+namespace pokezero {
+/*
+ * hand every complete record to the callback and free its space, returning
+ * how many there were
+ */
+size_t
+LogRing::drain(void (*callback)(const LogRing &, const LogRecord &, const char *, void *), void *context)
+{
+	uint64_t head = this->head.load(std::memory_order_relaxed);
+	uint64_t tail = this->tail.load(std::memory_order_acquire);
+	size_t records = 0;
+
+	while (head < tail) {
+		if (skipsTail(head)) {
+			head += Capacity - head % Capacity;
+			continue;
+		}
+
+		LogRecord record;
+		const char *at = this->data + head % Capacity;
+		std::memcpy(&record, at, sizeof(record));
+
+		if (record.component != nullptr) {
+			callback(*this, record, at + sizeof(record), context);
+			records++;
+		}
+		head += record.size;
+	}
+
+	this->head.store(head, std::memory_order_release);
+	return records;
+}
+
+/*
+ * the calling thread's ring, registered with the writer on first use
+ */
+LogRing &
+logRing()
+{
+	if (ring_owner.ring == nullptr) {
+		ring_owner.ring = logger().add();
+	}
+
+	return *ring_owner.ring;
+}
+
+void
+setLogLevel(LogLevel level)
+{
+	log_level.store(level, std::memory_order_relaxed);
+}
+
+/*
+ * level named trace, debug, info, warn or error
+ */
+bool
+parseLogLevel(std::string_view name, LogLevel &level)
+{
+	for (size_t i = 0; i < std::size(LEVEL_NAMES); i++) {
+		if (name == LEVEL_NAMES[i]) {
+			level = LogLevel(i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * append log lines to a file instead of stderr
+ */
+void
+logToFile(const char *path)
+{
+	FILE *out = std::fopen(path, "a");
+	if (out == nullptr) {
+		LOG_ERROR("log", "cannot open log file", "path", path, "error", std::strerror(errno));
+		return;
+	}
+
+	logger().setOutput(out);
+}
+
+/*
+ * POKEZERO_LOG_LEVEL sets the runtime level and POKEZERO_LOG_FILE the file
+ * lines go to
+ */
+void
+logFromEnvironment()
+{
+	const char *level_name = std::getenv("POKEZERO_LOG_LEVEL");
+	LogLevel level;
+	if (level_name != nullptr) {
+		if (parseLogLevel(level_name, level)) {
+			setLogLevel(level);
+		} else {
+			LOG_WARN("log", "unknown log level", "level", level_name);
+		}
+	}
+
+	const char *path = std::getenv("POKEZERO_LOG_FILE");
+	if (path != nullptr) {
+		logToFile(path);
+	}
+}
+
+/*
+ * write out everything logged so far, from the calling thread
+ */
+void
+logFlush()
+{
+	logger().drain();
+}
+} // namespace pokezero
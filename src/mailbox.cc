@@ -0,0 +1,254 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "mailbox.hh"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+// polls of an empty mailbox before a waiting thread sleeps on the futex;
+// directives usually follow the request within a few microseconds, but on a
+// single cpu spinning only delays the producer
+const size_t spin_limit = std::thread::hardware_concurrency() > 1 ? 2000 : 0;
+
+void
+relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/*
+ * the handoff Player used before the mailbox: a string written under a
+ * mutex and a condition variable to wake the reader
+ */
+struct LockedSlot {
+	std::mutex lock;
+	std::condition_variable cv;
+	std::string move;
+	bool full = false;
+
+	void put(const std::string &move)
+	{
+		std::unique_lock<std::mutex> lk(this->lock);
+		this->move = move;
+		this->full = true;
+		lk.unlock();
+		this->cv.notify_one();
+	}
+
+	std::string take()
+	{
+		std::unique_lock<std::mutex> lk(this->lock);
+		while (!this->full) {
+			this->cv.wait(lk);
+		}
+		this->full = false;
+		return this->move;
+	}
+};
+
+/*
+ * ns per round trip of a directive bounced between two threads
+ */
+template <class Send, class Receive>
+double
+pingPong(size_t iterations, Send send, Receive receive)
+{
+	std::thread echo([&]() {
+		for (size_t i = 0; i < iterations; i++) {
+			send(1, receive(0));
+		}
+	});
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		send(0, "{\"type\":\"move\",\"active\":0}");
+		receive(1);
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	echo.join();
+
+	return elapsed.count() / double(iterations);
+}
+} // namespace
+
+namespace showdown {
+/*
+ * constructor
+ *
+ * throws if the text does not fit inline
+ */
+MoveDirective::MoveDirective(MoveType type, std::string_view text, uint32_t turn)
+{
+	if (text.size() > Capacity) {
+		throw std::length_error("move directive longer than " + std::to_string(Capacity) + " bytes");
+	}
+
+	std::memcpy(this->text, text.data(), text.size());
+	this->length = uint8_t(text.size());
+	this->type = type;
+	this->turn = turn;
+}
+
+/*
+ * publish a directive, replacing one that has not been taken; returns the
+ * consumer coroutine parked on the mailbox, if any, for the caller to
+ * schedule
+ */
+std::coroutine_handle<>
+Mailbox::push(const MoveDirective &directive)
+{
+	this->slots[this->back] = directive;
+	uint64_t word = this->back | Fresh | uint64_t(directive.type) << 8 | uint64_t(directive.turn) << 32;
+	this->back = uint8_t(this->published.exchange(word, std::memory_order_seq_cst) & Slot);
+
+	// seq_cst against the consumer's store of waiter and load of published:
+	// either it sees the new directive or this sees its waiter
+	if (this->sleepers.load(std::memory_order_seq_cst) > 0) {
+		this->published.notify_all();
+	}
+
+	return std::coroutine_handle<>::from_address(this->waiter.exchange(nullptr, std::memory_order_seq_cst));
+}
+
+bool
+Mailbox::pop(MoveDirective &directive)
+{
+	if (!(this->published.load(std::memory_order_acquire) & Fresh)) {
+		return false;
+	}
+
+	this->front = uint8_t(this->published.exchange(this->front, std::memory_order_acq_rel) & Slot);
+	directive = this->slots[this->front];
+
+	return true;
+}
+
+/*
+ * type and turn of the directive waiting to be taken, a WAIT if there is none
+ */
+Mailbox::Pending
+Mailbox::peek() const
+{
+	uint64_t word = this->published.load(std::memory_order_acquire);
+	if (!(word & Fresh)) {
+		return {};
+	}
+
+	return {MoveType(word >> 8 & 0xff), uint32_t(word >> 32)};
+}
+
+/*
+ * take the next directive, spinning briefly and then sleeping on a futex
+ * while there is none
+ */
+MoveDirective
+Mailbox::wait()
+{
+	MoveDirective directive;
+	for (size_t i = 0; i < spin_limit; i++) {
+		if (this->pop(directive)) {
+			return directive;
+		}
+		relax();
+	}
+
+	this->sleepers.fetch_add(1, std::memory_order_seq_cst);
+	while (!this->pop(directive)) {
+		uint64_t word = this->published.load(std::memory_order_seq_cst);
+		if (!(word & Fresh)) {
+			this->published.wait(word, std::memory_order_seq_cst);
+		}
+	}
+	this->sleepers.fetch_sub(1, std::memory_order_relaxed);
+
+	return directive;
+}
+
+/*
+ * park the coroutine; false resumes it right away if a directive raced in
+ * and the producer has not already claimed the coroutine
+ */
+bool
+Mailbox::Next::await_suspend(std::coroutine_handle<> handle)
+{
+	this->mailbox.waiter.store(handle.address(), std::memory_order_seq_cst);
+	if (this->mailbox.empty()) {
+		return true;
+	}
+
+	return this->mailbox.waiter.exchange(nullptr, std::memory_order_seq_cst) == nullptr;
+}
+
+MoveDirective
+Mailbox::Next::await_resume()
+{
+	if (!this->popped && !this->mailbox.pop(this->directive)) {
+		throw std::logic_error("move directive mailbox resumed while empty");
+	}
+
+	return this->directive;
+}
+
+/*
+ * compares the mutex and condition variable handoff with the mailbox
+ *
+ * arguments: [iterations]
+ */
+int
+benchMailbox(int argc, char **argv)
+{
+	size_t iterations = argc > 0 ? std::stoul(argv[0]) : 200000;
+
+	LockedSlot slots[2];
+	double locked = pingPong(
+		iterations, [&](int i, const std::string &move) { slots[i].put(move); },
+		[&](int i) { return slots[i].take(); });
+	std::cout << "mutex + condition variable: " << locked << " ns per round trip\n";
+
+	Mailbox mailboxes[2];
+	double mailbox = pingPong(
+		iterations, [&](int i, std::string_view move) { mailboxes[i].push(MoveDirective(DIRECTED, move)); },
+		[&](int i) {
+			MoveDirective directive = mailboxes[i].wait();
+			return std::string(directive.view());
+		});
+	std::cout << "mailbox: " << mailbox << " ns per round trip\n";
+
+	Mailbox single;
+	MoveDirective directive(CHOICE, "switch 3");
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		single.push(directive);
+		single.pop(directive);
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "uncontended push + pop: " << elapsed.count() / double(iterations) << " ns\n";
+
+	return 0;
+}
+} // namespace showdown
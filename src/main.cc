@@ -18,16 +18,92 @@
 
 #include "main.hh"
 
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <iostream>
 #include <nlohmann/json.hpp>
 
+#include "arena.hh"
 #include "battle_parser.hh"
+#include "cluster.hh"
+#include "damage.hh"
+#include "dataset.hh"
+#include "determinizer.hh"
+#include "feature_schema.hh"
+#include "featurize.hh"
+#include "inference.hh"
+#include "mailbox.hh"
+#include "log.hh"
 #include "manager.hh"
+#include "metrics.hh"
 #include "random_player.hh"
+#include "tournament.hh"
+#include "trace.hh"
+
+namespace {
+// subcommands selected by the first command line argument; each receives the
+// remaining arguments
+struct Command {
+	const char *name;
+	int (*run)(int, char **);
+	const char *usage;
+};
+
+const Command commands[] = {
+	{"bench-inference", pokezero::benchInference, "[weights file|-] [batch size] [iterations]"},
+	{"bench-eval-queue", pokezero::benchEvalQueue, "[weights file|-] [clients] [evaluations per client] [max batch] [max delay us]"},
+	{"bench-damage", pokezero::benchDamage, "[iterations]"},
+	{"bench-determinizer", pokezero::benchDeterminizer, "[iterations]"},
+	{"head-to-head", pokezero::headToHead, "[battles] [trajectory prefix]"},
+	{"bench-placement", pokezero::benchPlacement, "[battles] [concurrent battles] [none|numa|cache...]"},
+	{"tournament", pokezero::tournament, "[-g games per pairing] [-c concurrent battles] [entrants...]"},
+	{"coordinator", pokezero::coordinate, "[-n battles] [-j battles per job] [-m weights file] <address> <shard prefix>"},
+	{"worker", pokezero::work, "[-c concurrent battles] [-b batch records] [-w window] [-s] <address>"},
+	{"bench-mailbox", showdown::benchMailbox, "[iterations]"},
+	{"bench-dataset", pokezero::benchDataset, "[records] [directory]"},
+	{"featurize", pokezero::featurize, "[-j threads] <shard prefix> <replay files...>"},
+	{"feature-schema", pokezero::featureSchema, ""},
+};
+} // namespace
 
 int
-main()
+main(int argc, char *argv[])
 {
+	pokezero::logFromEnvironment();
+
+	// with tracing built in, POKEZERO_TRACE names the file the timeline is
+	// written to on SIGUSR1 and at exit
+	const char *trace_file = std::getenv("POKEZERO_TRACE");
+	if (pokezero::TraceEnabled && trace_file != nullptr) {
+		pokezero::traceToFile(trace_file);
+	}
+
+	// POKEZERO_METRICS names a Prometheus text file rewritten every 10
+	// seconds, POKEZERO_METRICS_SOCKET a Unix socket that serves the same
+	const char *metrics_file = std::getenv("POKEZERO_METRICS");
+	const char *metrics_socket = std::getenv("POKEZERO_METRICS_SOCKET");
+	std::unique_ptr<pokezero::MetricsExporter> exporter;
+	if (metrics_file != nullptr || metrics_socket != nullptr) {
+		exporter = std::make_unique<pokezero::MetricsExporter>(metrics_file ? metrics_file : "",
+		                                                       metrics_socket ? metrics_socket : "");
+	}
+
+	if (argc > 1) {
+		for (auto &command: commands) {
+			if (std::strcmp(argv[1], command.name) == 0) {
+				return command.run(argc - 2, argv + 2);
+			}
+		}
+
+		std::cerr << "usage: " << argv[0] << " [command]\n";
+		for (auto &command: commands) {
+			std::cerr << "    " << command.name << ' ' << command.usage << '\n';
+		}
+		return 1;
+	}
+
 	/*
 	 * auto battle_parser = pokezero::BattleParser();
 	 *
@@ -0,0 +1,358 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "metrics.hh"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "log.hh"
+
+namespace {
+// quantiles reported for each histogram
+constexpr double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+// how often the socket loop checks whether the exporter is stopping
+constexpr int POLL_MS = 200;
+
+/*
+ * name{labels} with any extra label appended, or just the name
+ */
+std::string
+series(const std::string &name, const std::string &labels, const std::string &extra = "")
+{
+	if (labels.empty() && extra.empty()) {
+		return name;
+	}
+
+	return name + '{' + labels + (labels.empty() || extra.empty() ? "" : ",") + extra + '}';
+}
+
+/*
+ * the metrics of a deque grouped by name, so each name gets one HELP and TYPE
+ * header
+ */
+template <class Metrics, class Write>
+void
+writeGrouped(std::ostream &out, Metrics &metrics, const char *type, Write write)
+{
+	std::set<std::string> written;
+	for (auto &metric: metrics) {
+		if (!written.insert(metric.name).second) {
+			continue;
+		}
+
+		out << "# HELP " << metric.name << ' ' << metric.help << '\n';
+		out << "# TYPE " << metric.name << ' ' << type << '\n';
+		for (auto &same: metrics) {
+			if (same.name == metric.name) {
+				write(same);
+			}
+		}
+	}
+}
+} // namespace
+
+namespace pokezero {
+void
+Histogram::record(uint64_t ns)
+{
+	this->buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+	this->total.fetch_add(1, std::memory_order_relaxed);
+	this->total_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+/*
+ * values below SubBuckets have a bucket each; above that, the bucket is the
+ * value's power of two and its next four bits
+ */
+size_t
+Histogram::bucket(uint64_t value)
+{
+	if (value < SubBuckets) {
+		return size_t(value);
+	}
+
+	size_t exponent = 63 - size_t(std::countl_zero(value));
+	size_t sub = size_t(value >> (exponent - 4)) & (SubBuckets - 1);
+	return (exponent - 3) * SubBuckets + sub;
+}
+
+/*
+ * middle of the range of values that fall in a bucket
+ */
+uint64_t
+Histogram::bucketValue(size_t index)
+{
+	if (index < SubBuckets) {
+		return index;
+	}
+
+	size_t shift = index / SubBuckets - 1;
+	uint64_t low = uint64_t(SubBuckets + index % SubBuckets) << shift;
+	return low + (uint64_t(1) << shift) / 2;
+}
+
+Histogram::Counts
+Histogram::counts() const
+{
+	Counts counts;
+	for (size_t i = 0; i < BucketCount; i++) {
+		counts[i] = this->buckets[i].load(std::memory_order_relaxed);
+	}
+	return counts;
+}
+
+/*
+ * value below which the given share of recordings fall, or 0 with nothing
+ * recorded
+ */
+uint64_t
+Histogram::quantile(const Counts &counts, double q)
+{
+	uint64_t total = 0;
+	for (uint64_t count: counts) {
+		total += count;
+	}
+	if (total == 0) {
+		return 0;
+	}
+
+	uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(q * double(total))));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BucketCount; i++) {
+		seen += counts[i];
+		if (seen >= rank) {
+			return bucketValue(i);
+		}
+	}
+
+	return bucketValue(BucketCount - 1);
+}
+
+/*
+ * process wide registry
+ */
+MetricsRegistry &
+MetricsRegistry::shared()
+{
+	static MetricsRegistry registry;
+	return registry;
+}
+
+/*
+ * the counter with this name and labels, created on first use
+ */
+Counter &
+MetricsRegistry::counter(const std::string &name, const std::string &help, const std::string &labels)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	for (auto &metric: this->counters) {
+		if (metric.name == name && metric.labels == labels) {
+			return metric.value;
+		}
+	}
+
+	return this->counters.emplace_back(name, help, labels).value;
+}
+
+/*
+ * the histogram with this name and labels, created on first use; its name
+ * should end in _seconds, since it is exported in seconds
+ */
+Histogram &
+MetricsRegistry::histogram(const std::string &name, const std::string &help, const std::string &labels)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	for (auto &metric: this->histograms) {
+		if (metric.name == name && metric.labels == labels) {
+			return metric.value;
+		}
+	}
+
+	return this->histograms.emplace_back(name, help, labels).value;
+}
+
+/*
+ * every metric in the Prometheus text format; histograms are written as
+ * summaries of a few quantiles, which is all the buckets are needed for
+ */
+void
+MetricsRegistry::write(std::ostream &out)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+
+	writeGrouped(out, this->counters, "counter", [&](Metric<Counter> &metric) {
+		out << series(metric.name, metric.labels) << ' ' << metric.value.get() << '\n';
+	});
+
+	writeGrouped(out, this->histograms, "summary", [&](Metric<Histogram> &metric) {
+		char quantile[32];
+		for (double q: QUANTILES) {
+			std::snprintf(quantile, sizeof(quantile), "quantile=\"%g\"", q);
+			out << series(metric.name, metric.labels, quantile) << ' ' << double(metric.value.quantile(q)) / 1e9
+			    << '\n';
+		}
+		out << series(metric.name + "_sum", metric.labels) << ' ' << double(metric.value.sum()) / 1e9 << '\n';
+		out << series(metric.name + "_count", metric.labels) << ' ' << metric.value.count() << '\n';
+	});
+}
+
+/*
+ * constructor
+ */
+MetricsExporter::MetricsExporter(const std::string &file, const std::string &socket,
+                                 std::chrono::milliseconds interval, MetricsRegistry &registry)
+        : registry(registry), file(file), socket(socket), interval(interval)
+{
+	if (!this->socket.empty()) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_LOCAL;
+		strncpy(addr.sun_path, this->socket.c_str(), sizeof(addr.sun_path) - 1);
+
+		unlink(this->socket.c_str());
+		this->server_fd = ::socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (this->server_fd < 0 || bind(this->server_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+		    ::listen(this->server_fd, 8) < 0) {
+			LOG_ERROR("metrics", "cannot serve metrics", "socket", this->socket, "error", std::strerror(errno));
+			if (this->server_fd >= 0) {
+				close(this->server_fd);
+			}
+			this->server_fd = -1;
+		} else {
+			this->socket_thread = std::thread([this]() { this->socketLoop(); });
+		}
+	}
+
+	if (!this->file.empty()) {
+		this->file_thread = std::thread([this]() { this->fileLoop(); });
+	}
+}
+
+/*
+ * destructor
+ *
+ * writes the file one last time, so it holds the final counts
+ */
+MetricsExporter::~MetricsExporter()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	this->stopping = true;
+	lk.unlock();
+	this->stop_cv.notify_all();
+
+	if (this->file_thread.joinable()) {
+		this->file_thread.join();
+		this->writeFile();
+	}
+
+	if (this->socket_thread.joinable()) {
+		this->socket_thread.join();
+	}
+	if (this->server_fd >= 0) {
+		close(this->server_fd);
+		unlink(this->socket.c_str());
+	}
+}
+
+/*
+ * replace the file with the current metrics; the text is written next to it
+ * and renamed over it, so a reader never sees a partial file
+ */
+void
+MetricsExporter::writeFile()
+{
+	std::string temp = this->file + ".tmp";
+	{
+		std::ofstream out(temp, std::ios_base::trunc);
+		this->registry.write(out);
+		if (!out) {
+			LOG_ERROR("metrics", "cannot write metrics", "path", temp);
+			return;
+		}
+	}
+
+	if (rename(temp.c_str(), this->file.c_str()) < 0) {
+		LOG_ERROR("metrics", "cannot rename metrics file", "path", this->file, "error", std::strerror(errno));
+	}
+}
+
+void
+MetricsExporter::fileLoop()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	while (!this->stop_cv.wait_for(lk, this->interval, [this]() { return this->stopping; })) {
+		lk.unlock();
+		this->writeFile();
+		lk.lock();
+	}
+}
+
+/*
+ * every client that connects is sent the current metrics and disconnected,
+ * so `socat - UNIX-CONNECT:<path>` reads them
+ */
+void
+MetricsExporter::socketLoop()
+{
+	struct pollfd server = {this->server_fd, POLLIN, 0};
+
+	while (true) {
+		std::unique_lock<std::mutex> lk(this->lock);
+		if (this->stopping) {
+			return;
+		}
+		lk.unlock();
+
+		if (poll(&server, 1, POLL_MS) <= 0) {
+			continue;
+		}
+
+		int client = accept4(this->server_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client < 0) {
+			continue;
+		}
+
+		std::ostringstream text;
+		this->registry.write(text);
+		std::string body = text.str();
+
+		size_t sent = 0;
+		while (sent < body.size()) {
+			ssize_t n = send(client, body.data() + sent, body.size() - sent, MSG_NOSIGNAL);
+			if (n <= 0) {
+				break;
+			}
+			sent += size_t(n);
+		}
+		close(client);
+	}
+}
+} // namespace pokezero
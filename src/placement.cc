@@ -0,0 +1,286 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "placement.hh"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include "log.hh"
+
+namespace {
+std::string
+readLine(const std::filesystem::path &path)
+{
+	std::ifstream in(path);
+	std::string line;
+	std::getline(in, line);
+	return line;
+}
+
+/*
+ * cpus this process may run on, which taskset or a cgroup may have narrowed
+ */
+std::vector<int>
+allowedCpus()
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+		return {0};
+	}
+
+	std::vector<int> cpus;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &set)) {
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+/*
+ * NUMA node of each cpu; everything is on node 0 when sysfs does not say
+ */
+std::map<int, int>
+cpuNodes()
+{
+	std::map<int, int> nodes;
+	std::error_code err;
+	for (auto &entry: std::filesystem::directory_iterator("/sys/devices/system/node", err)) {
+		std::string name = entry.path().filename();
+		int node;
+		if (!name.starts_with("node") ||
+		    std::from_chars(name.data() + 4, name.data() + name.size(), node).ec != std::errc()) {
+			continue;
+		}
+
+		for (int cpu: showdown::parseCpuList(readLine(entry.path() / "cpulist"))) {
+			nodes[cpu] = node;
+		}
+	}
+	return nodes;
+}
+
+/*
+ * the cpus sharing cpu's last level cache, as the kernel lists them
+ */
+std::string
+lastCacheCpus(int cpu)
+{
+	std::filesystem::path cache = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache";
+	std::string shared;
+	for (int index = 0;; index++) {
+		std::filesystem::path path = cache / ("index" + std::to_string(index)) / "shared_cpu_list";
+		if (!std::filesystem::exists(path)) {
+			break;
+		}
+		shared = readLine(path);
+	}
+
+	return shared.empty() ? std::to_string(cpu) : shared;
+}
+} // namespace
+
+namespace showdown {
+PlacementPolicy
+parsePlacement(std::string_view name)
+{
+	if (name == "none") {
+		return PLACE_NONE;
+	} else if (name == "numa") {
+		return PLACE_NUMA;
+	} else if (name == "cache") {
+		return PLACE_CACHE;
+	}
+	throw std::invalid_argument("unknown placement " + std::string(name) + ", expected none, numa or cache");
+}
+
+const char *
+placementName(PlacementPolicy policy)
+{
+	switch (policy) {
+	case PLACE_NUMA:
+		return "numa";
+	case PLACE_CACHE:
+		return "cache";
+	default:
+		return "none";
+	}
+}
+
+/*
+ * cpus of a kernel cpu list such as "0-3,8,10-11"
+ */
+std::vector<int>
+parseCpuList(std::string_view list)
+{
+	std::vector<int> cpus;
+	const char *p = list.data(), *end = list.data() + list.size();
+
+	while (p < end) {
+		int first, last;
+		auto [next, err] = std::from_chars(p, end, first);
+		if (err != std::errc()) {
+			break;
+		}
+
+		last = first;
+		if (next < end && *next == '-') {
+			auto [after, range_err] = std::from_chars(next + 1, end, last);
+			if (range_err != std::errc()) {
+				break;
+			}
+			next = after;
+		}
+
+		for (int cpu = first; cpu <= last; cpu++) {
+			cpus.push_back(cpu);
+		}
+		p = next < end && *next == ',' ? next + 1 : end;
+	}
+
+	return cpus;
+}
+
+/*
+ * the allowed cpus split into the policy's domains, in cpu order; PLACE_NONE
+ * gives a single domain of every allowed cpu
+ */
+std::vector<CpuDomain>
+cpuDomains(PlacementPolicy policy)
+{
+	std::map<int, int> nodes = cpuNodes();
+	auto nodeOf = [&nodes](int cpu) { return nodes.contains(cpu) ? nodes[cpu] : 0; };
+
+	// domains by the cpu list or node that identifies them, in order of
+	// their first cpu
+	std::vector<CpuDomain> domains;
+	std::map<std::string, size_t> index;
+
+	for (int cpu: allowedCpus()) {
+		std::string key;
+		switch (policy) {
+		case PLACE_NONE:
+			break;
+		case PLACE_NUMA:
+			key = std::to_string(nodeOf(cpu));
+			break;
+		case PLACE_CACHE:
+			// a cache shared across nodes is split by node too
+			key = lastCacheCpus(cpu) + '/' + std::to_string(nodeOf(cpu));
+			break;
+		}
+
+		auto [it, added] = index.try_emplace(key, domains.size());
+		if (added) {
+			domains.push_back({nodeOf(cpu), {}});
+		}
+		domains[it->second].cpus.push_back(cpu);
+	}
+
+	return domains;
+}
+
+/*
+ * restrict the calling thread to the cpus; an empty list leaves it alone
+ */
+bool
+pinThread(const std::vector<int> &cpus)
+{
+	if (cpus.empty()) {
+		return true;
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu: cpus) {
+		CPU_SET(cpu, &set);
+	}
+
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err != 0) {
+		LOG_WARN("placement", "could not pin thread", "cpus", cpus.size(), "error", std::strerror(err));
+		return false;
+	}
+	return true;
+}
+
+/*
+ * constructor
+ *
+ * PLACE_NONE hands out the shared executor and leaves everything unpinned
+ */
+Placement::Placement(PlacementPolicy policy) : placement_policy(policy)
+{
+	if (policy == PLACE_NONE) {
+		return;
+	}
+
+	this->cpu_domains = cpuDomains(policy);
+	for (const CpuDomain &domain: this->cpu_domains) {
+		this->executors.push_back(std::make_unique<Executor>(0, domain.cpus));
+	}
+
+	LOG_INFO("placement", "battles pinned", "policy", placementName(policy), "domains",
+	         this->cpu_domains.size());
+}
+
+/*
+ * process wide placement, from the POKEZERO_PLACEMENT environment variable
+ * (none, numa or cache; none by default)
+ */
+Placement &
+Placement::shared()
+{
+	static Placement placement([]() {
+		const char *name = std::getenv("POKEZERO_PLACEMENT");
+		try {
+			return name ? parsePlacement(name) : PLACE_NONE;
+		} catch (std::invalid_argument &e) {
+			LOG_WARN("placement", "ignoring POKEZERO_PLACEMENT", "error", e.what());
+			return PLACE_NONE;
+		}
+	}());
+	return placement;
+}
+
+/*
+ * the slot for a new battle, going round the domains
+ */
+Placement::Slot
+Placement::next()
+{
+	if (this->executors.empty()) {
+		return {Executor::shared(), nullptr};
+	}
+
+	size_t i = this->cursor.fetch_add(1, std::memory_order_relaxed) % this->executors.size();
+	return {*this->executors[i], &this->cpu_domains[i]};
+}
+} // namespace showdown
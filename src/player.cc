@@ -19,16 +19,29 @@
 #include "player.hh"
 
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-#include <condition_variable>
 #include <fstream>
 #include <iostream>
-#include <mutex>
 #include <random>
 #include <stdexcept>
+#include <utility>
 
+#include "alloc_stats.hh"
 #include "common.hh"
+#include "log.hh"
+#include "trace.hh"
+
+namespace {
+std::chrono::nanoseconds
+threadCpuTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+}
+} // namespace
 
 namespace showdown {
 /*
@@ -37,6 +50,9 @@ namespace showdown {
 Player::Player(const std::string &name, const std::string &className)
 {
 	this->className = className;
+	this->decision_seconds = &pokezero::MetricsRegistry::shared().histogram(
+	        "pokezero_decision_seconds", "Time a player takes to decide its own move",
+	        "player=\"" + className + '"');
 
 	validateName(name);
 	this->name = name;
@@ -47,56 +63,288 @@ Player::Player(const std::string &name, const std::string &className)
 	std::ifstream urandom_stream("/dev/urandom", std::ios_base::binary | std::ios_base::in);
 	urandom_stream.read(buffer, sizeof(seed));
 
-	std::mt19937 rand(seed);
+	this->rng.seed(seed);
+
+	this->socket.listen(true);
+}
+
+/*
+ * the request loop as a coroutine on the given executor; the caller keeps
+ * the player alive until the returned task has finished
+ */
+Task<void>
+Player::run(Executor &executor)
+{
+	this->executor = &executor;
+	return this->serve();
+}
+
+/*
+ * receive requests from the node process and answer each with either the
+ * directed move or this player's own decision
+ *
+ * requests are read into the same buffer and decoded without a json
+ * document, so once the buffers have grown the loop does not allocate
+ */
+Task<void>
+Player::serve()
+{
+	// a coroutine waiting on replies must not outlive the loop, however it
+	// ends
+	try {
+		co_await this->socket.acceptAsync(*this->executor);
+
+		while (1) {
+			Socket::RecvStatus status;
+			while ((status = this->socket.pollMessage(this->request)) == Socket::RECV_AGAIN) {
+				TRACE_WAIT_BEGIN(wait);
+				co_await this->executor->readable(this->socket.sockfd);
+				TRACE_WAIT_END("player request wait", wait);
+			}
+
+			if (status == Socket::RECV_CLOSED) {
+				break;
+			}
+
+			{
+				TRACE_SCOPE("Player::decode");
+				ALLOC_SCOPE(ALLOC_PLAYER);
+				this->actions = pokezero::RequestActions::decode(this->request);
+			}
+
+			this->requests_received.fetch_add(1);
+
+			TRACE_WAIT_BEGIN(wait);
+			MoveDirective directive = co_await this->directives.next();
+			TRACE_WAIT_END("player directive wait", wait);
+
+			TRACE_SCOPE("Player::answer");
+			ALLOC_SCOPE(ALLOC_PLAYER);
+			this->socket.sendMessage(this->answer(directive));
+			this->replies_sent.fetch_add(1);
+			this->wakeReplied(false);
+		}
+	} catch (...) {
+		this->wakeReplied(true);
+		throw;
+	}
+
+	this->wakeReplied(true);
+}
+
+/*
+ * suspend until the player has sent count replies in all, or its connection
+ * has closed; only one coroutine may wait at a time
+ */
+bool
+Player::Replied::await_suspend(std::coroutine_handle<> handle)
+{
+	std::lock_guard<std::mutex> lk(this->player.reply_lock);
+	if (this->player.replies_closed || int32_t(this->player.replies_sent.load() - this->count) >= 0) {
+		return false;
+	}
 
-	this->socket.connect(true);
+	this->player.reply_waiter = handle;
+	this->player.reply_target = this->count;
+	return true;
+}
+
+/*
+ * resume the coroutine waiting on replies once it has enough of them, or
+ * for good once the connection has closed
+ */
+void
+Player::wakeReplied(bool closed)
+{
+	std::coroutine_handle<> waiter;
+	{
+		std::lock_guard<std::mutex> lk(this->reply_lock);
+		this->replies_closed = this->replies_closed || closed;
+		if (this->reply_waiter &&
+		    (this->replies_closed || int32_t(this->replies_sent.load() - this->reply_target) >= 0)) {
+			waiter = std::exchange(this->reply_waiter, nullptr);
+		}
+	}
+
+	if (waiter) {
+		this->executor->post(waiter);
+	}
+}
+
+size_t
+Player::randomInt(size_t start, size_t end)
+{
+	std::uniform_int_distribution<size_t> roll(start, end);
+	return roll(this->rng);
+}
+
+/*
+ * build the reply to the current request that picks the given index into its
+ * choices
+ */
+std::string_view
+Player::reply(size_t choice)
+{
+	if (this->actions.command == pokezero::RequestActions::UNKNOWN) {
+		LOG_WARN("player", "unknown request command", "player", this->name);
+	}
+
+	if (!this->policy_recorded) {
+		std::array<float, pokezero::ActionCount> played{};
+		for (size_t a = 0; a < pokezero::ActionCount; a++) {
+			if (this->actions.legal(a) && this->actions.choice[a] == choice) {
+				played[a] = 1;
+				break;
+			}
+		}
+		this->recordPolicy(played);
+	}
+
+	return this->actions.reply(choice, this->reply_buffer);
+}
+
+/*
+ * set the distribution over actions behind the current decision, such as a
+ * search's visit counts, for the trajectory of the battle
+ */
+void
+Player::recordPolicy(const std::array<float, pokezero::ActionCount> &policy)
+{
+	std::lock_guard<std::mutex> lk(this->policy_lock);
+	this->policies[this->answering % LatchedPolicies] = {this->answering, true, this->actions.mask, policy};
+	this->policy_recorded = true;
+}
+
+/*
+ * the policy behind the answer to the directive of the given turn, and the
+ * legal actions of the request it answered; false if it has not been
+ * answered, was answered with a directed reply, or is too old to still be
+ * latched
+ */
+bool
+Player::policyFor(uint32_t turn, std::array<float, pokezero::ActionCount> &policy, uint32_t &mask)
+{
+	std::lock_guard<std::mutex> lk(this->policy_lock);
+	const LatchedPolicy &latched = this->policies[turn % LatchedPolicies];
+	if (!latched.known || latched.turn != turn) {
+		return false;
+	}
+
+	policy = latched.policy;
+	mask = latched.mask;
+	return true;
+}
+
+/*
+ * build the reply to the current request that takes the given action of the
+ * fixed action space
+ */
+std::string_view
+Player::replyAction(size_t action)
+{
+	return this->actions.replyAction(action, this->reply_buffer);
+}
+
+/*
+ * build the reply that picks the request choice matching a showdown choice
+ * string such as "move 2" or "switch 3"
+ *
+ * falls back to this player's own decision if the request does not offer it
+ */
+std::string_view
+Player::replyForChoice(std::string_view choice)
+{
+	size_t action = pokezero::parseChoice(choice);
+	if (this->actions.legal(action)) {
+		std::array<float, pokezero::ActionCount> played{};
+		played[action] = 1;
+		this->recordPolicy(played);
+		return this->replyAction(action);
+	}
+
+	LOG_WARN("player", "choice not offered, deciding own move", "player", this->name, "choice", choice);
+	return this->decideOwnMove();
 }
 
 /*
  * let the controlling thread tell this class to decide its own move or use the given move
  */
 void
-Player::notifyMove(MoveType move_type, const std::string &move)
+Player::notifyMove(MoveType move_type, const std::string &move, uint32_t turn)
 {
 	// TODO ensure move is valid if move_type is DIRECTED?
-	std::unique_lock<std::mutex> lk(this->move_lock);
-	this->move = move;
-	this->move_type = move_type;
-	lk.unlock();
-
-	this->move_cv.notify_one();
+	std::coroutine_handle<> waiter = this->directives.push(MoveDirective(move_type, move, turn));
+	if (waiter) {
+		this->executor->post(waiter);
+	}
 }
 
 /*
  * alias for letting this class make its own move
  */
 void
-Player::notifyOwnMove()
+Player::notifyOwnMove(uint32_t turn)
 {
-	this->notifyMove(MoveType::OWN, "");
+	this->notifyMove(MoveType::OWN, "", turn);
 }
 
-std::string
-Player::waitDirectedMove()
+/*
+ * end the request loop of a battle that is being abandoned, wherever it is
+ * waiting
+ */
+void
+Player::stop()
 {
-	if (this->move_type == WAIT) {
-		std::unique_lock<std::mutex> lk(this->move_lock);
-		while (this->move_type == WAIT) {
-			// std::cout << this->name << " waiting" << std::endl;
-			this->move_cv.wait(lk);
-		}
-		lk.unlock();
+	this->socket.shutdown();
+
+	// a loop waiting for its directive answers into the closed socket
+	if (this->directives.empty()) {
+		this->notifyOwnMove(this->answering);
+	}
+}
+
+/*
+ * answer the current request with a directive that has already arrived
+ */
+std::string_view
+Player::takeMove()
+{
+	if (!this->directives.pop(this->taken)) {
+		throw std::runtime_error("No move directive to take");
+	}
+
+	return this->answer(this->taken);
+}
+
+std::string_view
+Player::answer(const MoveDirective &directive)
+{
+	{
+		// a directed reply leaves no policy behind
+		std::lock_guard<std::mutex> lk(this->policy_lock);
+		this->answering = directive.turn;
+		this->policies[directive.turn % LatchedPolicies] = {directive.turn, false, 0, {}};
+		this->policy_recorded = false;
 	}
 
-	switch (this->move_type) {
-	case OWN:
-		this->move_type = WAIT;
-		return decideOwnMove();
+	switch (directive.type) {
+	case OWN: {
+		// decideOwnMove() never suspends, so it runs on one thread
+		pokezero::ScopedTimer timer(*this->decision_seconds);
+		std::chrono::nanoseconds start = threadCpuTime();
+		std::string_view reply = decideOwnMove();
+		this->cpu_time += threadCpuTime() - start;
+		this->own_decisions++;
+		return reply;
+	}
 	case DIRECTED:
-		this->move_type = WAIT;
-		return this->move;
+		return directive.view();
+	case CHOICE:
+		return this->replyForChoice(directive.view());
 	case WAIT: // shouldn't get here
-		throw std::runtime_error("Shouldn't reach case WAIT in waitDirectedMove");
+		break;
 	}
+
+	throw std::runtime_error("Shouldn't reach case WAIT in answer");
 }
 } // namespace showdown
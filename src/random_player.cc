@@ -18,66 +18,11 @@
 
 #include "random_player.hh"
 
-#include <iostream>
-#include <nlohmann/json.hpp>
-#include <thread>
-
 namespace showdown {
-
-RandomPlayer::~RandomPlayer()
-{
-	for (auto &t: this->threads) {
-		t.join();
-	}
-
-	this->threads.clear();
-}
-
-void
-RandomPlayer::loop()
-{
-	this->threads.push_back(std::thread([this]() {
-		while (1) {
-			std::string message = this->socket.recvMessage();
-
-			if (message.empty()) {
-				return;
-			}
-
-			this->last_request = nlohmann::json::parse(message);
-
-			std::string reply_str = this->waitDirectedMove();
-			this->socket.sendMessage(reply_str);
-		}
-	}));
-}
-
-std::string
+std::string_view
 RandomPlayer::decideOwnMove()
 {
-	std::string command = this->last_request["command"];
-	nlohmann::json reply;
-	reply["type"] = "move";
-
-	if (command == "active") {
-		reply["active"] = this->randomInt(0, this->last_request["choices"].size() - 1);
-	} else if (command == "forceSwitch") {
-		reply["switch"] = this->randomInt(0, this->last_request["choices"].size() - 1);
-	} else if (command == "teamPreview") {
-		reply["teamPreview"] = "default";
-	} else {
-		std::cerr << "Unknown command: " << command << std::endl;
-	}
-
-	// std::cerr << this->last_request.dump() << '\n' << reply.dump() << "\n\n";
-	return reply.dump();
-}
-size_t
-RandomPlayer::randomInt(size_t start, size_t end)
-{
-	std::uniform_int_distribution<size_t> roll(start, end);
-	auto random_roll = std::bind(roll, std::ref(this->rng));
-	return random_roll();
+	size_t choices = this->actions.choice_count;
+	return this->reply(choices > 0 ? this->randomInt(0, choices - 1) : 0);
 }
-
 } // namespace showdown
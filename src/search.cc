@@ -0,0 +1,188 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "search.hh"
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+// how many iterations run between clock reads and early stopping checks
+constexpr uint64_t CHECK_INTERVAL = 16;
+} // namespace
+
+namespace pokezero {
+std::chrono::microseconds
+Deadline::elapsed() const
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - this->start);
+}
+
+std::chrono::microseconds
+Deadline::remaining() const
+{
+	auto left = std::chrono::duration_cast<std::chrono::microseconds>(this->end - clock::now());
+	return std::max(left, std::chrono::microseconds(0));
+}
+
+/*
+ * constructor
+ */
+AnytimeSearch::AnytimeSearch(size_t actions, double exploration)
+{
+	if (actions == 0) {
+		throw std::invalid_argument("AnytimeSearch needs at least one action");
+	}
+
+	this->exploration = exploration;
+	this->action_visits.assign(actions, 0);
+	this->action_totals.assign(actions, 0.0);
+}
+
+/*
+ * sample until the deadline passes, the interrupt predicate fires, or the
+ * most visited action can no longer be overtaken in the time that is left
+ *
+ * the search always returns the current best action, even if it was stopped
+ * before every action was sampled
+ */
+SearchStats
+AnytimeSearch::run(const Deadline &deadline, const Sampler &sample, const Interrupt &interrupt)
+{
+	SearchStats stats;
+	stats.budget = deadline.budget;
+
+	// nothing to decide between
+	if (this->action_visits.size() == 1) {
+		stats.early_stop = true;
+		return stats;
+	}
+
+	uint64_t iterations = 0;
+	while (true) {
+		if (iterations % CHECK_INTERVAL == 0) {
+			if (deadline.expired()) {
+				break;
+			}
+			if (interrupt && interrupt()) {
+				stats.interrupted = true;
+				break;
+			}
+
+			// estimate how many more samples fit in the remaining budget
+			// from the rate so far
+			auto elapsed = deadline.elapsed().count();
+			if (iterations > 0 && elapsed > 0) {
+				double rate = double(iterations) / double(elapsed);
+				if (this->decided(uint64_t(rate * double(deadline.remaining().count())))) {
+					stats.early_stop = true;
+					break;
+				}
+			}
+		}
+
+		size_t action = this->select();
+		double outcome = sample(action);
+
+		this->action_visits[action]++;
+		this->action_totals[action] += outcome;
+		this->total_visits++;
+		iterations++;
+	}
+
+	stats.best = this->best();
+	stats.iterations = iterations;
+	stats.elapsed = deadline.elapsed();
+
+	return stats;
+}
+
+/*
+ * most visited action, ties broken by mean outcome
+ */
+size_t
+AnytimeSearch::best() const
+{
+	size_t best = 0;
+	for (size_t a = 1; a < this->action_visits.size(); a++) {
+		if (this->action_visits[a] > this->action_visits[best] ||
+		    (this->action_visits[a] == this->action_visits[best] && this->mean(a) > this->mean(best))) {
+			best = a;
+		}
+	}
+
+	return best;
+}
+
+double
+AnytimeSearch::mean(size_t action) const
+{
+	if (this->action_visits[action] == 0) {
+		return 0;
+	}
+
+	return this->action_totals[action] / double(this->action_visits[action]);
+}
+
+/*
+ * UCB1; unvisited actions are always tried first
+ */
+size_t
+AnytimeSearch::select() const
+{
+	size_t best = 0;
+	double best_score = -std::numeric_limits<double>::infinity();
+	double log_total = std::log(double(this->total_visits) + 1);
+
+	for (size_t a = 0; a < this->action_visits.size(); a++) {
+		if (this->action_visits[a] == 0) {
+			return a;
+		}
+
+		double n = double(this->action_visits[a]);
+		double score = this->mean(a) + this->exploration * std::sqrt(log_total / n);
+		if (score > best_score) {
+			best_score = score;
+			best = a;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * true if giving every remaining sample to the runner up still could not
+ * change the most visited action
+ */
+bool
+AnytimeSearch::decided(uint64_t remaining) const
+{
+	uint64_t first = 0, second = 0;
+	for (uint64_t v: this->action_visits) {
+		if (v > first) {
+			second = first;
+			first = v;
+		} else if (v > second) {
+			second = v;
+		}
+	}
+
+	return second + remaining < first;
+}
+} // namespace pokezero
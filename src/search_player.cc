@@ -0,0 +1,109 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "search_player.hh"
+
+#include "log.hh"
+
+namespace showdown {
+/*
+ * constructor for derived players that replace the rollout
+ */
+SearchPlayer::SearchPlayer(const std::string &name, const std::string &className, std::chrono::microseconds budget)
+        : Player(name, className)
+{
+	this->budget = budget;
+}
+
+void
+SearchPlayer::observe(const MLVec &vec, size_t side, const std::vector<std::string> &choices, uint32_t turn)
+{
+	this->observed.put(vec, side, choices, turn);
+}
+
+/*
+ * outcome in [-1, 1] of one playout after taking the given choice of the
+ * request; 0 when the state being answered was not observed
+ */
+double
+SearchPlayer::rollout(size_t choice)
+{
+	return this->playout.play(this->choice_actions[choice], rollout_epsilon, this->rng);
+}
+
+/*
+ * search until the budget runs out or the best choice is settled, then answer
+ * with the best choice found so far
+ *
+ * a directed move or choice from the Manager arriving mid search preempts it, so the
+ * Manager is never kept waiting on a search it has already overridden
+ */
+std::string_view
+SearchPlayer::decideOwnMove()
+{
+	using pokezero::RequestActions;
+
+	size_t choices = this->actions.choice_count;
+	if ((this->actions.command != RequestActions::ACTIVE && this->actions.command != RequestActions::FORCE_SWITCH) ||
+	    choices < 2) {
+		return this->reply(0);
+	}
+
+	this->choice_actions.assign(choices, pokezero::NoAction);
+	for (size_t a = 0; a < pokezero::ActionCount; a++) {
+		if (this->actions.legal(a) && this->actions.choice[a] < choices) {
+			this->choice_actions[this->actions.choice[a]] = a;
+		}
+	}
+
+	pokezero::Deadline deadline(this->budget);
+	if (this->observed.take(this->answering, this->vec, this->side, this->choices, this->tables)) {
+		this->playout.prepare(this->vec, this->tables, this->side, this->choices);
+	} else {
+		LOG_DEBUG("search", "state not observed, rollouts are uninformed", "player", this->name);
+		this->playout.reset();
+	}
+
+	pokezero::AnytimeSearch search(choices);
+	this->last_stats = search.run(
+		deadline, [this](size_t choice) { return this->rollout(choice); },
+		[this]() {
+			// a directive for a later request waits for that request
+			Mailbox::Pending next = this->directives.peek();
+			return next.turn == this->answering && (next.type == DIRECTED || next.type == CHOICE);
+		});
+
+	LOG_DEBUG("search", "searched", "player", this->name, "iterations", this->last_stats.iterations, "us",
+	          this->last_stats.elapsed.count(), "budget_us", this->last_stats.budget.count(), "early_stop",
+	          this->last_stats.early_stop);
+
+	if (this->last_stats.interrupted) {
+		return this->takeMove();
+	}
+
+	std::array<float, pokezero::ActionCount> visits{};
+	for (size_t a = 0; a < pokezero::ActionCount; a++) {
+		if (this->actions.legal(a) && this->last_stats.iterations > 0) {
+			visits[a] = float(search.visits(this->actions.choice[a])) / float(this->last_stats.iterations);
+		}
+	}
+	this->recordPolicy(visits);
+
+	return this->reply(this->last_stats.best);
+}
+} // namespace showdown
@@ -16,10 +16,8 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include "showdown.hh"
 
-#include <sys/wait.h>
-#include <unistd.h>
+#include "showdown.hh"
 
 #include <string>
 #include <vector>
@@ -36,87 +34,64 @@ Showdown::Showdown() {}
  */
 Showdown::~Showdown()
 {
-	/* TODO: more error handling? */
-	int stat_loc;
-	if (this->child.pid != 0 && waitpid(this->child.pid, &stat_loc, 0) != this->child.pid) {
-		std::perror("Wait failed for child process");
-	}
+	this->stop();
 }
 
 /*
- * start the node process
+ * start the node process under the supervisor, which captures its output
+ * and calls the exit callback when it ends
  */
 bool
 Showdown::start(const std::string &showdown_script, const std::vector<std::string> &extra_args)
 {
 	this->showdown_script = showdown_script;
-	bool success = true;
 
 	/*
 	 * create vector of arguments with "node", the node script to run, and
 	 * any extra arguments to pass to node
 	 */
-	std::vector<std::string> argv_builder{"node", this->showdown_script};
-	argv_builder.insert(argv_builder.end(), extra_args.begin(), extra_args.end());
-
-	/* build a char ** that execvp() accepts from the vector of arguments */
-	char const **argv = new char const *[argv_builder.size() + 1];
-	for (size_t i = 0; i < argv_builder.size(); ++i) {
-		argv[i] = argv_builder[i].c_str();
-	}
-
-	/* make last element nullptr */
-	argv[argv_builder.size()] = nullptr;
+	std::vector<std::string> argv{"node", this->showdown_script};
+	argv.insert(argv.end(), extra_args.begin(), extra_args.end());
 
-	/*
-	 * parent writes into writepipe[1] and reads from readpipe[0]
-	 * child writes into readpipe[1] and reads from writepipe[0]
-	 */
-	int readpipe[2], writepipe[2];
-	pid_t pid;
+	this->child = Supervisor::shared().spawn(argv, std::move(this->on_exit), this->cpus);
+	return this->child != nullptr;
+}
 
-	if (pipe(readpipe) < 0) {
-		success = false;
-		goto cleanup_readpipe;
+/*
+ * kill the process unless disarm() is called within the timeout
+ */
+void
+Showdown::arm(std::chrono::milliseconds timeout)
+{
+	if (this->child) {
+		Supervisor::shared().arm(*this->child, timeout);
 	}
+}
 
-	if (pipe(writepipe) < 0) {
-		success = false;
-		goto cleanup_writepipe;
+void
+Showdown::disarm()
+{
+	if (this->child) {
+		Supervisor::shared().disarm(*this->child);
 	}
+}
 
-	pid = fork();
-	switch (pid) {
-	case -1: // failed to fork child
-		success = false;
-		goto cleanup_fork;
-	case 0: // child
-		/* dup2(writepipe[0], STDIN_FILENO); */
-		close(writepipe[0]);
-		/* dup2(readpipe[1], STDOUT_FILENO); */
-		close(readpipe[1]);
-
-		if (execvp(argv[0], (char *const *) argv) == -1) {
-			std::perror("Could not execvp");
-		}
+bool
+Showdown::exited()
+{
+	return !this->child || Supervisor::shared().exited(*this->child);
+}
 
-		exit(-1);
-	default: // parent
-		break;
+/*
+ * wait up to the grace period for the process to exit, then terminate it;
+ * the exit callback is not called once this returns
+ */
+void
+Showdown::stop(std::chrono::milliseconds grace)
+{
+	if (this->child) {
+		Supervisor::shared().stop(*this->child, grace);
+		this->child = nullptr;
 	}
-
-	this->child.pid = pid;
-	this->child.readfd = readpipe[0];
-	this->child.writefd = writepipe[1];
-
-cleanup_fork:
-	close(readpipe[0]);
-	close(readpipe[1]);
-cleanup_writepipe:
-	close(writepipe[0]);
-	close(writepipe[1]);
-cleanup_readpipe:
-	delete[] argv;
-	return success;
 }
 } // namespace showdown
@@ -18,10 +18,75 @@
 
 #include "socket_helper.hh"
 
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "alloc_stats.hh"
+#include "log.hh"
+#include "trace.hh"
+
+namespace {
+/*
+ * addresses of a "tcp:host:port" socket name, or null for a Unix socket
+ * path; passive addresses are for listening on
+ */
+struct addrinfo *
+tcpAddresses(const std::string &name, bool passive)
+{
+	if (!name.starts_with("tcp:")) {
+		return nullptr;
+	}
+
+	size_t colon = name.rfind(':');
+	if (colon < 4) {
+		throw std::invalid_argument("tcp socket " + name + " needs a port");
+	}
+
+	std::string host = name.substr(4, colon - 4);
+	std::string port = name.substr(colon + 1);
+	if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+		host = host.substr(1, host.size() - 2);
+	}
+
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+	struct addrinfo *addresses = nullptr;
+	bool any = host.empty() || host == "*";
+	int err = getaddrinfo(any ? nullptr : host.c_str(), port.c_str(), &hints, &addresses);
+	if (err != 0) {
+		throw std::invalid_argument("cannot resolve " + name + ": " + gai_strerror(err));
+	}
+
+	return addresses;
+}
+
+/*
+ * messages are small and answered one at a time, so Nagle's algorithm would
+ * only add latency
+ */
+void
+setNoDelay(int fd)
+{
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+} // namespace
+
 namespace showdown {
 /*
  * create a socket to listen for connections on
@@ -29,6 +94,10 @@ namespace showdown {
 int
 Socket::createSocket(const std::string &socket_name, bool force)
 {
+	if (socket_name.starts_with("tcp:")) {
+		return this->createTcpSocket(socket_name);
+	}
+
 	int err = 0;
 	int server_sockfd;
 
@@ -43,14 +112,14 @@ Socket::createSocket(const std::string &socket_name, bool force)
 
 	server_sockfd = socket(AF_LOCAL, SOCK_STREAM, 0);
 	if (server_sockfd < 0) {
-		perror((socket_name + ": socket error").c_str());
+		LOG_ERROR("socket", "socket failed", "socket", socket_name, "error", std::strerror(errno));
 		err = server_sockfd;
 		goto cleanup_socket;
 	}
 
 	err = bind(server_sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr));
 	if (err) {
-		perror((socket_name + ": bind error").c_str());
+		LOG_ERROR("socket", "bind failed", "socket", socket_name, "error", std::strerror(errno));
 		goto cleanup_bind;
 	}
 
@@ -64,134 +133,407 @@ cleanup_socket:
 }
 
 /*
- * close the server socket if initialized
+ * createSocket() for a tcp address, bound to the first of its addresses
+ * that accepts
+ */
+int
+Socket::createTcpSocket(const std::string &socket_name)
+{
+	struct addrinfo *addresses = tcpAddresses(socket_name, true);
+	int server_sockfd = -1;
+
+	for (struct addrinfo *address = addresses; address != nullptr; address = address->ai_next) {
+		server_sockfd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+		if (server_sockfd < 0) {
+			continue;
+		}
+
+		int one = 1;
+		setsockopt(server_sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(server_sockfd, address->ai_addr, address->ai_addrlen) == 0) {
+			break;
+		}
+
+		close(server_sockfd);
+		server_sockfd = -1;
+	}
+	freeaddrinfo(addresses);
+
+	if (server_sockfd < 0) {
+		LOG_ERROR("socket", "bind failed", "socket", socket_name, "error", std::strerror(errno));
+		return -1;
+	}
+
+	this->tcp = true;
+	this->server_sockfd = server_sockfd;
+	return server_sockfd;
+}
+
+/*
+ * close the server socket if initialized, removing its path
  */
 void
 Socket::closeServer()
 {
+	// a client's socket_name is the server's, which is not its to remove
 	if (this->server_sockfd > -1) {
 		close(this->server_sockfd);
+		if (!this->tcp) {
+			unlink(this->socket_name.c_str());
+		}
 	}
 	this->server_sockfd = -1;
-
-	unlink(this->socket_name.c_str());
 }
 
+/*
+ * create the socket if needed and start listening, so a client can connect
+ * as soon as this returns; backlog is how many clients may wait to be
+ * accepted
+ */
 void
-Socket::connect(bool force)
+Socket::listen(bool force, int backlog)
 {
+	pokezero::MetricsRegistry &metrics = pokezero::MetricsRegistry::shared();
+	std::string label = "socket=\"" + this->socket_name + '"';
+	this->sent_total = &metrics.counter("pokezero_socket_sent_bytes_total", "Bytes sent on a socket", label);
+	this->received_total =
+	        &metrics.counter("pokezero_socket_received_bytes_total", "Bytes received on a socket", label);
+
 	if (this->server_sockfd == -1) {
 		this->createSocket(this->socket_name, force);
 	}
 
-	this->threads.push_back(std::thread([this]() { this->connectHelper(); }));
+	if (::listen(this->server_sockfd, backlog) == -1) {
+		LOG_ERROR("socket", "listen failed", "socket", this->socket_name, "error", std::strerror(errno));
+		return;
+	}
+
+	fcntl(this->server_sockfd, F_SETFL, fcntl(this->server_sockfd, F_GETFL) | O_NONBLOCK);
 }
 
-bool
-Socket::connectHelper()
+/*
+ * accept the single client of this socket without holding a thread while
+ * waiting for it
+ */
+Task<void>
+Socket::acceptAsync(Executor &executor)
 {
-	int err, client_sockfd;
-	struct sockaddr_un client_addr;
-	socklen_t len;
-	std::unique_lock<std::mutex> lk(this->socket_lock, std::defer_lock);
+	while (true) {
+		int client_sockfd = ::accept(this->server_sockfd, nullptr, nullptr);
+		if (client_sockfd >= 0) {
+			this->setClient(client_sockfd);
+			co_return;
+		}
 
-	err = listen(this->server_sockfd, 1);
-	if (err == -1) {
-		perror((this->socket_name + ": listen error").c_str());
-		goto cleanup_listen;
+		if (this->shut) {
+			co_return;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			co_await executor.readable(this->server_sockfd);
+		} else if (errno != EINTR) {
+			LOG_ERROR("socket", "accept failed", "socket", this->socket_name, "error", std::strerror(errno));
+			co_return;
+		}
 	}
+}
 
-	client_sockfd = accept(this->server_sockfd, (struct sockaddr *) &client_addr, &len);
-	if (client_sockfd == -2) {
-		perror((this->socket_name + ": accept error").c_str());
-		goto cleanup_accept;
+/*
+ * wait for the next of many clients of a listening socket and return it as
+ * a connected Socket of its own
+ *
+ * returns null once the socket is shut down
+ */
+std::unique_ptr<Socket>
+Socket::accept()
+{
+	while (true) {
+		int client_sockfd = ::accept4(this->server_sockfd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client_sockfd >= 0) {
+			auto client = std::make_unique<Socket>();
+			client->socket_name = this->socket_name;
+			client->tcp = this->tcp;
+			client->sent_total = this->sent_total;
+			client->received_total = this->received_total;
+			client->setClient(client_sockfd);
+			return client;
+		}
+
+		if (this->shut) {
+			return nullptr;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			struct pollfd server = {this->server_sockfd, POLLIN, 0};
+			poll(&server, 1, -1);
+		} else if (errno != EINTR) {
+			LOG_ERROR("socket", "accept failed", "socket", this->socket_name, "error", std::strerror(errno));
+			return nullptr;
+		}
+	}
+}
+
+/*
+ * connect to a listening socket as its client, so this end sends and
+ * receives messages like one that accepted
+ */
+bool
+Socket::connect(const std::string &address)
+{
+	this->socket_name = address;
+	int client_sockfd = -1;
+
+	if (struct addrinfo *addresses = tcpAddresses(address, false)) {
+		for (struct addrinfo *a = addresses; a != nullptr; a = a->ai_next) {
+			client_sockfd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+			if (client_sockfd >= 0 && ::connect(client_sockfd, a->ai_addr, a->ai_addrlen) == 0) {
+				break;
+			}
+			if (client_sockfd >= 0) {
+				close(client_sockfd);
+				client_sockfd = -1;
+			}
+		}
+		freeaddrinfo(addresses);
+		this->tcp = true;
+	} else {
+		struct sockaddr_un server_addr = {};
+		server_addr.sun_family = AF_LOCAL;
+		strncpy(server_addr.sun_path, address.c_str(), sizeof(server_addr.sun_path) - 1);
+
+		client_sockfd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (client_sockfd >= 0 &&
+		    ::connect(client_sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+			close(client_sockfd);
+			client_sockfd = -1;
+		}
 	}
 
-	err = getsockname(client_sockfd, (struct sockaddr *) &client_addr, &len);
-	if (err == -1) {
-		perror("getsockname error");
-		goto cleanup_getsockname;
+	if (client_sockfd < 0) {
+		LOG_ERROR("socket", "connect failed", "socket", address, "error", std::strerror(errno));
+		return false;
 	}
 
-	lk.lock();
+	this->setClient(client_sockfd);
+	return true;
+}
+
+void
+Socket::setClient(int client_sockfd)
+{
+	if (this->tcp) {
+		setNoDelay(client_sockfd);
+	}
+
+	std::unique_lock<std::mutex> lk(this->socket_lock);
 	this->sockfd = client_sockfd;
+	if (this->shut) {
+		::shutdown(client_sockfd, SHUT_RDWR);
+	}
 	lk.unlock();
-	this->socket_ready.notify_one();
+	this->socket_ready.notify_all();
+}
 
-	return true;
+/*
+ * take the next full message without blocking
+ *
+ * bytes after the message are kept for the next call, and message keeps its
+ * capacity between calls, so a steady stream of requests does not allocate;
+ * returns RECV_AGAIN when the socket has nothing more to read yet and
+ * RECV_CLOSED once the client closes the connection
+ */
+Socket::RecvStatus
+Socket::pollMessage(std::string &message)
+{
+	TRACE_SCOPE("Socket::pollMessage");
+	ALLOC_SCOPE(ALLOC_SOCKET);
+	char buf[RECV_BUFSIZE];
+
+	while (this->sockfd >= 0) {
+		size_t msg_end = this->pending.find('\0');
+		if (msg_end != std::string::npos) {
+			message.assign(this->pending, 0, msg_end);
+			this->pending.erase(0, msg_end + 1);
+			return RECV_MESSAGE;
+		}
 
-cleanup_getsockname:
-	close(client_sockfd);
-cleanup_accept:
-cleanup_listen:
-	return false;
+		ssize_t bytes_read = recv(this->sockfd, buf, RECV_BUFSIZE, MSG_DONTWAIT);
+		if (bytes_read > 0) {
+			this->countReceived(bytes_read);
+			this->pending.append(buf, bytes_read);
+		} else if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return RECV_AGAIN;
+		} else if (bytes_read == 0 || errno != EINTR) {
+			if (bytes_read < 0) {
+				LOG_ERROR("socket", "recv failed", "socket", this->socket_name, "error",
+				          std::strerror(errno));
+			}
+			break;
+		}
+	}
+
+	closeClient();
+	message.clear();
+	return RECV_CLOSED;
 }
 
 /*
- * read from socket into a stringstream until a null byte is found,
- * then return a string up until the message
+ * recvMessage() that suspends instead of blocking while no full message has
+ * arrived
  *
- * the leftover bytes read (if any) are left in the recv_stream for the
- * next call to recvMessage()
+ * returns "" once the client closes the connection
+ */
+Task<std::string>
+Socket::recvMessageAsync(Executor &executor)
+{
+	std::string message;
+	while (this->pollMessage(message) == RECV_AGAIN) {
+		TRACE_WAIT_BEGIN(wait);
+		co_await executor.readable(this->sockfd);
+		TRACE_WAIT_END("socket wait", wait);
+	}
+
+	co_return message;
+}
+
+/*
+ * block until the next full message arrives
+ *
+ * bytes read past it are kept for the next call; returns "" once the client
+ * closes the connection
  */
 std::string
 Socket::recvMessage()
 {
+	TRACE_SCOPE("Socket::recvMessage");
+	ALLOC_SCOPE(ALLOC_SOCKET);
+
 	if (this->sockfd < 0) {
 		std::unique_lock<std::mutex> lk(this->socket_lock);
-		while (this->sockfd < 0) {
+		while (this->sockfd < 0 && !this->shut) {
 			this->socket_ready.wait(lk);
 		}
 		lk.unlock();
 	}
 
-	char buf[RECV_BUFSIZE];
-	ssize_t bytes_read;
-	size_t message_len = 0;
+	std::string message;
+	while (this->pollMessage(message) == RECV_AGAIN) {
+		this->waitReadable();
+	}
 
-	while ((bytes_read = recv(this->sockfd, buf, RECV_BUFSIZE, 0)) > 0) {
-		recv_stream << std::string_view(buf, bytes_read);
-		size_t msg_end = std::string_view(buf, bytes_read).find('\0');
-		if (msg_end != std::string::npos) {
-			message_len += msg_end;
-			std::string message(message_len, '\0');
-			recv_stream.read(&message[0], message_len);
-			recv_stream.seekg(1, std::ios_base::cur);
+	return message;
+}
 
-			return message;
+/*
+ * block until n more bytes have arrived, such as a payload sent after a
+ * message, and take them; false if the connection closes first
+ */
+bool
+Socket::recvBytes(std::string &bytes, size_t n)
+{
+	ALLOC_SCOPE(ALLOC_SOCKET);
+
+	while (this->pending.size() < n && this->sockfd >= 0) {
+		// read straight into the buffer, since payloads can be large
+		size_t have = this->pending.size();
+		this->pending.resize(std::max(n, have + RECV_BUFSIZE));
+		ssize_t bytes_read = recv(this->sockfd, this->pending.data() + have, this->pending.size() - have, MSG_DONTWAIT);
+		this->pending.resize(have + size_t(std::max<ssize_t>(bytes_read, 0)));
+
+		if (bytes_read > 0) {
+			this->countReceived(bytes_read);
+		} else if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			this->waitReadable();
+		} else if (bytes_read == 0 || errno != EINTR) {
+			this->closeClient();
 		}
-		message_len += bytes_read;
 	}
 
-	if (bytes_read < 0) {
-		// TODO: handle error better?
-		perror("client socket recv error");
+	if (this->pending.size() < n) {
+		return false;
 	}
 
-	// only get here on recv error or close
-	closeClient();
-	return "";
+	bytes.assign(this->pending, 0, n);
+	this->pending.erase(0, n);
+	return true;
+}
+
+/*
+ * block until the client socket is readable or closed
+ */
+bool
+Socket::waitReadable()
+{
+	struct pollfd client = {this->sockfd, POLLIN, 0};
+	return poll(&client, 1, -1) > 0;
 }
 
+/*
+ * send the message followed by its terminating null byte, then the payload
+ * if there is one, in as few calls as the socket takes
+ */
 // TODO: handle error better
 void
-Socket::sendMessage(const std::string &msg)
+Socket::sendMessage(std::string_view msg, std::string_view payload)
 {
+	TRACE_SCOPE("Socket::sendMessage");
+	ALLOC_SCOPE(ALLOC_SOCKET);
+
 	if (this->sockfd < 0) {
 		std::unique_lock<std::mutex> lk(this->socket_lock);
-		while (this->sockfd < 0) {
+		while (this->sockfd < 0 && !this->shut) {
 			this->socket_ready.wait(lk);
 		}
 		lk.unlock();
 	}
 
-	ssize_t bytes_sent;
-	bytes_sent = send(this->sockfd, msg.c_str(), msg.length() + 1, 0);
-	if (bytes_sent == -1) {
-		// TODO: handle better
-		perror("error send");
+	if (this->sockfd < 0) {
 		return;
 	}
+
+	char terminator = '\0';
+	struct iovec parts[3] = {{const_cast<char *>(msg.data()), msg.size()},
+	                         {&terminator, 1},
+	                         {const_cast<char *>(payload.data()), payload.size()}};
+	struct msghdr header = {};
+	header.msg_iov = parts;
+	header.msg_iovlen = payload.empty() ? 2 : 3;
+
+	size_t remaining = msg.size() + 1 + payload.size();
+	while (remaining > 0) {
+		ssize_t bytes_sent = sendmsg(this->sockfd, &header, MSG_NOSIGNAL);
+		if (bytes_sent == -1 && errno == EINTR) {
+			continue;
+		} else if (bytes_sent == -1) {
+			// TODO: handle better
+			if (this->shut) {
+				return;
+			}
+			LOG_ERROR("socket", "send failed", "socket", this->socket_name, "error", std::strerror(errno));
+			return;
+		}
+
+		if (this->sent_total != nullptr) {
+			this->sent_total->add(size_t(bytes_sent));
+		}
+
+		// a large payload can go out in pieces
+		remaining -= size_t(bytes_sent);
+		for (size_t sent = size_t(bytes_sent); sent > 0;) {
+			size_t part = std::min(sent, header.msg_iov->iov_len);
+			header.msg_iov->iov_base = static_cast<char *>(header.msg_iov->iov_base) + part;
+			header.msg_iov->iov_len -= part;
+			sent -= part;
+			if (header.msg_iov->iov_len == 0) {
+				header.msg_iov++;
+				header.msg_iovlen--;
+			}
+		}
+	}
+}
+
+void
+Socket::countReceived(size_t bytes)
+{
+	if (this->received_total != nullptr) {
+		this->received_total->add(bytes);
+	}
 }
 
 void
@@ -205,15 +547,33 @@ Socket::closeClient()
 }
 
 /*
- * destructor
+ * wake everything waiting on the socket for good: reads see the connection
+ * closed, sends fail quietly and a pending accept returns without a client
+ *
+ * used when the other end is gone or a battle is abandoned; safe to call
+ * from any thread
  */
-Socket::~Socket()
+void
+Socket::shutdown()
 {
-	for (auto &t: this->threads) {
-		t.join();
+	std::unique_lock<std::mutex> lk(this->socket_lock);
+	this->shut = true;
+	if (this->server_sockfd > -1) {
+		::shutdown(this->server_sockfd, SHUT_RDWR);
 	}
-	this->threads.clear();
+	if (this->sockfd > -1) {
+		::shutdown(this->sockfd, SHUT_RDWR);
+	}
+	lk.unlock();
 
+	this->socket_ready.notify_all();
+}
+
+/*
+ * destructor
+ */
+Socket::~Socket()
+{
 	closeClient();
 
 	this->closeServer();
@@ -0,0 +1,489 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "supervisor.hh"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+
+#include "log.hh"
+
+namespace {
+// how often exits are checked for when no output arrives
+constexpr auto REAP_INTERVAL = std::chrono::milliseconds(50);
+
+// longest output line kept before it is logged in pieces
+constexpr size_t MAX_LINE = 1 << 16;
+
+// time a child gets to exit after SIGTERM before it is killed
+constexpr auto TERM_GRACE = std::chrono::seconds(1);
+} // namespace
+
+namespace showdown {
+struct Supervisor::Child {
+	pid_t pid = 0;
+
+	// read ends of the child's stdout and stderr, -1 once closed
+	int out_fd = -1;
+	int err_fd = -1;
+	std::string out_line;
+	std::string err_line;
+
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+	bool exited = false;
+	bool stopping = false; // stop() was called, so the exit is expected
+	bool hung = false;
+	int status = 0;
+
+	// held while the exit callback runs, so stop() can clear it safely
+	std::mutex callback_lock;
+	std::function<void()> on_exit;
+};
+
+/*
+ * constructor
+ */
+Supervisor::Supervisor()
+{
+	this->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (this->wake_fd < 0) {
+		throw std::system_error(errno, std::generic_category(), "supervisor eventfd");
+	}
+
+	this->thread = std::thread([this]() { this->run(); });
+}
+
+/*
+ * destructor
+ *
+ * children still running are killed, so none outlive the process
+ */
+Supervisor::~Supervisor()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	this->stopping = true;
+	for (auto &child: this->children) {
+		if (!child->exited) {
+			kill(child->pid, SIGKILL);
+		}
+	}
+	lk.unlock();
+
+	this->wake();
+	this->thread.join();
+	close(this->wake_fd);
+}
+
+/*
+ * process wide supervisor, started on first use
+ */
+Supervisor &
+Supervisor::shared()
+{
+	static Supervisor supervisor;
+	return supervisor;
+}
+
+/*
+ * start a process with its stdin on /dev/null and its output captured;
+ * on_exit is called from the supervisor thread once it has exited for any
+ * reason. A nonempty cpus pins the process to them before it execs.
+ *
+ * returns null if the process could not be started
+ */
+std::shared_ptr<Supervisor::Child>
+Supervisor::spawn(const std::vector<std::string> &args, std::function<void()> on_exit, const std::vector<int> &cpus)
+{
+	// built before forking, since the child may only make async signal safe
+	// calls until it execs
+	std::vector<char *> argv;
+	for (const std::string &arg: args) {
+		argv.push_back(const_cast<char *>(arg.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	for (int cpu: cpus) {
+		CPU_SET(cpu, &cpu_set);
+	}
+
+	int out[2], err[2];
+	if (pipe2(out, O_CLOEXEC) < 0) {
+		LOG_ERROR("supervisor", "pipe failed", "error", std::strerror(errno));
+		return nullptr;
+	}
+	if (pipe2(err, O_CLOEXEC) < 0) {
+		LOG_ERROR("supervisor", "pipe failed", "error", std::strerror(errno));
+		close(out[0]);
+		close(out[1]);
+		return nullptr;
+	}
+	int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		// the logger's writer thread does not exist in the child
+		if (null_fd >= 0) {
+			dup2(null_fd, STDIN_FILENO);
+		}
+		dup2(out[1], STDOUT_FILENO);
+		dup2(err[1], STDERR_FILENO);
+		if (!cpus.empty() && sched_setaffinity(0, sizeof(cpu_set), &cpu_set) < 0) {
+			std::perror("Could not pin simulator");
+		}
+		execvp(argv[0], argv.data());
+		std::perror("Could not execvp");
+		_exit(127);
+	}
+
+	close(out[1]);
+	close(err[1]);
+	if (null_fd >= 0) {
+		close(null_fd);
+	}
+
+	if (pid < 0) {
+		LOG_ERROR("supervisor", "fork failed", "error", std::strerror(errno));
+		close(out[0]);
+		close(err[0]);
+		return nullptr;
+	}
+
+	auto child = std::make_shared<Child>();
+	child->pid = pid;
+	child->out_fd = out[0];
+	child->err_fd = err[0];
+	child->on_exit = std::move(on_exit);
+	fcntl(child->out_fd, F_SETFL, fcntl(child->out_fd, F_GETFL) | O_NONBLOCK);
+	fcntl(child->err_fd, F_SETFL, fcntl(child->err_fd, F_GETFL) | O_NONBLOCK);
+
+	std::unique_lock<std::mutex> lk(this->lock);
+	this->children.push_back(child);
+	lk.unlock();
+
+	this->spawned.add();
+	this->wake();
+	LOG_INFO("supervisor", "simulator started", "pid", pid, "command", args.at(0));
+
+	return child;
+}
+
+/*
+ * kill the child unless disarm() is called within the timeout
+ */
+void
+Supervisor::arm(Child &child, std::chrono::milliseconds timeout)
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	child.deadline = std::chrono::steady_clock::now() + timeout;
+	lk.unlock();
+
+	this->wake();
+}
+
+void
+Supervisor::disarm(Child &child)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	child.deadline = std::chrono::steady_clock::time_point::max();
+}
+
+bool
+Supervisor::exited(Child &child)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	return child.exited;
+}
+
+/*
+ * wait up to the timeout for the child to exit, returning whether it has
+ */
+bool
+Supervisor::wait(Child &child, std::chrono::milliseconds timeout)
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	return this->exit_cv.wait_for(lk, timeout, [&child]() { return child.exited; });
+}
+
+/*
+ * give the child `grace` to exit on its own, then SIGTERM and finally
+ * SIGKILL it; its exit callback is dropped first, so it is not called
+ * after this returns
+ */
+void
+Supervisor::stop(Child &child, std::chrono::milliseconds grace)
+{
+	std::unique_lock<std::mutex> callback_lk(child.callback_lock);
+	child.on_exit = nullptr;
+	callback_lk.unlock();
+
+	std::unique_lock<std::mutex> lk(this->lock);
+	child.stopping = true;
+	lk.unlock();
+
+	for (int signal: {SIGTERM, SIGKILL}) {
+		if (this->wait(child, signal == SIGTERM ? grace : TERM_GRACE)) {
+			return;
+		}
+
+		lk.lock();
+		if (!child.exited) {
+			LOG_WARN("supervisor", "simulator did not exit, signalling", "pid", child.pid, "signal", signal);
+			kill(child.pid, signal);
+		}
+		lk.unlock();
+	}
+
+	// SIGKILL cannot be ignored, so this only waits for the reaper
+	std::unique_lock<std::mutex> wait_lk(this->lock);
+	this->exit_cv.wait(wait_lk, [&child]() { return child.exited; });
+}
+
+/*
+ * a battle was restarted on a new child after its first one failed
+ */
+void
+Supervisor::countRestart()
+{
+	this->restarts.add();
+}
+
+SupervisorStats
+Supervisor::stats()
+{
+	SupervisorStats stats;
+	stats.spawned = this->spawned.get();
+	stats.crashed = this->crashed.get();
+	stats.hung = this->hung.get();
+	stats.restarts = this->restarts.get();
+
+	std::lock_guard<std::mutex> lk(this->lock);
+	stats.running = this->children.size();
+
+	return stats;
+}
+
+void
+Supervisor::wake()
+{
+	uint64_t one = 1;
+	if (write(this->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		LOG_ERROR("supervisor", "wake failed", "error", std::strerror(errno));
+	}
+}
+
+void
+Supervisor::run()
+{
+	while (true) {
+		std::vector<struct pollfd> fds = {{this->wake_fd, POLLIN, 0}};
+		std::vector<std::pair<std::shared_ptr<Child>, bool>> owners = {{nullptr, false}};
+		auto timeout = REAP_INTERVAL;
+
+		std::unique_lock<std::mutex> lk(this->lock);
+		if (this->stopping && this->children.empty()) {
+			return;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		for (auto &child: this->children) {
+			for (bool err: {false, true}) {
+				int fd = err ? child->err_fd : child->out_fd;
+				if (fd >= 0) {
+					fds.push_back({fd, POLLIN, 0});
+					owners.emplace_back(child, err);
+				}
+			}
+
+			if (child->deadline != std::chrono::steady_clock::time_point::max()) {
+				auto left = std::chrono::duration_cast<std::chrono::milliseconds>(child->deadline - now);
+				timeout = std::clamp(left, std::chrono::milliseconds(0), timeout);
+			}
+		}
+		lk.unlock();
+
+		if (poll(fds.data(), fds.size(), int(timeout.count())) < 0 && errno != EINTR) {
+			LOG_ERROR("supervisor", "poll failed", "error", std::strerror(errno));
+		}
+
+		uint64_t wakes;
+		if (fds[0].revents & POLLIN && read(this->wake_fd, &wakes, sizeof(wakes)) < 0) {
+			LOG_ERROR("supervisor", "wake read failed", "error", std::strerror(errno));
+		}
+
+		for (size_t i = 1; i < fds.size(); i++) {
+			if (fds[i].revents != 0) {
+				this->drainOutput(*owners[i].first, owners[i].second);
+			}
+		}
+
+		this->expire();
+		this->reap();
+	}
+}
+
+/*
+ * log every complete line waiting on one of the child's pipes, closing it
+ * at end of file
+ */
+void
+Supervisor::drainOutput(Child &child, bool err)
+{
+	int &fd = err ? child.err_fd : child.out_fd;
+	std::string &line = err ? child.err_line : child.out_line;
+	char buf[4096];
+
+	auto emit = [&](std::string_view text) {
+		if (err) {
+			LOG_WARN("node", "output", "pid", child.pid, "stream", "stderr", "line", text);
+		} else {
+			LOG_INFO("node", "output", "pid", child.pid, "stream", "stdout", "line", text);
+		}
+	};
+
+	while (fd >= 0) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0 && errno == EAGAIN) {
+			return;
+		}
+
+		if (n <= 0) {
+			if (!line.empty()) {
+				emit(line);
+				line.clear();
+			}
+
+			// only this thread reads or closes the descriptors
+			std::lock_guard<std::mutex> lk(this->lock);
+			close(fd);
+			fd = -1;
+			return;
+		}
+
+		line.append(buf, size_t(n));
+		size_t start = 0, end;
+		while ((end = line.find('\n', start)) != std::string::npos) {
+			emit(std::string_view(line).substr(start, end - start));
+			start = end + 1;
+		}
+		line.erase(0, start);
+
+		if (line.size() > MAX_LINE) {
+			emit(line);
+			line.clear();
+		}
+	}
+}
+
+/*
+ * kill children past their deadline
+ */
+void
+Supervisor::expire()
+{
+	auto now = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> lk(this->lock);
+	for (auto &child: this->children) {
+		if (!child->exited && !child->hung && now >= child->deadline) {
+			child->hung = true;
+			this->hung.add();
+			LOG_ERROR("supervisor", "simulator missed its request deadline, killing", "pid", child->pid);
+			kill(child->pid, SIGKILL);
+		}
+	}
+}
+
+/*
+ * collect children that have exited: drain what they wrote last, log how
+ * they ended, forget them and call their exit callbacks
+ */
+void
+Supervisor::reap()
+{
+	struct Exit {
+		std::shared_ptr<Child> child;
+		int status;
+		bool stopping;
+	};
+	std::vector<Exit> exited;
+
+	std::unique_lock<std::mutex> lk(this->lock);
+	for (auto &child: this->children) {
+		int status;
+		if (waitpid(child->pid, &status, WNOHANG) == child->pid) {
+			// marked at once, so nothing signals a pid that may be reused
+			child->exited = true;
+			child->status = status;
+			exited.push_back({child, status, child->stopping});
+		}
+	}
+	lk.unlock();
+
+	if (exited.empty()) {
+		return;
+	}
+	this->exit_cv.notify_all();
+
+	for (auto &[child, status, stopping]: exited) {
+		this->drainOutput(*child, false);
+		this->drainOutput(*child, true);
+
+		bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+		int signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+		if (child->hung || (stopping && (clean || signal == SIGTERM || signal == SIGKILL))) {
+			LOG_INFO("supervisor", "simulator stopped", "pid", child->pid, "code", code, "signal", signal);
+		} else if (!clean) {
+			this->crashed.add();
+			LOG_ERROR("supervisor", "simulator crashed", "pid", child->pid, "code", code, "signal", signal);
+		} else {
+			LOG_INFO("supervisor", "simulator exited", "pid", child->pid);
+		}
+	}
+
+	lk.lock();
+	for (auto &exit: exited) {
+		std::erase(this->children, exit.child);
+	}
+	lk.unlock();
+
+	for (auto &exit: exited) {
+		std::lock_guard<std::mutex> callback_lk(exit.child->callback_lock);
+		if (exit.child->on_exit) {
+			exit.child->on_exit();
+		}
+	}
+}
+} // namespace showdown
@@ -0,0 +1,386 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tournament.hh"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "arena.hh"
+#include "heuristic_player.hh"
+#include "random_player.hh"
+#include "search_player.hh"
+
+namespace {
+using pokezero::BattleResult;
+using pokezero::PairingResult;
+
+// one battle between two entrants, the first as p1
+typedef BattleResult (*BattleFn)(const std::string &, showdown::Placement::Slot);
+
+/*
+ * the endgame solver is off, so every decision is the entrant's own and
+ * its whole cost is in the entrant's cpu time
+ */
+template <class P1, class P2>
+BattleResult
+battle(const std::string &name, showdown::Placement::Slot slot)
+{
+	pokezero::EndgameConfig endgame;
+	endgame.threshold = 0;
+	return pokezero::playBattle<P1, P2>(nullptr, name, slot, endgame);
+}
+
+/*
+ * table of battles between every ordered pair of player types, so entrants
+ * chosen at run time still play through Manager<P1, P2>
+ */
+template <class... Ps>
+struct Roster {
+	static constexpr size_t size = sizeof...(Ps);
+
+	template <class P1>
+	static constexpr std::array<BattleFn, size> row()
+	{
+		return {battle<P1, Ps>...};
+	}
+
+	static constexpr std::array<std::array<BattleFn, size>, size> table() { return {row<Ps>()...}; }
+};
+
+// the first entrant anchors the ratings at 0
+typedef Roster<showdown::RandomPlayer, showdown::HeuristicPlayer, showdown::BudgetSearchPlayer<10>,
+               showdown::BudgetSearchPlayer<50>, showdown::BudgetSearchPlayer<200>>
+        Entrants;
+
+constexpr std::array<std::array<BattleFn, Entrants::size>, Entrants::size> BATTLES = Entrants::table();
+
+// pseudo games, drawn, added to every pairing so ratings stay finite when one
+// side wins every game
+constexpr double PRIOR_DRAWS = 1.0;
+
+// rounds of the rating fit
+constexpr int FIT_ITERATIONS = 500;
+
+/*
+ * pairings resampled game by game with replacement
+ */
+std::vector<PairingResult>
+resample(const std::vector<PairingResult> &pairings, std::mt19937_64 &rng)
+{
+	std::vector<PairingResult> out;
+	for (const PairingResult &p: pairings) {
+		PairingResult r{p.first, p.second};
+		uint64_t games = p.wins + p.ties + p.losses;
+		std::uniform_int_distribution<uint64_t> pick(0, games > 0 ? games - 1 : 0);
+		for (uint64_t g = 0; g < games; g++) {
+			uint64_t x = pick(rng);
+			if (x < p.wins) {
+				r.wins++;
+			} else if (x < p.wins + p.ties) {
+				r.ties++;
+			} else {
+				r.losses++;
+			}
+		}
+		out.push_back(r);
+	}
+	return out;
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * names of the player types a tournament can enter, in rating anchor order
+ */
+const std::vector<std::string> &
+entrantNames()
+{
+	static const std::vector<std::string> names = {"random", "heuristic", "search10ms", "search50ms",
+	                                               "search200ms"};
+	static_assert(Entrants::size == 5, "every entrant needs a name");
+	return names;
+}
+
+/*
+ * Elo ratings of n entrants from their pairings, the first entrant at 0
+ *
+ * a Bradley-Terry fit by minorization-maximization, with ties as half a win
+ * each and PRIOR_DRAWS drawn games added to every pairing
+ */
+std::vector<double>
+fitElo(size_t n, const std::vector<PairingResult> &pairings)
+{
+	std::vector<double> gamma(n, 1.0), wins(n, 0.0);
+	for (const PairingResult &p: pairings) {
+		wins[p.first] += double(p.wins) + 0.5 * (double(p.ties) + PRIOR_DRAWS);
+		wins[p.second] += double(p.losses) + 0.5 * (double(p.ties) + PRIOR_DRAWS);
+	}
+
+	for (int iteration = 0; iteration < FIT_ITERATIONS; iteration++) {
+		std::vector<double> denominator(n, 0.0);
+		for (const PairingResult &p: pairings) {
+			double games = double(p.wins + p.ties + p.losses) + PRIOR_DRAWS;
+			double d = games / (gamma[p.first] + gamma[p.second]);
+			denominator[p.first] += d;
+			denominator[p.second] += d;
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			if (denominator[i] > 0) {
+				gamma[i] = wins[i] / denominator[i];
+			}
+		}
+		double anchor = gamma[0];
+		for (double &g: gamma) {
+			g /= anchor;
+		}
+	}
+
+	std::vector<double> elo(n);
+	for (size_t i = 0; i < n; i++) {
+		elo[i] = 400.0 * std::log10(gamma[i]);
+	}
+	return elo;
+}
+
+/*
+ * play every pairing of the entrants and rate them
+ *
+ * games are handed out pairing by pairing within each round, so a pool of
+ * threads works through all the pairings evenly; every thread takes one
+ * placement slot and pins itself to it, like benchPlacement
+ */
+TournamentResult
+runTournament(const TournamentConfig &config)
+{
+	const std::vector<std::string> &names = entrantNames();
+
+	std::vector<size_t> entrants;
+	for (const std::string &name: config.entrants) {
+		auto it = std::find(names.begin(), names.end(), name);
+		if (it == names.end()) {
+			throw std::invalid_argument("unknown entrant " + name);
+		}
+		entrants.push_back(size_t(it - names.begin()));
+	}
+	if (entrants.empty()) {
+		for (size_t i = 0; i < names.size(); i++) {
+			entrants.push_back(i);
+		}
+	}
+	if (entrants.size() < 2) {
+		throw std::invalid_argument("a tournament needs two entrants");
+	}
+
+	TournamentResult result;
+	for (size_t e: entrants) {
+		result.entrants.push_back(EntrantResult{names[e]});
+	}
+	for (size_t i = 0; i < entrants.size(); i++) {
+		for (size_t j = i + 1; j < entrants.size(); j++) {
+			result.pairings.push_back(PairingResult{i, j});
+		}
+	}
+
+	// game g of every pairing before game g + 1 of any
+	size_t games = config.games * result.pairings.size();
+	std::atomic<size_t> next{0};
+	std::mutex lock;
+
+	size_t concurrency = config.concurrency;
+	if (concurrency == 0) {
+		concurrency = std::max(1u, std::thread::hardware_concurrency() / 2);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < concurrency; t++) {
+		threads.emplace_back([&, t]() {
+			showdown::Placement::Slot slot = showdown::Placement::shared().next();
+			showdown::pinThread(slot.cpus());
+
+			std::string name = "t" + std::to_string(getpid()) + "s" + std::to_string(t);
+			for (size_t game = next++; game < games; game = next++) {
+				PairingResult &pairing = result.pairings[game % result.pairings.size()];
+				bool swapped = game / result.pairings.size() % 2 == 1;
+
+				// p1 and p2 as indices into the tournament's entrants
+				size_t side[2] = {pairing.first, pairing.second};
+				if (swapped) {
+					std::swap(side[0], side[1]);
+				}
+				BattleResult battle = BATTLES[entrants[side[0]]][entrants[side[1]]](name, slot);
+
+				std::lock_guard<std::mutex> lk(lock);
+				if (battle.aborted) {
+					result.aborted++;
+					continue;
+				}
+
+				for (size_t s = 0; s < 2; s++) {
+					EntrantResult &entrant = result.entrants[side[s]];
+					entrant.games++;
+					entrant.cpu += battle.cpu[s];
+					entrant.decisions += battle.decisions[s];
+					entrant.score += battle.winner < 0 ? 0.5 : battle.winner == int(s) ? 1.0 : 0.0;
+				}
+
+				if (battle.winner < 0) {
+					pairing.ties++;
+				} else if ((battle.winner == 0) != swapped) {
+					pairing.wins++;
+				} else {
+					pairing.losses++;
+				}
+			}
+		});
+	}
+	for (auto &thread: threads) {
+		thread.join();
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t n = result.entrants.size();
+	std::vector<double> elo = fitElo(n, result.pairings);
+
+	std::vector<std::vector<double>> samples(n);
+	std::mt19937_64 rng(std::random_device{}());
+	for (size_t r = 0; r < config.resamples; r++) {
+		std::vector<double> sample = fitElo(n, resample(result.pairings, rng));
+		for (size_t i = 0; i < n; i++) {
+			samples[i].push_back(sample[i]);
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		EntrantResult &entrant = result.entrants[i];
+		entrant.elo = entrant.elo_low = entrant.elo_high = elo[i];
+		if (!samples[i].empty()) {
+			std::sort(samples[i].begin(), samples[i].end());
+			entrant.elo_low = samples[i][size_t(0.025 * double(samples[i].size() - 1))];
+			entrant.elo_high = samples[i][size_t(0.975 * double(samples[i].size() - 1))];
+		}
+	}
+
+	return result;
+}
+
+/*
+ * round robin between player types with their ratings and what their
+ * strength costs
+ *
+ * strength per cpu second is an entrant's rating over the first entrant's
+ * divided by the cpu seconds it spends deciding per game
+ *
+ * arguments: [-g games per pairing] [-c concurrent battles] [entrants...]
+ */
+int
+tournament(int argc, char **argv)
+{
+	TournamentConfig config;
+
+	int i = 0;
+	for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		if (std::strcmp(argv[i], "-g") == 0) {
+			config.games = std::max(1ul, std::stoul(argv[i + 1]));
+		} else if (std::strcmp(argv[i], "-c") == 0) {
+			config.concurrency = std::stoul(argv[i + 1]);
+		} else {
+			break;
+		}
+	}
+	for (; i < argc; i++) {
+		if (argv[i][0] == '-') {
+			std::cerr << "usage: tournament [-g games per pairing] [-c concurrent battles] [entrants...]"
+				  << std::endl;
+			return 1;
+		}
+		config.entrants.push_back(argv[i]);
+	}
+
+	TournamentResult result;
+	try {
+		result = runTournament(config);
+	} catch (std::invalid_argument &e) {
+		std::cerr << e.what() << "; entrants are";
+		for (const std::string &name: entrantNames()) {
+			std::cerr << " " << name;
+		}
+		std::cerr << std::endl;
+		return 1;
+	}
+
+	for (const PairingResult &p: result.pairings) {
+		std::cout << result.entrants[p.first].name << " vs " << result.entrants[p.second].name << ": "
+			  << p.wins << " wins, " << p.ties << " ties, " << p.losses << " losses\n";
+	}
+
+	std::vector<const EntrantResult *> ranked;
+	for (const EntrantResult &entrant: result.entrants) {
+		ranked.push_back(&entrant);
+	}
+	std::stable_sort(ranked.begin(), ranked.end(), [](auto *a, auto *b) { return a->elo > b->elo; });
+
+	const EntrantResult &anchor = result.entrants.front();
+	std::cout << "\n"
+		  << std::left << std::setw(14) << "entrant" << std::right << std::setw(8) << "elo" << std::setw(20)
+		  << "95% interval" << std::setw(8) << "score" << std::setw(7) << "games" << std::setw(12)
+		  << "cpu s/game" << std::setw(12) << "ms/decision" << std::setw(12) << "elo/cpu s" << "\n"
+		  << std::fixed;
+	for (const EntrantResult *entrant: ranked) {
+		double games = double(std::max<uint64_t>(1, entrant->games));
+		double cpu = std::chrono::duration<double>(entrant->cpu).count();
+		double per_game = cpu / games;
+		double per_decision = 1e3 * cpu / double(std::max<uint64_t>(1, entrant->decisions));
+
+		std::cout << std::left << std::setw(14) << entrant->name << std::right << std::setprecision(0)
+			  << std::setw(8) << entrant->elo << std::setw(9) << "[" << std::setw(4) << entrant->elo_low
+			  << ", " << std::setw(4) << entrant->elo_high << "]" << std::setprecision(1) << std::setw(8)
+			  << entrant->score << std::setw(7) << entrant->games << std::setprecision(4) << std::setw(12)
+			  << per_game << std::setprecision(3) << std::setw(12) << per_decision << std::setw(12);
+		if (entrant == &anchor || per_game <= 0) {
+			std::cout << "-";
+		} else {
+			std::cout << std::setprecision(0) << (entrant->elo - anchor.elo) / per_game;
+		}
+		std::cout << "\n";
+	}
+	std::cout << std::defaultfloat << std::setprecision(6);
+
+	std::cout << "\n"
+		  << result.pairings.size() * config.games << " games in " << result.seconds << "s";
+	if (result.aborted > 0) {
+		std::cout << ", " << result.aborted << " aborted and left out";
+	}
+	std::cout << "; ratings relative to " << anchor.name << std::endl;
+
+	return 0;
+}
+} // namespace pokezero
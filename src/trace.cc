@@ -0,0 +1,248 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "trace.hh"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "log.hh"
+
+namespace {
+struct Event {
+	const char *name;
+	int64_t start;
+	int64_t duration;
+	bool wait;
+};
+
+// a thread's buffer grows a chunk at a time, up to a million events
+constexpr size_t CHUNK_EVENTS = 4096;
+constexpr size_t MAX_CHUNKS = 256;
+
+/*
+ * events of one thread, appended only by that thread
+ *
+ * chunks are never moved or freed, so a dump can read every event below
+ * count while the thread keeps appending
+ */
+struct ThreadBuffer {
+	pid_t tid = gettid();
+	std::array<std::atomic<Event *>, MAX_CHUNKS> chunks{};
+	std::atomic<size_t> count{0};
+	std::atomic<uint64_t> dropped{0};
+};
+
+struct Registry {
+	std::mutex lock;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+	int64_t epoch = pokezero::traceNow();
+	std::string path; // written by traceToFile()
+};
+
+/*
+ * buffers outlive the threads that filled them, and the registry outlives
+ * static destructors, so a dump at exit still sees everything
+ */
+Registry &
+registry()
+{
+	static Registry *registry = new Registry();
+	return *registry;
+}
+
+thread_local ThreadBuffer *local_buffer = nullptr;
+
+/*
+ * the calling thread's buffer, registered on its first event
+ */
+ThreadBuffer *
+threadBuffer()
+{
+	if (local_buffer == nullptr) {
+		Registry &reg = registry();
+		std::lock_guard<std::mutex> lk(reg.lock);
+		reg.buffers.push_back(std::make_unique<ThreadBuffer>());
+		local_buffer = reg.buffers.back().get();
+	}
+
+	return local_buffer;
+}
+
+void
+dumpAtExit()
+{
+	pokezero::dumpTrace(registry().path);
+}
+
+/*
+ * dump the trace every time SIGUSR1 arrives
+ */
+void
+signalLoop(sigset_t signals)
+{
+	int signal;
+	while (sigwait(&signals, &signal) == 0) {
+		if (pokezero::dumpTrace(registry().path)) {
+			LOG_INFO("trace", "trace written", "path", registry().path);
+		}
+	}
+}
+} // namespace
+
+namespace pokezero {
+/*
+ * add an event that started at `start` and lasted `duration` nanoseconds to
+ * the calling thread's timeline; a wait is shown on a track of its own
+ *
+ * events past a thread's buffer capacity are counted and dropped
+ */
+void
+traceRecord(const char *name, int64_t start, int64_t duration, bool wait)
+{
+	ThreadBuffer *buffer = threadBuffer();
+
+	size_t index = buffer->count.load(std::memory_order_relaxed);
+	size_t chunk = index / CHUNK_EVENTS;
+	if (chunk >= MAX_CHUNKS) {
+		buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Event *events = buffer->chunks[chunk].load(std::memory_order_relaxed);
+	if (events == nullptr) {
+		events = new Event[CHUNK_EVENTS];
+		buffer->chunks[chunk].store(events, std::memory_order_relaxed);
+	}
+
+	events[index % CHUNK_EVENTS] = {name, start, duration, wait};
+	buffer->count.store(index + 1, std::memory_order_release);
+}
+
+/*
+ * write every event recorded so far as Chrome trace json
+ *
+ * scopes are complete events on their thread's track; waits are async
+ * begin/end pairs, which Perfetto groups into a track per name
+ */
+void
+dumpTrace(std::ostream &out)
+{
+	Registry &reg = registry();
+	std::lock_guard<std::mutex> lk(reg.lock);
+
+	pid_t pid = getpid();
+	uint64_t wait_id = 0;
+	bool first = true;
+	char line[512];
+
+	out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	for (auto &buffer: reg.buffers) {
+		size_t count = buffer->count.load(std::memory_order_acquire);
+
+		for (size_t i = 0; i < count; i++) {
+			const Event &event = buffer->chunks[i / CHUNK_EVENTS].load(std::memory_order_relaxed)[i % CHUNK_EVENTS];
+			double ts = double(event.start - reg.epoch) / 1000;
+			double dur = double(event.duration) / 1000;
+
+			if (event.wait) {
+				wait_id++;
+				std::snprintf(line, sizeof(line),
+				              "%s\n{\"name\":\"%s\",\"cat\":\"wait\",\"ph\":\"b\",\"id\":%llu,\"ts\":%.3f,"
+				              "\"pid\":%d,\"tid\":%d},"
+				              "\n{\"name\":\"%s\",\"cat\":\"wait\",\"ph\":\"e\",\"id\":%llu,\"ts\":%.3f,"
+				              "\"pid\":%d,\"tid\":%d}",
+				              first ? "" : ",", event.name, (unsigned long long) wait_id, ts, pid,
+				              buffer->tid, event.name, (unsigned long long) wait_id, ts + dur, pid, buffer->tid);
+			} else {
+				std::snprintf(line, sizeof(line),
+				              "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+				              first ? "" : ",", event.name, ts, dur, pid, buffer->tid);
+			}
+
+			out << line;
+			first = false;
+		}
+	}
+	out << "\n]}\n";
+}
+
+/*
+ * dumpTrace() into a file, replacing it; returns false if it cannot be
+ * written
+ */
+bool
+dumpTrace(const std::string &path)
+{
+	std::ofstream out(path, std::ios_base::trunc);
+	if (!out) {
+		LOG_ERROR("trace", "cannot write trace", "path", path);
+		return false;
+	}
+
+	dumpTrace(out);
+	return bool(out);
+}
+
+TraceStats
+traceStats()
+{
+	Registry &reg = registry();
+	std::lock_guard<std::mutex> lk(reg.lock);
+
+	TraceStats stats;
+	for (auto &buffer: reg.buffers) {
+		stats.events += buffer->count.load(std::memory_order_acquire);
+		stats.dropped += buffer->dropped.load(std::memory_order_relaxed);
+	}
+	stats.threads = reg.buffers.size();
+
+	return stats;
+}
+
+/*
+ * write the trace to the file at exit and whenever the process gets SIGUSR1
+ *
+ * SIGUSR1 is blocked in the calling thread and taken by a thread of its own,
+ * so this must be called before any other thread is started for them to
+ * inherit the mask
+ */
+void
+traceToFile(const std::string &path)
+{
+	registry().path = path;
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	std::thread(signalLoop, signals).detach();
+	std::atexit(dumpAtExit);
+}
+} // namespace pokezero
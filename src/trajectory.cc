@@ -0,0 +1,318 @@
+/*
+ * PokeZero: ML Pokemon battling bot
+ * Copyright (C) 2022  Mingu Kim & David Hughes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "trajectory.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+
+#include "log.hh"
+
+namespace pokezero {
+/*
+ * sample of a state for one side, with the legal actions taken from the
+ * side's showdown choices in MLVec order; the policy is left empty and the
+ * outcome a tie until they are known
+ *
+ * getChoices() offers every move and party slot, so moves out of pp or
+ * disabled, switches to the active or a fainted Pokemon, and moves when the
+ * active has fainted are dropped here. The Manager replaces the mask with the
+ * one decoded from the side's request, which this can only approximate
+ */
+TrajectoryRecord
+sampleState(const MLVec &vec, const std::vector<std::string> &choices, int turn, size_t side)
+{
+	TrajectoryRecord record;
+	std::copy(vec.begin(), vec.end(), record.state);
+	std::fill(std::begin(record.policy), std::end(record.policy), 0.0f);
+
+	SideView<const double> own = features(vec).sides()[side];
+	std::optional<PokemonView<const double>> active;
+	for (auto poke: own.pokemon()) {
+		if (poke.active() > 0) {
+			active = poke;
+		}
+	}
+	bool can_move = active && active->hp() > -1;
+
+	record.mask = 0;
+	for (size_t i = 0; i < choices.size(); i++) {
+		size_t action = parseChoice(choices[i]);
+		if (action == NoAction) {
+			continue;
+		}
+
+		if (i < MoveSlots) {
+			if (!can_move || active->moves()[i].pp() <= -1 || active->moves()[i].disabled() > 0) {
+				continue;
+			}
+		} else if (i - MoveSlots < SwitchSlots) {
+			PokemonView<const double> poke = own.pokemon()[i - MoveSlots];
+			if (poke.active() > 0 || poke.hp() <= -1) {
+				continue;
+			}
+		}
+		record.mask |= uint32_t(1) << action;
+	}
+
+	record.turn = uint16_t(turn);
+	record.side = uint8_t(side);
+	record.outcome = 0;
+
+	return record;
+}
+
+/*
+ * constructor
+ *
+ * shards are named <prefix>-000000.traj, <prefix>-000001.traj, ...; the
+ * first is created when the first buffer is flushed
+ */
+TrajectoryWriter::TrajectoryWriter(const std::string &prefix, size_t shard_bytes, size_t buffer_records)
+{
+	if (buffer_records == 0) {
+		throw std::invalid_argument("TrajectoryWriter buffer_records must be positive");
+	}
+
+	this->prefix = prefix;
+	this->buffer_records = buffer_records;
+	this->shard_records = std::max<size_t>(1, (shard_bytes - std::min(shard_bytes, sizeof(TrajectoryHeader))) /
+	                                                  sizeof(TrajectoryRecord));
+	this->active.reserve(buffer_records);
+
+	this->threads.push_back(std::thread([this]() { this->loop(); }));
+}
+
+/*
+ * destructor
+ *
+ * everything appended is written out and the last shard truncated to its
+ * records before returning
+ */
+TrajectoryWriter::~TrajectoryWriter()
+{
+	this->flush();
+
+	std::unique_lock<std::mutex> lk(this->lock);
+	this->stopping = true;
+	lk.unlock();
+	this->ready.notify_all();
+
+	for (auto &t: this->threads) {
+		t.join();
+	}
+	this->threads.clear();
+
+	this->closeShard();
+}
+
+std::string
+TrajectoryWriter::shardName(const std::string &prefix, uint64_t index)
+{
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), "-%06llu.traj", static_cast<unsigned long long>(index));
+	return prefix + suffix;
+}
+
+/*
+ * copy records into the active buffer, handing it to the flushing thread
+ * whenever it fills
+ */
+void
+TrajectoryWriter::append(const TrajectoryRecord *records, size_t count)
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	for (size_t i = 0; i < count; i++) {
+		this->active.push_back(records[i]);
+		if (this->active.size() >= this->buffer_records) {
+			this->swap();
+		}
+	}
+}
+
+/*
+ * wait until every record appended so far has been copied into a shard
+ */
+void
+TrajectoryWriter::flush()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	if (!this->active.empty()) {
+		this->swap();
+	}
+
+	while (!this->full.empty() || this->writing) {
+		this->flushed.wait(lk);
+	}
+}
+
+TrajectoryWriterStats
+TrajectoryWriter::stats()
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	return this->counts;
+}
+
+/*
+ * queue the active buffer for flushing and replace it with a spare one;
+ * called with the lock held
+ */
+void
+TrajectoryWriter::swap()
+{
+	this->full.push_back(std::move(this->active));
+	this->counts.buffer_swaps++;
+	this->counts.max_backlog = std::max(this->counts.max_backlog, this->full.size());
+
+	// the disk falling behind costs memory rather than stalling a battle
+	if (this->spare.empty()) {
+		this->active = std::vector<TrajectoryRecord>();
+		this->active.reserve(this->buffer_records);
+	} else {
+		this->active = std::move(this->spare.back());
+		this->spare.pop_back();
+	}
+
+	this->ready.notify_one();
+}
+
+void
+TrajectoryWriter::loop()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	while (true) {
+		while (this->full.empty() && !this->stopping) {
+			this->ready.wait(lk);
+		}
+
+		if (this->full.empty()) {
+			return;
+		}
+
+		std::vector<TrajectoryRecord> buffer = std::move(this->full.front());
+		this->full.pop_front();
+		this->writing = true;
+		lk.unlock();
+
+		try {
+			this->write(buffer);
+		} catch (std::exception &e) {
+			LOG_ERROR("trajectory", "write failed, dropping records", "error", e.what(), "records",
+			          buffer.size());
+		}
+
+		lk.lock();
+		this->counts.records += buffer.size();
+		buffer.clear();
+		this->spare.push_back(std::move(buffer));
+		this->writing = false;
+		this->flushed.notify_all();
+	}
+}
+
+/*
+ * copy a buffer into the mapped shard, rotating to a new shard whenever the
+ * current one is full
+ */
+void
+TrajectoryWriter::write(const std::vector<TrajectoryRecord> &buffer)
+{
+	size_t done = 0;
+	while (done < buffer.size()) {
+		if (this->shard == nullptr || this->shard->records == this->shard_records) {
+			this->closeShard();
+			this->openShard();
+		}
+
+		size_t count = std::min(buffer.size() - done, size_t(this->shard_records - this->shard->records));
+		TrajectoryRecord *records = reinterpret_cast<TrajectoryRecord *>(this->shard + 1);
+		std::memcpy(records + this->shard->records, buffer.data() + done, count * sizeof(TrajectoryRecord));
+
+		this->shard->records += count;
+		done += count;
+	}
+}
+
+void
+TrajectoryWriter::openShard()
+{
+	std::unique_lock<std::mutex> lk(this->lock);
+	std::string name = shardName(this->prefix, this->counts.shards++);
+	lk.unlock();
+
+	this->fd = open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (this->fd < 0) {
+		throw std::system_error(errno, std::generic_category(), name);
+	}
+
+	this->shard_size = sizeof(TrajectoryHeader) + this->shard_records * sizeof(TrajectoryRecord);
+	if (ftruncate(this->fd, off_t(this->shard_size)) < 0) {
+		int err = errno;
+		close(this->fd);
+		this->fd = -1;
+		throw std::system_error(err, std::generic_category(), name);
+	}
+
+	void *map = mmap(nullptr, this->shard_size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+	if (map == MAP_FAILED) {
+		int err = errno;
+		close(this->fd);
+		this->fd = -1;
+		throw std::system_error(err, std::generic_category(), name);
+	}
+
+	this->shard = new (map) TrajectoryHeader;
+	std::memcpy(this->shard->magic, TrajectoryHeader::Magic, sizeof(this->shard->magic));
+	this->shard->record_size = sizeof(TrajectoryRecord);
+	this->shard->state_size = BattleStateSize;
+	this->shard->action_count = ActionCount;
+	this->shard->records = 0;
+	this->shard->schema = FeatureSchemaHash;
+}
+
+/*
+ * unmap the current shard and cut the file down to the records written
+ */
+void
+TrajectoryWriter::closeShard()
+{
+	if (this->shard == nullptr) {
+		return;
+	}
+
+	size_t used = sizeof(TrajectoryHeader) + this->shard->records * sizeof(TrajectoryRecord);
+	munmap(this->shard, this->shard_size);
+	this->shard = nullptr;
+
+	if (ftruncate(this->fd, off_t(used)) < 0) {
+		LOG_ERROR("trajectory", "shard truncate failed", "error", std::strerror(errno));
+	}
+	close(this->fd);
+	this->fd = -1;
+}
+} // namespace pokezero